@@ -2,14 +2,21 @@
 
 #include "common/serializer.hpp"
 
+#include <cmath>
+#include <cstring>
 #include <iostream>
 
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define WING_BLOOM_AVX2
+#include <immintrin.h>
+#endif
+
 namespace wing {
 
 namespace utils {
 
 void BloomFilter::Create(
-    size_t key_n, size_t bits_per_key, std::string& bloom_bits) {
+    size_t key_n, double bits_per_key, std::string& bloom_bits) {
   size_t bits = key_n * bits_per_key;
   bits = std::max<size_t>(64, bits);
   size_t bytes = (bits + 7) / 8;
@@ -17,7 +24,7 @@ void BloomFilter::Create(
   utils::Serializer(bloom_bits.data())
       .Write<uint64_t>(bits)
       .Write<uint64_t>(key_n)
-      .Write<uint64_t>(bits_per_key);
+      .Write<uint64_t>(std::lround(bits_per_key));
 }
 
 void BloomFilter::Add(std::string_view key, std::string& bloom_bits) {
@@ -67,6 +74,114 @@ bool BloomFilter::Find(size_t h, std::string_view bloom_bits) {
   return true;
 }
 
+/**
+ * The i-th probe of a key sets bit (h * kProbeSalts[i]) >> 23 of its block,
+ * where h is the lower 32 bits of the hash. The salts are odd, so that the
+ * bits are different for different probes.
+ */
+alignas(32) static const uint32_t kProbeSalts[16] = {0x47b6137bU,
+    0x44974d91U, 0x8824ad5bU, 0xa2b7289dU, 0x705495c7U, 0x2df1424bU,
+    0x9efc4947U, 0x5c6bfb31U, 0x9e3779b1U, 0x85ebca77U, 0xc2b2ae3dU,
+    0x27d4eb2fU, 0x165667b1U, 0xd3a2646bU, 0xfd7046c5U, 0xb55a4f09U};
+
+/* Lanes [8 - n, 16 - n) are the mask of the first n lanes. */
+alignas(32) static const int32_t kLaneMask[16] = {
+    -1, -1, -1, -1, -1, -1, -1, -1, 0, 0, 0, 0, 0, 0, 0, 0};
+
+/* Select the block by the higher 32 bits of the hash. */
+static size_t BlockOffset(size_t h, size_t num_blocks) {
+  return ((h >> 32) * num_blocks >> 32) * BlockedBloomFilter::kBlockSize;
+}
+
+static bool FindInBlockScalar(
+    const char* block, uint32_t h, size_t num_probes) {
+  for (size_t i = 0; i < num_probes; i++) {
+    uint32_t bit = (h * kProbeSalts[i]) >> 23;
+    uint32_t word;
+    std::memcpy(&word, block + bit / 32 * sizeof(uint32_t), sizeof(word));
+    if (!(word & (1U << (bit & 31)))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+#ifdef WING_BLOOM_AVX2
+__attribute__((target("avx2"))) static bool FindInBlockAVX2(
+    const char* block, uint32_t h, size_t num_probes) {
+  const __m256i hash = _mm256_set1_epi32(h);
+  for (size_t i = 0; i < num_probes; i += 8) {
+    __m256i salts = _mm256_load_si256(
+        reinterpret_cast<const __m256i*>(kProbeSalts + i));
+    __m256i bits = _mm256_srli_epi32(_mm256_mullo_epi32(hash, salts), 23);
+    __m256i words = _mm256_i32gather_epi32(
+        reinterpret_cast<const int*>(block), _mm256_srli_epi32(bits, 5), 4);
+    __m256i mask = _mm256_sllv_epi32(_mm256_set1_epi32(1),
+        _mm256_and_si256(bits, _mm256_set1_epi32(31)));
+    if (num_probes - i < 8) {
+      mask = _mm256_and_si256(mask,
+          _mm256_loadu_si256(reinterpret_cast<const __m256i*>(
+              kLaneMask + 8 - (num_probes - i))));
+    }
+    /* All the bits of the mask must be set in the words. */
+    if (!_mm256_testc_si256(words, mask)) {
+      return false;
+    }
+  }
+  return true;
+}
+#endif
+
+void BlockedBloomFilter::Create(
+    size_t key_n, double bits_per_key, std::string& bloom_bits) {
+  size_t bits = key_n * bits_per_key;
+  size_t num_blocks = std::max<size_t>(1, (bits + kBlockSize * 8 - 1) /
+                                              (kBlockSize * 8));
+  size_t num_probes =
+      std::min<size_t>(kMaxProbes, std::max<size_t>(1, bits_per_key * 0.69));
+  bloom_bits.resize(num_blocks * kBlockSize + sizeof(uint64_t) * 2, 0);
+  utils::Serializer(bloom_bits.data())
+      .Write<uint64_t>(num_blocks)
+      .Write<uint64_t>(num_probes);
+}
+
+void BlockedBloomFilter::Add(std::string_view key, std::string& bloom_bits) {
+  Add(BloomFilter::BloomHash(key), bloom_bits);
+}
+
+void BlockedBloomFilter::Add(size_t h, std::string& bloom_bits) {
+  auto des = utils::Deserializer(bloom_bits.data());
+  size_t num_blocks = des.Read<uint64_t>();
+  size_t num_probes = des.Read<uint64_t>();
+  auto* block = const_cast<char*>(des.data()) + BlockOffset(h, num_blocks);
+  for (size_t i = 0; i < num_probes; i++) {
+    uint32_t bit = (static_cast<uint32_t>(h) * kProbeSalts[i]) >> 23;
+    uint32_t word;
+    std::memcpy(&word, block + bit / 32 * sizeof(uint32_t), sizeof(word));
+    word |= 1U << (bit & 31);
+    std::memcpy(block + bit / 32 * sizeof(uint32_t), &word, sizeof(word));
+  }
+}
+
+bool BlockedBloomFilter::Find(
+    std::string_view key, std::string_view bloom_bits) {
+  return Find(BloomFilter::BloomHash(key), bloom_bits);
+}
+
+bool BlockedBloomFilter::Find(size_t h, std::string_view bloom_bits) {
+  auto des = utils::Deserializer(bloom_bits.data());
+  size_t num_blocks = des.Read<uint64_t>();
+  size_t num_probes = des.Read<uint64_t>();
+  auto* block = des.data() + BlockOffset(h, num_blocks);
+#ifdef WING_BLOOM_AVX2
+  static const bool has_avx2 = __builtin_cpu_supports("avx2");
+  if (has_avx2) {
+    return FindInBlockAVX2(block, h, num_probes);
+  }
+#endif
+  return FindInBlockScalar(block, h, num_probes);
+}
+
 }  // namespace utils
 
 }  // namespace wing
@@ -14,7 +14,7 @@ class BloomFilter {
 
   /* Create a bloom filter buffer */
   static void Create(
-      size_t key_n, size_t bits_per_key, std::string& bloom_bits);
+      size_t key_n, double bits_per_key, std::string& bloom_bits);
 
   /* Add a key to the bloom filter */
   static void Add(std::string_view key, std::string& bloom_bits);
@@ -29,6 +29,40 @@ class BloomFilter {
   static bool Find(size_t hash1, std::string_view bloom_bits);
 };
 
+/**
+ * A bloom filter whose bits of each key are in one 64-byte block, i.e. a
+ * cache line, so that a lookup costs about one cache miss instead of one for
+ * each probe. It has a slightly higher false positive rate than BloomFilter
+ * with the same number of bits. The probes are checked 8 at a time with
+ * AVX2 if the CPU supports it.
+ *
+ * Representation:
+ * [number of blocks: uint64_t][number of probes: uint64_t]
+ * then the blocks, each of which is 16 uint32_t.
+ */
+class BlockedBloomFilter {
+ public:
+  static constexpr size_t kBlockSize = 64;
+  /* The maximum number of probes, i.e. bits set for each key. */
+  static constexpr size_t kMaxProbes = 16;
+
+  /* Create a bloom filter buffer */
+  static void Create(
+      size_t key_n, double bits_per_key, std::string& bloom_bits);
+
+  /* Add a key to the bloom filter */
+  static void Add(std::string_view key, std::string& bloom_bits);
+
+  /* Add a key hash (i.e. BloomFilter::BloomHash(key)) to the bloom filter */
+  static void Add(size_t hash1, std::string& bloom_bits);
+
+  /* Check if a key may be added */
+  static bool Find(std::string_view key, std::string_view bloom_bits);
+
+  /* Check if a key (i.e. BloomFilter::BloomHash(key)) may be added */
+  static bool Find(size_t hash1, std::string_view bloom_bits);
+};
+
 }  // namespace utils
 
 }  // namespace wing
@@ -66,13 +66,16 @@ class InsertExecutor : public Executor {
     }
     // Release the iterator
     ch_ = nullptr;
-    // Insert the tuples
+    // Insert the tuples as a batch
+    std::vector<std::pair<std::string_view, std::string_view>> kvs;
+    kvs.reserve(insert_rows_.size());
     for (auto& row : insert_rows_) {
       auto key_view =
           Tuple::GetFieldView(row.data(), pk_offset_, pk_type_, pk_size_);
-      if (!handle_->Insert(key_view, row)) {
-        throw DBException("Insert error: duplicate key!");
-      }
+      kvs.emplace_back(key_view, row);
+    }
+    if (!handle_->InsertBatch(kvs)) {
+      throw DBException("Insert error: duplicate key!");
     }
     insert_row_counts_.data_.int_data = insert_rows_.size();
     return reinterpret_cast<const uint8_t*>(&insert_row_counts_);
@@ -1,11 +1,41 @@
 #include "storage/lsm/block.hpp"
-#include <iostream>
 
 namespace wing {
 
 namespace lsm {
 
+/* Write v as a varint32 to buf. Return the number of bytes. */
+static size_t EncodeVarint32(char* buf, uint32_t v) {
+  size_t n = 0;
+  while (v >= 0x80) {
+    buf[n++] = static_cast<char>(v | 0x80);
+    v >>= 7;
+  }
+  buf[n++] = static_cast<char>(v);
+  return n;
+}
+
+static const char* DecodeVarint32(const char* p, uint32_t* v) {
+  uint32_t result = 0;
+  for (uint32_t shift = 0; shift <= 28; shift += 7) {
+    uint32_t byte = static_cast<uint8_t>(*p++);
+    result |= (byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      break;
+    }
+  }
+  *v = result;
+  return p;
+}
+
 bool BlockBuilder::Append(ParsedKey key, Slice value) {
+  if (format_ == SSTFormat::kPlain) {
+    return AppendPlain(key, value);
+  }
+  return AppendPrefixCompressed(key, value);
+}
+
+bool BlockBuilder::AppendPlain(ParsedKey key, Slice value) {
   // Calculate the size needed to store the key and value
   size_t key_size = key.size();
   size_t value_size = value.size();
@@ -19,7 +49,6 @@ bool BlockBuilder::Append(ParsedKey key, Slice value) {
   // Append the key to the block
   offset_t key_length = static_cast<offset_t>(key_size);
   file_->Append(reinterpret_cast<const char*>(&key_length), sizeof(offset_t));
-  // file_->Append(reinterpret_cast<const char*>(&key), key_size);
   file_->Append(key.user_key_.data(), key.user_key_.size());
   file_->Append(reinterpret_cast<const char*>(&key.seq_), sizeof(key.seq_));
   file_->Append(reinterpret_cast<const char*>(&key.type_), sizeof(key.type_));
@@ -35,14 +64,52 @@ bool BlockBuilder::Append(ParsedKey key, Slice value) {
   // Update the current size and offset
   current_size_ += entry_size;
   offset_ += sizeof(offset_t) * 2 + key_size + value_size;
-  last_key_ = key;
+  last_key_ = InternalKey(key).GetSlice();
+  count_ += 1;
 
   return true;
 }
 
-void BlockBuilder::Finish() { 
-  // If there are no offsets, there is nothing to finish
-  if (offsets_.empty()) {
+bool BlockBuilder::AppendPrefixCompressed(ParsedKey key, Slice value) {
+  InternalKey ikey(key);
+  Slice key_slice = ikey.GetSlice();
+  bool restart = count_ % restart_interval_ == 0;
+  size_t shared = 0;
+  if (!restart) {
+    size_t max_shared = std::min(last_key_.size(), key_slice.size());
+    while (shared < max_shared && last_key_[shared] == key_slice[shared]) {
+      shared++;
+    }
+  }
+  size_t unshared = key_slice.size() - shared;
+  char header[15];
+  size_t header_size = EncodeVarint32(header, shared);
+  header_size += EncodeVarint32(header + header_size, unshared);
+  header_size += EncodeVarint32(header + header_size, value.size());
+  size_t entry_size = header_size + unshared + value.size();
+  /* The restart array and its length are written in Finish(). */
+  size_t trailer_size = sizeof(offset_t) * (offsets_.size() + restart + 1);
+  if (count_ > 0 && offset_ + entry_size + trailer_size > block_size_) {
+    return false;
+  }
+
+  if (restart) {
+    offsets_.push_back(offset_);
+  }
+  file_->Append(header, header_size);
+  file_->Append(key_slice.data() + shared, unshared);
+  file_->Append(value.data(), value.size());
+
+  offset_ += entry_size;
+  current_size_ = offset_ + trailer_size;
+  last_key_ = key_slice;
+  count_ += 1;
+  return true;
+}
+
+void BlockBuilder::Finish() {
+  // If there are no entries, there is nothing to finish
+  if (count_ == 0) {
     return;
   }
 
@@ -50,101 +117,121 @@ void BlockBuilder::Finish() {
   for (const auto& offset : offsets_) {
     file_->Append(reinterpret_cast<const char*>(&offset), sizeof(offset));
   }
+  if (format_ == SSTFormat::kPrefixCompressed) {
+    offset_t num_restarts = offsets_.size();
+    file_->Append(
+        reinterpret_cast<const char*>(&num_restarts), sizeof(num_restarts));
+  }
 }
 
-/* Find key0 == user_key && largest seq0 <= seq */
-/* If not found, return the sentinel (invalid) */
-void BlockIterator::Seek(Slice user_key, seq_t seq) {
-  // linear search
-  /*
-  ParsedKey target_key(user_key, seq, RecordType::Value);
-  SeekToFirst();
-  while (Valid() && !(ParsedKey(current_key_) >= target_key)) {
-    Next();
+BlockIterator::BlockIterator(
+    const char* data, BlockHandle handle, SSTFormat format)
+  : data_(data), handle_(handle), format_(format) {
+  if (handle_.count_ == 0) {
+    return;
   }
+  if (format_ == SSTFormat::kPlain) {
+    data_end_ = handle_.size_ - handle_.count_ * sizeof(offset_t);
+    restarts_ = reinterpret_cast<const offset_t*>(data_ + data_end_);
+    num_restarts_ = handle_.count_;
+  } else {
+    num_restarts_ = *reinterpret_cast<const offset_t*>(
+        data_ + handle_.size_ - sizeof(offset_t));
+    data_end_ = handle_.size_ - (num_restarts_ + 1) * sizeof(offset_t);
+    restarts_ = reinterpret_cast<const offset_t*>(data_ + data_end_);
+  }
+}
 
-  if (handle_.count_ == 0) {
+void BlockIterator::ParseEntry() {
+  if (current_offset_ >= data_end_) {
     current_key_ = Slice();
     current_value_ = Slice();
     return;
   }
-  */
-
-  ParsedKey target_key(user_key, seq, RecordType::Value);
+  const char* p = data_ + current_offset_;
+  if (format_ == SSTFormat::kPlain) {
+    offset_t key_length = *reinterpret_cast<const offset_t*>(p);
+    current_key_ = Slice(p + sizeof(offset_t), key_length);
+    p += sizeof(offset_t) + key_length;
+    offset_t value_length = *reinterpret_cast<const offset_t*>(p);
+    current_value_ = Slice(p + sizeof(offset_t), value_length);
+    next_offset_ = current_offset_ + sizeof(offset_t) * 2 + key_length +
+                   value_length;
+    return;
+  }
+  uint32_t shared, unshared, value_length;
+  p = DecodeVarint32(p, &shared);
+  p = DecodeVarint32(p, &unshared);
+  p = DecodeVarint32(p, &value_length);
+  key_buf_.resize(shared);
+  key_buf_.append(p, unshared);
+  current_value_ = Slice(p + unshared, value_length);
+  next_offset_ = (p - data_) + unshared + value_length;
+}
 
-  const char* offset_array_start = data_ + handle_.size_ - handle_.count_ * sizeof(offset_t);
-  const offset_t* offsets = reinterpret_cast<const offset_t*>(offset_array_start);
+void BlockIterator::SeekToRestart(size_t i) {
+  key_buf_.clear();
+  current_offset_ = restarts_[i];
+  ParseEntry();
+}
 
+/* Find key0 == user_key && largest seq0 <= seq */
+/* If not found, return the sentinel (invalid) */
+void BlockIterator::Seek(Slice user_key, seq_t seq) {
+  if (num_restarts_ == 0) {
+    current_offset_ = data_end_;
+    return;
+  }
+  ParsedKey target_key(user_key, seq, RecordType::Value);
+  /**
+   * In a plain block every entry is a restart point.
+   * Find the last restart point whose key < target_key.
+   */
   size_t left = 0;
-  size_t right = handle_.count_;
+  size_t right = num_restarts_;
   while (left < right) {
     size_t mid = (left + right) / 2;
-    const char* key_ptr = data_ + offsets[mid];
-    offset_t key_length = *reinterpret_cast<const offset_t*>(key_ptr);
-    Slice mid_key(key_ptr + sizeof(offset_t), key_length);
-    // seq_t mid_seq = *reinterpret_cast<const seq_t*>(key_ptr + sizeof(offset_t) + key_length);
-
-    ParsedKey mid_parsed_key(mid_key);
-    if (mid_parsed_key < target_key) {
+    SeekToRestart(mid);
+    if (ParsedKey(key()) < target_key) {
       left = mid + 1;
     } else {
       right = mid;
     }
   }
-
-  index_ = left;
-  if (index_ < handle_.count_) {
-    current_offset_ = offsets[index_];
-    offset_t key_length = *reinterpret_cast<const offset_t*>(data_ + current_offset_);
-    current_key_ = Slice(data_ + current_offset_ + sizeof(offset_t), key_length);
-    offset_t value_length = *reinterpret_cast<const offset_t*>(data_ + current_offset_ + sizeof(offset_t) + key_length);
-    current_value_ = Slice(data_ + current_offset_ + sizeof(offset_t) * 2 + key_length, value_length);
-  } else {
-    current_key_ = Slice();
-    current_value_ = Slice();
+  if (format_ == SSTFormat::kPlain) {
+    current_offset_ = left < num_restarts_ ? restarts_[left] : data_end_;
+    ParseEntry();
+    return;
+  }
+  /* Scan from the restart point. */
+  SeekToRestart(left == 0 ? 0 : left - 1);
+  while (Valid() && ParsedKey(key()) < target_key) {
+    Next();
   }
 }
 
 void BlockIterator::SeekToFirst() {
+  key_buf_.clear();
   current_offset_ = 0;
-  index_ = 0;
-  if (handle_.count_ > 0) {
-    offset_t key_length = *reinterpret_cast<const offset_t*>(data_);
-    current_key_ = Slice(data_ + sizeof(offset_t), key_length);
-    offset_t value_length = *reinterpret_cast<const offset_t*>(data_ + sizeof(offset_t) + key_length);
-    current_value_ = Slice(data_ + sizeof(offset_t) * 2 + key_length, value_length);
-  } else {
-    current_key_ = Slice();
-    current_value_ = Slice();
-  }
+  ParseEntry();
 }
 
 Slice BlockIterator::key() const {
-  return current_key_;
+  if (format_ == SSTFormat::kPlain) {
+    return current_key_;
+  }
+  return key_buf_;
 }
 
-Slice BlockIterator::value() const {
-  return current_value_;
-}
+Slice BlockIterator::value() const { return current_value_; }
 
 void BlockIterator::Next() {
   if (!Valid()) return;
-  index_ ++;
-  current_offset_ += sizeof(offset_t) * 2 + current_key_.size() + current_value_.size();
-  if (index_ == handle_.count_) {
-    current_key_ = Slice();
-    current_value_ = Slice();
-    return;
-  }
-  offset_t key_length = *reinterpret_cast<const offset_t*>(data_ + current_offset_);
-  current_key_ = Slice(data_ + current_offset_ + sizeof(offset_t), key_length);
-  offset_t value_length = *reinterpret_cast<const offset_t*>(data_ + current_offset_ + sizeof(offset_t) + current_key_.size());
-  current_value_ = Slice(data_ + current_offset_ + sizeof(offset_t) * 2 + current_key_.size(), value_length);
+  current_offset_ = next_offset_;
+  ParseEntry();
 }
 
-bool BlockIterator::Valid() { 
-  return handle_.count_ > 0 && index_ < handle_.count_;
-}
+bool BlockIterator::Valid() { return current_offset_ < data_end_; }
 
 }  // namespace lsm
 
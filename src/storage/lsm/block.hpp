@@ -8,10 +8,28 @@ namespace wing {
 
 namespace lsm {
 
+/**
+ * SSTFormat::kPlain:
+ * [entry 0]...[entry n-1][offset 0]...[offset n-1], where an entry is
+ * [key length: offset_t][internal key][value length: offset_t][value]
+ *
+ * SSTFormat::kPrefixCompressed:
+ * [entry 0]...[entry n-1][restart 0]...[restart m-1][m: offset_t], where an
+ * entry is
+ * [shared: varint32][unshared: varint32][value length: varint32]
+ * [unshared key bytes][value]
+ * The key shares its first `shared` bytes with the previous key. The entries
+ * at restart points have shared = 0, so the search starts from them.
+ */
 class BlockBuilder {
  public:
-  BlockBuilder(size_t block_size, FileWriter* file)
-    : block_size_(block_size), file_(file) {}
+  BlockBuilder(size_t block_size, FileWriter* file,
+      SSTFormat format = SSTFormat::kPrefixCompressed,
+      size_t restart_interval = 16)
+    : block_size_(block_size),
+      file_(file),
+      format_(format),
+      restart_interval_(restart_interval) {}
 
   /**
    * It appends key and value to the end of the block
@@ -26,7 +44,7 @@ class BlockBuilder {
    *
    * It is called when the block is full,
    * or there is no more key value pairs.
-   * It writes all the offsets to the end of the block.
+   * It writes all the offsets (or restart points) to the end of the block.
    * */
   void Finish();
 
@@ -34,28 +52,42 @@ class BlockBuilder {
   size_t size() const { return current_size_; }
 
   /* The number of key-value pairs. */
-  size_t count() const { return offsets_.size(); }
+  size_t count() const { return count_; }
 
   void Clear() {
-    current_size_ = offset_ = 0;
+    current_size_ = offset_ = count_ = 0;
     offsets_.clear();
+    last_key_.clear();
   }
 
-  ParsedKey GetLastKey() { return last_key_; };
+  ParsedKey GetLastKey() { return ParsedKey(Slice(last_key_)); };
 
  private:
+  bool AppendPlain(ParsedKey key, Slice value);
+
+  bool AppendPrefixCompressed(ParsedKey key, Slice value);
+
   /* The maximum size of a block */
   size_t block_size_{0};
   /* The current used size of the block. */
   size_t current_size_{0};
   /* The current offset of the key value region */
   offset_t offset_{0};
+  /* The number of key-value pairs. */
+  size_t count_{0};
   /* The writer. */
   FileWriter* file_{nullptr};
-  /* The last key of a block */
-  ParsedKey last_key_{ParsedKey()};
+  /* The format of the block. */
+  SSTFormat format_;
+  /* The number of keys between restart points. */
+  size_t restart_interval_;
+  /* The last internal key of the block */
+  std::string last_key_;
 
-  /* The offsets of the records in the block. */
+  /**
+   * The offsets of the records in the block,
+   * or the offsets of the restart points.
+   */
   std::vector<offset_t> offsets_;
 };
 
@@ -64,15 +96,8 @@ class BlockIterator final : public Iterator {
   BlockIterator() = default;
 
   /* data is a pointer to the beginning of the block. */
-  BlockIterator(const char* data, BlockHandle handle) : 
-    data_(data), 
-    handle_(handle), 
-    current_offset_(0), 
-    index_(0),
-    current_key_(Slice()),
-    current_value_(Slice()) {
-    // DB_ERR("Not implemented!");
-  }
+  BlockIterator(const char* data, BlockHandle handle,
+      SSTFormat format = SSTFormat::kPrefixCompressed);
 
   /* Move the the beginning */
   void SeekToFirst();
@@ -89,13 +114,28 @@ class BlockIterator final : public Iterator {
 
   bool Valid() override;
 
- // private:
+ private:
+  /* Decode the entry at current_offset_. */
+  void ParseEntry();
+
+  /* Decode the entry at restart point i. */
+  void SeekToRestart(size_t i);
+
   const char* data_{nullptr};
-  BlockHandle handle_;
-  size_t current_offset_;
-  offset_t index_;
+  BlockHandle handle_{};
+  SSTFormat format_{SSTFormat::kPlain};
+  /* The end of the entries. */
+  size_t data_end_{0};
+  /* The restart points of a prefix-compressed block. */
+  const offset_t* restarts_{nullptr};
+  size_t num_restarts_{0};
+  /* The offset of the current entry, and the next entry. */
+  size_t current_offset_{0};
+  size_t next_offset_{0};
   Slice current_key_;
   Slice current_value_;
+  /* The whole key of a prefix-compressed entry. */
+  std::string key_buf_;
 };
 
 }  // namespace lsm
@@ -1,79 +1,212 @@
 #include "storage/lsm/cache.hpp"
 
-#include <fcntl.h>
-#include <sys/stat.h>
-#include <unistd.h>
-
-#include <tuple>
-#include <utility>
+#include "common/logging.hpp"
 
 namespace wing {
 
 namespace lsm {
 
-void Cache::unref_block(CacheKey cache_key) {
-  std::unique_lock<std::mutex> lock(mu_);
-  auto it = cache_.find(cache_key);
-  wing_assert(it != cache_.end());
-  size_t ori = it->second.refcount.fetch_sub(1, std::memory_order_relaxed);
-  if (ori == 1) {
-    auto lru_it = lru_list_.insert(lru_list_.end(), cache_key);
-    auto ret = lru_map_.insert(std::make_pair(cache_key, lru_it));
-    wing_assert(ret.second == true);
-  }
-}
-
-void Cache::evict() {
-  wing_assert(size_ >= capacity_);
-  do {
-    wing_assert(lru_list_.empty(), "Cache capacity too small!");
-    auto it = lru_list_.begin();
-    const CacheKey &cache_key = *it;
-    wing_assert(lru_map_.erase(cache_key) == 1);
-    auto it2 = cache_.find(cache_key);
-    wing_assert(it2 != cache_.end());
-    size_t refcount = it2->second.refcount.load(std::memory_order_relaxed);
-    wing_assert_eq(refcount, (size_t)0);
-    size_ -= it2->second.block.size();
-    cache_.erase(it2);
-    lru_list_.erase(it);
-  } while (size_ >= capacity_);
+Cache::Handle::~Handle() {
+  if (entry_ != nullptr) {
+    shard_->Release(entry_);
+  }
 }
 
+std::string_view Cache::Handle::block() const { return entry_->block_; }
+
+Cache::Cache(const CacheOptions &options) {
+  wing_assert(options.num_shards > 0, "Cache needs at least 1 shard!");
+  for (size_t i = 0; i < options.num_shards; i++) {
+    shards_.push_back(std::make_unique<Shard>(
+        options.capacity / options.num_shards, options.policy, options.lru_k));
+  }
+}
+
+Cache::~Cache() = default;
+
 std::optional<Cache::Handle> Cache::get(
-    uint64_t sstable_id, BlockHandle block) {
+    uint64_t sstable_id, BlockHandle block, CachePriority priority) {
   CacheKey cache_key(sstable_id, block.offset_);
-  std::unique_lock<std::mutex> lock(mu_);
-  auto it = cache_.find(cache_key);
-  if (it == cache_.end()) {
+  auto shard = GetShard(cache_key);
+  auto e = shard->Lookup(cache_key, priority);
+  if (e == nullptr) {
     return std::nullopt;
   }
-  size_t ori_refcount =
-      it->second.refcount.fetch_add(1, std::memory_order_relaxed);
-  if (ori_refcount == 0) {
-    auto map_it = lru_map_.find(cache_key);
-    wing_assert(map_it != lru_map_.end());
-    lru_list_.erase(map_it->second);
-    lru_map_.erase(map_it);
-  }
-  return Handle(*this, cache_key, it->second.block);
+  return Handle(shard, e);
 }
 
-Cache::Handle Cache::insert(
-    uint64_t sstable_id, BlockHandle block, std::string &&content) {
+Cache::Handle Cache::insert(uint64_t sstable_id, BlockHandle block,
+    std::string &&content, CachePriority priority) {
   CacheKey cache_key(sstable_id, block.offset_);
-  size_t size = content.size();
-  std::unique_lock<std::mutex> lock(mu_);
-  auto ret =
-      cache_.emplace(std::piecewise_construct, std::forward_as_tuple(cache_key),
-          std::forward_as_tuple(std::move(content), 1));
-  if (ret.second) {
-    size_ += size;
-    if (size_ > capacity_) {
-      evict();
+  auto shard = GetShard(cache_key);
+  return Handle(shard, shard->Insert(cache_key, std::move(content), priority));
+}
+
+uint64_t Cache::NewId() {
+  static std::atomic<uint64_t> next_id{0};
+  return next_id.fetch_add(1, std::memory_order_relaxed);
+}
+
+CacheStats Cache::GetStats() {
+  CacheStats ret;
+  for (auto &shard : shards_) {
+    auto stats = shard->GetStats();
+    ret.hits_ += stats.hits_;
+    ret.misses_ += stats.misses_;
+    ret.evictions_ += stats.evictions_;
+    ret.size_ += stats.size_;
+  }
+  return ret;
+}
+
+Cache::Shard::~Shard() {
+  for (auto &[key, e] : table_) {
+    wing_assert(e->refcount_ == 0, "Cache is destroyed with pinned blocks!");
+    delete e;
+  }
+}
+
+Cache::Entry *Cache::Shard::Lookup(
+    const CacheKey &key, CachePriority priority) {
+  std::unique_lock lck(mu_);
+  auto it = table_.find(key);
+  if (it == table_.end()) {
+    stats_.misses_ += 1;
+    return nullptr;
+  }
+  stats_.hits_ += 1;
+  Ref(it->second);
+  Access(it->second, priority);
+  return it->second;
+}
+
+Cache::Entry *Cache::Shard::Insert(
+    const CacheKey &key, std::string &&content, CachePriority priority) {
+  std::unique_lock lck(mu_);
+  auto it = table_.find(key);
+  if (it != table_.end()) {
+    /* Another thread has inserted it after our miss. */
+    Ref(it->second);
+    Access(it->second, priority);
+    return it->second;
+  }
+  auto e = new Entry(key, std::move(content));
+  table_.emplace(key, e);
+  size_ += e->block_.size();
+  e->refcount_ = 1;
+  Access(e, priority);
+  Evict();
+  return e;
+}
+
+void Cache::Shard::Release(Entry *e) {
+  std::unique_lock lck(mu_);
+  wing_assert(e->refcount_ > 0);
+  if (--e->refcount_ == 0) {
+    AddEvictable(e, e->low_priority_);
+    Evict();
+  }
+}
+
+CacheStats Cache::Shard::GetStats() {
+  std::unique_lock lck(mu_);
+  auto ret = stats_;
+  ret.size_ = size_;
+  return ret;
+}
+
+void Cache::Shard::Access(Entry *e, CachePriority priority) {
+  if (priority == CachePriority::kLow) {
+    return;
+  }
+  e->low_priority_ = false;
+  if (policy_ == CachePolicy::kClock) {
+    e->referenced_ = true;
+  } else {
+    /* The entry is pinned, so it is not in lru_k_ now. */
+    if (e->history_.size() == k_) {
+      e->history_.erase(e->history_.begin());
+    }
+    e->history_.push_back(++clock_time_);
+  }
+}
+
+void Cache::Shard::Ref(Entry *e) {
+  if (e->refcount_++ == 0) {
+    /* It is pinned now. */
+    RemoveEvictable(e);
+  }
+}
+
+Cache::Shard::LRUKKey Cache::Shard::GetLRUKKey(Entry *e) const {
+  if (e->history_.size() < k_) {
+    /* Fewer than K accesses: the backward K-distance is infinite. */
+    return {false, e->history_.empty() ? 0 : e->history_.back(), e};
+  }
+  return {true, e->history_.front(), e};
+}
+
+void Cache::Shard::AddEvictable(Entry *e, bool low_priority) {
+  if (policy_ == CachePolicy::kClock) {
+    if (low_priority) {
+      /* It is the next one to be checked by the hand. */
+      e->clock_it_ = clock_.insert(hand_, e);
+      hand_ = e->clock_it_;
+    } else {
+      /* It is the last one to be checked by the hand. */
+      e->clock_it_ = clock_.insert(hand_, e);
+    }
+  } else {
+    lru_k_.insert(GetLRUKKey(e));
+  }
+}
+
+void Cache::Shard::RemoveEvictable(Entry *e) {
+  if (policy_ == CachePolicy::kClock) {
+    if (hand_ == e->clock_it_) {
+      ++hand_;
+    }
+    clock_.erase(e->clock_it_);
+  } else {
+    lru_k_.erase(GetLRUKKey(e));
+  }
+}
+
+Cache::Entry *Cache::Shard::PickVictim() {
+  if (policy_ == CachePolicy::kLRUK) {
+    return lru_k_.empty() ? nullptr : std::get<2>(*lru_k_.begin());
+  }
+  /* All the reference bits are cleared in the first round. */
+  for (size_t i = 0; i <= clock_.size() * 2; i++) {
+    if (hand_ == clock_.end()) {
+      hand_ = clock_.begin();
+      if (hand_ == clock_.end()) {
+        return nullptr;
+      }
+    }
+    auto e = *hand_;
+    if (!e->referenced_) {
+      return e;
+    }
+    e->referenced_ = false;
+    ++hand_;
+  }
+  return nullptr;
+}
+
+void Cache::Shard::Evict() {
+  while (size_ > capacity_) {
+    auto e = PickVictim();
+    if (e == nullptr) {
+      /* All the blocks are pinned. */
+      return;
     }
+    RemoveEvictable(e);
+    table_.erase(e->key_);
+    size_ -= e->block_.size();
+    stats_.evictions_ += 1;
+    delete e;
   }
-  return Handle(*this, std::move(cache_key), ret.first->second.block);
 }
 
 }  // namespace lsm
@@ -1,11 +1,14 @@
 #pragma once
 
 #include <atomic>
-#include <functional>
 #include <list>
+#include <memory>
 #include <mutex>
 #include <optional>
+#include <set>
+#include <tuple>
 #include <unordered_map>
+#include <vector>
 
 #include "storage/lsm/format.hpp"
 
@@ -13,8 +16,34 @@ namespace wing {
 
 namespace lsm {
 
+/* The eviction policy of the block cache. */
+enum class CachePolicy {
+  /* Evict a block that is not referenced since the clock hand last passed. */
+  kClock,
+  /**
+   * Evict the block whose K-th most recent access is the oldest. Blocks with
+   * fewer than K accesses are evicted first, in LRU order.
+   */
+  kLRUK,
+};
+
+/**
+ * The priority of a block. Low priority blocks, e.g. the blocks read by
+ * scans and compactions, are evicted before the blocks read by point lookups,
+ * so that a large scan does not wipe out the working set.
+ */
+enum class CachePriority {
+  kHigh,
+  kLow,
+};
+
 struct CacheOptions {
   size_t capacity = 8 * 1024 * 1024;  // 8MiB
+  /* The number of shards. Each shard has its own lock. */
+  size_t num_shards = 16;
+  CachePolicy policy = CachePolicy::kClock;
+  /* K of LRU-K */
+  size_t lru_k = 2;
 };
 
 class CacheKey {
@@ -28,7 +57,12 @@ class CacheKey {
 
   struct Hash {
     size_t operator()(const CacheKey &x) const {
-      return (x.sst_id_ << 32) | x.offset_;
+      /* Mix the bits so that both the shard and the bucket are uniform. */
+      uint64_t h = (x.sst_id_ << 32) ^ x.offset_;
+      h ^= h >> 33;
+      h *= 0xff51afd7ed558ccdull;
+      h ^= h >> 33;
+      return h;
     }
   };
 
@@ -37,69 +71,150 @@ class CacheKey {
   offset_t offset_;
 };
 
+struct CacheStats {
+  uint64_t hits_{0};
+  uint64_t misses_{0};
+  uint64_t evictions_{0};
+  /* The total size of the cached blocks. */
+  uint64_t size_{0};
+};
+
+/**
+ * A sharded block cache. The blocks referenced by a Handle are pinned, i.e.
+ * they are never evicted. If all the blocks are pinned, the cache may exceed
+ * its capacity temporarily.
+ */
 class Cache {
+  class Shard;
+  struct Entry;
+
  public:
   class Handle {
    public:
     Handle(const Handle &) = delete;
     Handle &operator=(const Handle &) = delete;
-    Handle(Handle &&rhs)
-      : cache_(rhs.cache_), block_id_(rhs.block_id_), block_(rhs.block_) {
-      rhs.block_ = std::string_view();
+    Handle(Handle &&rhs) : shard_(rhs.shard_), entry_(rhs.entry_) {
+      rhs.entry_ = nullptr;
     }
     Handle &operator=(Handle &&rhs) {
-      this->~Handle();
-      cache_ = rhs.cache_;
-      block_id_ = rhs.block_id_;
-      block_ = rhs.block_;
-      rhs.block_ = std::string_view();
+      if (this != &rhs) {
+        this->~Handle();
+        shard_ = rhs.shard_;
+        entry_ = rhs.entry_;
+        rhs.entry_ = nullptr;
+      }
       return *this;
     }
-    ~Handle() {
-      if (block_.data() != nullptr)
-        cache_.get().unref_block(block_id_);
-    }
+    ~Handle();
 
-    std::string_view block() const { return block_; }
+    std::string_view block() const;
 
    private:
-    Handle(Cache &cache, CacheKey block_id, std::string_view block)
-      : cache_(cache), block_id_(block_id), block_(block) {}
+    Handle(Shard *shard, Entry *entry) : shard_(shard), entry_(entry) {}
 
-    std::reference_wrapper<Cache> cache_;
-    CacheKey block_id_;
-    std::string_view block_;
+    Shard *shard_;
+    Entry *entry_;
 
     friend class Cache;
   };
 
-  Cache(const CacheOptions &options) : capacity_(options.capacity), size_(0) {}
+  Cache(const CacheOptions &options);
 
-  std::optional<Cache::Handle> get(uint64_t sstable_id, BlockHandle block);
-  Handle insert(uint64_t sstable_id, BlockHandle block, std::string &&content);
+  ~Cache();
 
- private:
-  struct BlockInfo {
-    std::string block;
-    std::atomic<size_t> refcount;
+  std::optional<Cache::Handle> get(uint64_t sstable_id, BlockHandle block,
+      CachePriority priority = CachePriority::kHigh);
+  Handle insert(uint64_t sstable_id, BlockHandle block, std::string &&content,
+      CachePriority priority = CachePriority::kHigh);
+
+  /**
+   * Return an ID that is unique in the process. Each SSTable uses its own ID
+   * in the cache keys, so that SSTables of different databases can share
+   * the cache.
+   */
+  static uint64_t NewId();
+
+  /* The sum of the counters of all the shards. */
+  CacheStats GetStats();
 
-    BlockInfo(std::string &&b, size_t rc) : block(std::move(b)), refcount(rc) {}
+ private:
+  struct Entry {
+    Entry(CacheKey key, std::string &&block)
+      : key_(key), block_(std::move(block)) {}
+
+    CacheKey key_;
+    std::string block_;
+    /* The number of Handles. Protected by the mutex of the shard. */
+    size_t refcount_{0};
+    /* If it has only been read by low priority reads. */
+    bool low_priority_{true};
+    /* CLOCK: the reference bit. */
+    bool referenced_{false};
+    /* CLOCK: its position in the clock. */
+    std::list<Entry *>::iterator clock_it_;
+    /* LRU-K: the times of the last K accesses, the latest at the back. */
+    std::vector<uint64_t> history_;
   };
 
-  void unref_block(CacheKey block_id);
-  // REQUIRES: this->mu_ held
-  void evict();
+  class Shard {
+   public:
+    Shard(size_t capacity, CachePolicy policy, size_t k)
+      : capacity_(capacity), policy_(policy), k_(k) {
+      hand_ = clock_.end();
+    }
+
+    ~Shard();
+
+    Entry *Lookup(const CacheKey &key, CachePriority priority);
+
+    Entry *Insert(
+        const CacheKey &key, std::string &&content, CachePriority priority);
 
-  const size_t capacity_;
+    void Release(Entry *e);
 
-  std::mutex mu_;
-  std::unordered_map<CacheKey, BlockInfo, CacheKey::Hash> cache_;
-  size_t size_;
-  std::unordered_map<CacheKey, std::list<CacheKey>::iterator, CacheKey::Hash>
-      lru_map_;
-  std::list<CacheKey> lru_list_;
+    CacheStats GetStats();
+
+   private:
+    using LRUKKey = std::tuple<bool, uint64_t, Entry *>;
+
+    // Require: mu_ held
+    void Access(Entry *e, CachePriority priority);
+    // Require: mu_ held
+    void Ref(Entry *e);
+    // Require: mu_ held
+    void AddEvictable(Entry *e, bool low_priority);
+    // Require: mu_ held
+    void RemoveEvictable(Entry *e);
+    // Require: mu_ held
+    void Evict();
+    // Require: mu_ held. Return nullptr if all the entries are pinned.
+    Entry *PickVictim();
+    // Require: mu_ held
+    LRUKKey GetLRUKKey(Entry *e) const;
+
+    const size_t capacity_;
+    const CachePolicy policy_;
+    const size_t k_;
+
+    std::mutex mu_;
+    std::unordered_map<CacheKey, Entry *, CacheKey::Hash> table_;
+    size_t size_{0};
+    /* The logical time of LRU-K. */
+    uint64_t clock_time_{0};
+    /* CLOCK: the unpinned entries and the clock hand. */
+    std::list<Entry *> clock_;
+    std::list<Entry *>::iterator hand_;
+    /* LRU-K: the unpinned entries, ordered by their eviction priority. */
+    std::set<LRUKKey> lru_k_;
+    CacheStats stats_;
+  };
+
+  Shard *GetShard(const CacheKey &key) {
+    /* The low bits are used by the hash table in the shard. */
+    return shards_[(CacheKey::Hash()(key) >> 32) % shards_.size()].get();
+  }
 
-  friend class Block;
+  std::vector<std::unique_ptr<Shard>> shards_;
 };
 
 }  // namespace lsm
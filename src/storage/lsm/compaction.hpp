@@ -38,6 +38,25 @@ class Compaction {
 
   bool is_trivial_move() const { return is_trivial_move_; }
 
+  /**
+   * Mark the SSTables that the compaction reads, so that they are not picked
+   * by other compactions at the same time.
+   */
+  void SetCompactionInProcess(bool compaction_in_process) const {
+    for (auto& sst : input_ssts_) {
+      sst->SetCompactionInProcess(compaction_in_process);
+    }
+    for (auto& run : input_runs_) {
+      run->SetCompactionInProcess(compaction_in_process);
+    }
+    if (target_sorted_run_ != nullptr) {
+      target_sorted_run_->SetCompactionInProcess(compaction_in_process);
+      for (auto& sst : target_sorted_run_->GetSSTs()) {
+        sst->SetCompactionInProcess(compaction_in_process);
+      }
+    }
+  }
+
  private:
   /* The input SSTables */
   std::vector<std::shared_ptr<SSTable>> input_ssts_;
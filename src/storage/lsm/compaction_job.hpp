@@ -1,7 +1,13 @@
 #pragma once
 
+#include "storage/lsm/range_del.hpp"
+#include "storage/lsm/snapshot.hpp"
 #include "storage/lsm/sst.hpp"
+#include "storage/lsm/value_log.hpp"
+#include <filesystem>
 #include <iostream>
+#include <optional>
+#include <set>
 
 namespace wing {
 
@@ -10,19 +16,35 @@ namespace lsm {
 class CompactionJob {
  public:
   CompactionJob(FileNameGenerator* gen, size_t block_size, size_t sst_size,
-      size_t write_buffer_size, size_t bloom_bits_per_key, bool use_direct_io)
+      size_t write_buffer_size, double bloom_bits_per_key, bool use_direct_io,
+      SSTFormat format = SSTFormat::kPrefixCompressed,
+      size_t restart_interval = 16, bool partitioned = false,
+      bool blocked_bloom = false,
+      const PrefixExtractor* prefix_extractor = nullptr,
+      BlobWriteOptions blob_options = {})
     : file_gen_(gen),
       block_size_(block_size),
       sst_size_(sst_size),
       write_buffer_size_(write_buffer_size),
       bloom_bits_per_key_(bloom_bits_per_key),
-      use_direct_io_(use_direct_io) {}
+      use_direct_io_(use_direct_io),
+      format_(format),
+      restart_interval_(restart_interval),
+      partitioned_(partitioned),
+      blocked_bloom_(blocked_bloom),
+      prefix_extractor_(prefix_extractor),
+      blob_options_(blob_options) {}
 
   /**
    * It receives an iterator and returns a list of SSTable
+   * The records deleted by range_dels are dropped if it is not nullptr.
+   * The records that the snapshots see are kept if it is not nullptr,
+   * otherwise only the newest record of each user key is kept.
    */
   template <typename IterT>
-  std::vector<SSTInfo> Run(IterT&& it) {
+  std::vector<SSTInfo> Run(IterT&& it,
+      const RangeTombstoneList* range_dels = nullptr,
+      const SnapshotList* snapshots = nullptr) {
     std::vector<SSTInfo> sst_info_list;
 
     auto filename = file_gen_->Generate();
@@ -31,35 +53,78 @@ class CompactionJob {
         std::make_unique<SeqWriteFile>(
           filename.first, use_direct_io_),
         1 << 20),
-      block_size_, bloom_bits_per_key_
+      block_size_, bloom_bits_per_key_, format_, restart_interval_,
+      partitioned_, blocked_bloom_, prefix_extractor_
     );
 
     std::string last_user_key;
     bool first = true;
+    size_t last_stripe = 0;
+    /* The large values are written to the value log. */
+    BlobWriter blob_writer(file_gen_, blob_options_.blob_file_size_);
+    std::string blob_index;
+    /* The blob files that the current SSTable refers to */
+    std::set<uint64_t> blob_files;
 
     while (it.Valid()) {
       ParsedKey current_key(it.key());
       Slice current_value = it.value();
+      size_t stripe =
+          snapshots != nullptr ? snapshots->Stripe(current_key.seq_) : 0;
 
-      if (first) {
-        first = false;
-        last_user_key = current_key.user_key_;
-        builder.Append(current_key, current_value);
+      /* No snapshot sees an older record in the same stripe. */
+      if (!first && current_key.user_key_ == last_user_key &&
+          stripe == last_stripe) {
         it.Next();
         continue;
       }
 
-
-      if (!first && current_key.user_key_ == last_user_key) {
+      // new user key, or the newest record in the stripe
+      bool same_user_key = !first && current_key.user_key_ == last_user_key;
+      first = false;
+      last_user_key = current_key.user_key_;
+      last_stripe = stripe;
+
+      /**
+       * The older records of the key in the stripe are deleted too, so they
+       * are skipped.
+       */
+      seq_t read_seq =
+          snapshots != nullptr ? snapshots->StripeSeq(stripe) : UINT64_MAX;
+      if (range_dels != nullptr &&
+          range_dels->ShouldDelete(current_key, read_seq)) {
         it.Next();
         continue;
       }
 
-      // new user key
-      last_user_key = current_key.user_key_;
+      std::optional<uint64_t> blob_file;
+      if (current_key.type_ == RecordType::BlobIndex) {
+        auto index = BlobIndex::Decode(current_value);
+        if (index.file_id_ < blob_options_.gc_cutoff_) {
+          /* Move the value out of the old blob file. */
+          index = blob_writer.Add(blob_options_.value_log_->Read(index));
+          blob_index = index.Encode();
+          current_value = blob_index;
+        }
+        blob_file = index.file_id_;
+      } else if (current_key.type_ == RecordType::Value &&
+                 blob_options_.min_blob_size_ > 0 &&
+                 current_value.size() >= blob_options_.min_blob_size_) {
+        auto index = blob_writer.Add(current_value);
+        blob_index = index.Encode();
+        current_key.type_ = RecordType::BlobIndex;
+        current_value = blob_index;
+        blob_file = index.file_id_;
+      }
 
       size_t entry_size = sizeof(offset_t) * 3 + current_key.size() + current_value.size();
-      if (builder.size() + entry_size <= sst_size_) {
+      /**
+       * The records of a user key are in the same SSTable, otherwise a
+       * compaction may pick the SSTable of the newer ones only and move them
+       * below the older ones.
+       */
+      if (builder.count() == 0 || same_user_key ||
+          builder.size() + entry_size <= sst_size_) {
         builder.Append(current_key, current_value);
       } else {
         builder.Finish();
@@ -70,6 +135,12 @@ class CompactionJob {
         info.bloom_filter_offset_ = builder.GetBloomFilterOffset();
         info.size_ = builder.size();
         info.sst_id_ = filename.second;
+        info.smallest_key_ = InternalKey(builder.GetSmallestKey()).GetSlice();
+        info.largest_key_ = InternalKey(builder.GetLargestKey()).GetSlice();
+        info.smallest_seq_ = builder.GetSmallestSeq();
+        info.largest_seq_ = builder.GetLargestSeq();
+        info.blob_files_.assign(blob_files.begin(), blob_files.end());
+        blob_files.clear();
         sst_info_list.push_back(info);
 
         // create a new SSTable builder
@@ -80,11 +151,15 @@ class CompactionJob {
             std::make_unique<SeqWriteFile>(
               filename.first, use_direct_io_),
             1 << 20),
-          block_size_, bloom_bits_per_key_
+          block_size_, bloom_bits_per_key_, format_, restart_interval_,
+          partitioned_, blocked_bloom_, prefix_extractor_
         };
 
         builder.Append(current_key, current_value);
       }
+      if (blob_file) {
+        blob_files.insert(*blob_file);
+      }
       it.Next();
     }
 
@@ -97,7 +172,15 @@ class CompactionJob {
       info.bloom_filter_offset_ = builder.GetBloomFilterOffset();
       info.size_ = builder.size();
       info.sst_id_ = filename.second;
+      info.smallest_key_ = InternalKey(builder.GetSmallestKey()).GetSlice();
+      info.largest_key_ = InternalKey(builder.GetLargestKey()).GetSlice();
+      info.smallest_seq_ = builder.GetSmallestSeq();
+      info.largest_seq_ = builder.GetLargestSeq();
+      info.blob_files_.assign(blob_files.begin(), blob_files.end());
       sst_info_list.push_back(info);   
+    } else {
+      /* All the records are deleted, so the empty file is not needed. */
+      std::filesystem::remove(filename.first);
     }
 
     return sst_info_list;
@@ -113,9 +196,53 @@ class CompactionJob {
   /* The size of write buffer in FileWriter */
   size_t write_buffer_size_;
   /* The number of bits per key in bloom filter */
-  size_t bloom_bits_per_key_;
+  double bloom_bits_per_key_;
   /* Use O_DIRECT or not */
   bool use_direct_io_;
+  /* The format of the data blocks */
+  SSTFormat format_;
+  /* The number of keys between restart points */
+  size_t restart_interval_;
+  /* Partition the index and the filter or not */
+  bool partitioned_;
+  bool blocked_bloom_;
+  /* Add the prefixes of the keys to the filters if it is not nullptr */
+  const PrefixExtractor* prefix_extractor_;
+  /* How the values are written to the value log */
+  BlobWriteOptions blob_options_;
+};
+
+/**
+ * The records of an iterator whose user keys are in (lower, upper], i.e. the
+ * input of a subcompaction. std::nullopt means there is no bound. The
+ * iterator must not be positioned after the first record in the range.
+ */
+template <typename IterT>
+class KeyRangeIterator {
+ public:
+  KeyRangeIterator(IterT* it, std::optional<std::string> lower,
+      std::optional<std::string> upper)
+    : it_(it), lower_(std::move(lower)), upper_(std::move(upper)) {
+    while (lower_ && it_->Valid() &&
+           ParsedKey(it_->key()).user_key_ <= Slice(*lower_)) {
+      it_->Next();
+    }
+  }
+
+  bool Valid() {
+    return it_->Valid() &&
+           (!upper_ || ParsedKey(it_->key()).user_key_ <= Slice(*upper_));
+  }
+
+  Slice key() const { return it_->key(); }
+
+  Slice value() const { return it_->value(); }
+
+  void Next() { it_->Next(); }
+
+ private:
+  IterT* it_;
+  std::optional<std::string> lower_, upper_;
 };
 
 }  // namespace lsm
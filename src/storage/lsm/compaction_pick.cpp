@@ -1,4 +1,7 @@
 #include "storage/lsm/compaction_pick.hpp"
+
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 
 namespace wing {
@@ -13,7 +16,110 @@ struct cmp {
 };
 
 
+/* If any of the SSTables is picked by a running compaction. */
+static bool InProcess(const std::vector<std::shared_ptr<SSTable>>& ssts) {
+  return std::any_of(ssts.begin(), ssts.end(),
+      [](auto& sst) { return sst->GetCompactionInProcess(); });
+}
+
+/* If the user key ranges of the SSTables overlap. */
+static bool Overlap(const SSTable& a, const SSTable& b) {
+  return !(a.GetLargestKey().user_key_ < b.GetSmallestKey().user_key_ ||
+           b.GetLargestKey().user_key_ < a.GetSmallestKey().user_key_);
+}
+
+/* If the SSTable overlaps any SSTable of the sorted run. */
+static bool Overlap(const SSTable& sst, const SortedRun& run) {
+  auto& ssts = run.GetSSTs();
+  /* The first SSTable that does not end before sst. */
+  auto it = std::partition_point(ssts.begin(), ssts.end(), [&](auto& x) {
+    return x->GetLargestKey().user_key_ < sst.GetSmallestKey().user_key_;
+  });
+  return it != ssts.end() && Overlap(sst, **it);
+}
+
+/**
+ * If the SSTables can be moved into the target sorted run without being
+ * rewritten, i.e., none of them overlaps another one or the target run.
+ */
+static bool CanTrivialMove(std::vector<std::shared_ptr<SSTable>> ssts,
+    const std::shared_ptr<SortedRun>& target_sorted_run) {
+  std::sort(ssts.begin(), ssts.end(), [](auto& a, auto& b) {
+    return a->GetSmallestKey().user_key_ < b->GetSmallestKey().user_key_;
+  });
+  for (size_t i = 0; i < ssts.size(); i++) {
+    if (i > 0 && Overlap(*ssts[i - 1], *ssts[i])) {
+      return false;
+    }
+    if (target_sorted_run && Overlap(*ssts[i], *target_sorted_run)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+double CompactionPicker::GetBloomBitsPerKey(
+    Version* version, size_t level, double bits_per_key) {
+  auto& levels = version->GetLevels();
+  /* The number of keys of each level and of each run of the level. */
+  std::vector<double> keys(levels.size(), 0), run_keys(levels.size(), 0);
+  double total_keys = 0;
+  for (size_t i = 0; i < levels.size(); i++) {
+    for (auto& run : levels[i].GetRuns()) {
+      for (auto& sst : run->GetSSTs()) {
+        keys[i] += sst->GetSSTInfo().count_;
+      }
+    }
+    if (!levels[i].GetRuns().empty()) {
+      run_keys[i] = keys[i] / levels[i].GetRuns().size();
+    }
+    total_keys += keys[i];
+  }
+  if (level >= levels.size() || keys[level] == 0) {
+    return bits_per_key;
+  }
+  /**
+   * The rate of level i is c * run_keys[i], where c is solved from the
+   * memory budget. The levels whose rate is >= 1 get no bits, and c is
+   * solved again for the other levels.
+   */
+  const double ln2_2 = std::log(2) * std::log(2);
+  std::vector<bool> active(levels.size());
+  for (size_t i = 0; i < levels.size(); i++) {
+    active[i] = keys[i] > 0;
+  }
+  double log_c = 0;
+  while (true) {
+    double active_keys = 0, sum = 0;
+    for (size_t i = 0; i < levels.size(); i++) {
+      if (active[i]) {
+        active_keys += keys[i];
+        sum += keys[i] * std::log(run_keys[i]);
+      }
+    }
+    if (active_keys == 0) {
+      break;
+    }
+    log_c = -(bits_per_key * total_keys * ln2_2 + sum) / active_keys;
+    bool changed = false;
+    for (size_t i = 0; i < levels.size(); i++) {
+      if (active[i] && log_c + std::log(run_keys[i]) >= 0) {
+        active[i] = false;
+        changed = true;
+      }
+    }
+    if (!changed) {
+      break;
+    }
+  }
+  if (!active[level]) {
+    return 0;
+  }
+  return -(log_c + std::log(run_keys[level])) / ln2_2;
+}
+
 std::unique_ptr<Compaction> LeveledCompactionPicker::Get(Version* version) {
+  /* Levels used by running compactions are skipped. */
   for (size_t i = 0; i < version->GetLevels().size(); ++i) {
     auto& level = version->GetLevels()[i];
 
@@ -23,16 +129,22 @@ std::unique_ptr<Compaction> LeveledCompactionPicker::Get(Version* version) {
       for (auto& run : level.GetRuns())
         ssts.insert(ssts.end(), run->GetSSTs().begin(), run->GetSSTs().end());
       std::shared_ptr<SortedRun> target_sorted_run = nullptr;
-      if (version->GetLevels().size() > 1)
+      /* The next level is empty if a range deletion dropped all of it. */
+      if (version->GetLevels().size() > 1 &&
+          !version->GetLevels()[i + 1].GetRuns().empty())
         target_sorted_run = version->GetLevels()[i + 1].GetRuns()[0];
+      if (InProcess(ssts) ||
+          (target_sorted_run && InProcess(target_sorted_run->GetSSTs())))
+        continue;
 
+      bool is_trivial_move = CanTrivialMove(ssts, target_sorted_run);
       return std::make_unique<Compaction>(
         ssts,
         level.GetRuns(),
         i,
         i + 1,
         target_sorted_run,
-        false
+        is_trivial_move
       );
     }
 
@@ -40,11 +152,34 @@ std::unique_ptr<Compaction> LeveledCompactionPicker::Get(Version* version) {
       // only need to check the total size of sorted runs
 
       std::shared_ptr<SortedRun> target_sorted_run = nullptr;
-      if (version->GetLevels().size() > i + 1)
+      if (version->GetLevels().size() > i + 1 &&
+          !version->GetLevels()[i + 1].GetRuns().empty())
         target_sorted_run = version->GetLevels()[i + 1].GetRuns()[0];
+      /**
+       * Only one compaction reads the level at a time, since the output
+       * replaces the whole target level.
+       */
+      if (level.GetRuns()[0]->GetCompactionInProcess() ||
+          (target_sorted_run && InProcess(target_sorted_run->GetSSTs())))
+        continue;
 
       std::vector<std::shared_ptr<SSTable>> ssts;
 
+      /* An SSTable that does not overlap the next level is moved first. */
+      for (auto& sst : level.GetRuns()[0]->GetSSTs()) {
+        if (target_sorted_run && !Overlap(*sst, *target_sorted_run)) {
+          ssts.push_back(sst);
+          return std::make_unique<Compaction>(
+            std::move(ssts),
+            level.GetRuns(),
+            i,
+            i + 1,
+            target_sorted_run,
+            true
+          );
+        }
+      }
+
       // use heap to sort the SSTable with min size
       std::priority_queue<std::shared_ptr<SSTable>, std::vector<std::shared_ptr<SSTable>>, cmp<std::shared_ptr<SSTable>>> sst_heap;
 
@@ -67,6 +202,23 @@ std::unique_ptr<Compaction> LeveledCompactionPicker::Get(Version* version) {
   return nullptr;
 }
 
+size_t LeveledCompactionPicker::GetPendingCompactionBytes(Version* version) {
+  auto& levels = version->GetLevels();
+  size_t ret = 0;
+  if (levels.size() > 0 &&
+      levels[0].GetRuns().size() > level0_compaction_trigger_) {
+    ret += levels[0].size();
+  }
+  for (size_t i = 1; i < levels.size(); ++i) {
+    double target = base_level_size_ * pow(ratio_, i);
+    if (levels[i].size() > target) {
+      /* Each byte moved down is merged with about ratio_ bytes. */
+      ret += (levels[i].size() - target) * (ratio_ + 1);
+    }
+  }
+  return ret;
+}
+
 std::unique_ptr<Compaction> TieredCompactionPicker::Get(Version* version) {
   DB_ERR("Not implemented!");
 }
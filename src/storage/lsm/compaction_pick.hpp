@@ -12,6 +12,20 @@ class CompactionPicker {
  public:
   virtual std::unique_ptr<Compaction> Get(Version* version) = 0;
 
+  /* The estimated bytes to compact until no compaction is needed. */
+  virtual size_t GetPendingCompactionBytes(Version* version) { return 0; }
+
+  /**
+   * The bloom bits per key of the new SSTables of the level, such that the
+   * filters use bits_per_key bits per key in total (Monkey). The expected
+   * number of false positives of a lookup, i.e. the sum of the false
+   * positive rates of all sorted runs, is minimized when the rate of each
+   * run is proportional to its number of keys. So the small runs of the
+   * upper levels get more bits and the last level gets fewer.
+   */
+  virtual double GetBloomBitsPerKey(
+      Version* version, size_t level, double bits_per_key);
+
   virtual ~CompactionPicker() = default;
 };
 
@@ -25,6 +39,8 @@ class LeveledCompactionPicker final : public CompactionPicker {
 
   std::unique_ptr<Compaction> Get(Version* version) override;
 
+  size_t GetPendingCompactionBytes(Version* version) override;
+
  private:
   /* The target size ratio */
   size_t ratio_{10};
@@ -2,6 +2,10 @@
 
 #include <fcntl.h>
 #include <unistd.h>
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 #include "common/exception.hpp"
 #include "storage/lsm/stats.hpp"
@@ -42,6 +46,41 @@ ssize_t ReadFile::Read(char* data, size_t n, offset_t offset) {
   return ret;
 }
 
+MmapFile::MmapFile(const std::string& filename) : filename_(filename) {
+#if defined(__linux__)
+  int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw DBException("::open file {} error! Error: {}", filename, errno);
+  }
+  struct stat st;
+  if (::fstat(fd, &st) < 0) {
+    ::close(fd);
+    throw DBException("::fstat file {} error! Error: {}", filename, errno);
+  }
+  size_ = st.st_size;
+  if (size_ > 0) {
+    void* addr = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+      ::close(fd);
+      throw DBException("::mmap file {} error! Error: {}", filename, errno);
+    }
+    data_ = static_cast<const char*>(addr);
+  }
+  /* The mapping stays valid after the file is closed. */
+  ::close(fd);
+#else
+  throw DBException("mmap is not supported on this platform!");
+#endif
+}
+
+MmapFile::~MmapFile() {
+#if defined(__linux__)
+  if (data_ != nullptr) {
+    ::munmap(const_cast<char*>(data_), size_);
+  }
+#endif
+}
+
 SeqWriteFile::SeqWriteFile(const std::string& filename, bool use_direct_io)
   : filename_(filename), use_direct_io_(use_direct_io) {
   auto flag = O_WRONLY | O_CREAT | O_TRUNC;
@@ -69,6 +108,17 @@ ssize_t SeqWriteFile::Write(const char* data, size_t n) {
   return ret;
 }
 
+void SeqWriteFile::Sync() {
+#if defined(__linux__)
+  int ret = ::fdatasync(fd_);
+#elif defined(__MINGW64__)
+  int ret = ::_commit(fd_);
+#endif
+  if (ret < 0) {
+    throw DBException("::fdatasync Error! Error: {}", errno);
+  }
+}
+
 void FileWriter::Append(const char* data, size_t n) {
   size_t len = std::min(buffer_size_ - offset_, n);
   memcpy(buffer_.data() + offset_, data, len);
@@ -87,6 +137,11 @@ void FileWriter::Flush() {
   offset_ = 0;
 }
 
+void FileWriter::Sync() {
+  Flush();
+  file_->Sync();
+}
+
 FileWriter::~FileWriter() {
   if (offset_ > 0) {
     Flush();
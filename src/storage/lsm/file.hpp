@@ -31,6 +31,30 @@ class ReadFile {
   bool use_direct_io_;
 };
 
+/**
+ * A file mapped read-only into memory. The data is read from the page cache
+ * without copies, so it does not use O_DIRECT.
+ */
+class MmapFile {
+ public:
+  MmapFile(const std::string& filename);
+
+  MmapFile(const MmapFile&) = delete;
+  MmapFile(MmapFile&&) = delete;
+  MmapFile& operator=(const MmapFile&) = delete;
+  MmapFile& operator=(MmapFile&&) = delete;
+
+  ~MmapFile();
+
+  const char* data() const { return data_; }
+  size_t size() const { return size_; }
+
+ private:
+  std::string filename_;
+  const char* data_{nullptr};
+  size_t size_{0};
+};
+
 class SeqWriteFile {
  public:
   SeqWriteFile(const std::string& filename, bool use_direct_io);
@@ -43,6 +67,8 @@ class SeqWriteFile {
   SeqWriteFile& operator=(SeqWriteFile&&) = delete;
 
   ssize_t Write(const char* data, size_t n);
+  /* Force the written data to the storage device. */
+  void Sync();
   bool use_direct_io() const { return use_direct_io_; }
 
  private:
@@ -75,6 +101,9 @@ class FileWriter {
 
   void Flush();
 
+  /* Flush the buffer and force the data to the storage device. */
+  void Sync();
+
   size_t size() const { return size_; }
 
  private:
@@ -126,9 +155,16 @@ class FileNameGenerator {
   FileNameGenerator(std::string_view prefix, size_t id_begin)
     : prefix_(prefix), id_(id_begin) {}
 
-  std::pair<std::string, size_t> Generate() {
+  std::pair<std::string, size_t> Generate() { return Generate("sst"); }
+
+  /* Generate a file name with the given extension, e.g. "log". */
+  std::pair<std::string, size_t> Generate(std::string_view ext) {
     auto id = id_.fetch_add(1);
-    return {fmt::format("{}{}.sst", prefix_, id), id};
+    return {GetFileName(id, ext), id};
+  }
+
+  std::string GetFileName(size_t id, std::string_view ext) const {
+    return fmt::format("{}{}.{}", prefix_, id, ext);
   }
 
   size_t GetID() const { return id_.load(std::memory_order_relaxed); }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <vector>
 
 #include "storage/lsm/common.hpp"
 #include "storage/lsm/file.hpp"
@@ -16,6 +17,16 @@ using PinnableSlice = std::string;
 enum class RecordType : uint8_t {
   Deletion = 0,
   Value,
+  /**
+   * A range tombstone in a WriteBatch, whose key and value are the begin and
+   * the end of the range. It is never in the records of a MemTable.
+   */
+  RangeDeletion,
+  /**
+   * A value in the value log, whose value is a BlobIndex. It is only in the
+   * SSTables. See value_log.hpp.
+   */
+  BlobIndex,
 };
 
 class ParsedKey;
@@ -101,6 +112,32 @@ struct ParsedKey {
 inline InternalKey::InternalKey(ParsedKey key)
   : InternalKey(key.user_key_, key.seq_, key.type_) {}
 
+/**
+ * A key of a batched lookup and its result. The lookup stops at the first
+ * place that returns kFound or kDelete.
+ */
+struct LookupKey {
+  Slice user_key_;
+  GetResult result_{GetResult::kNotFound};
+  std::string value_;
+  /* The sequence number of the record that is found or deleted. */
+  seq_t seq_{0};
+};
+
+/* The format of the data blocks in an SSTable. */
+enum class SSTFormat : uint32_t {
+  /**
+   * Each entry stores the whole internal key, followed by an array of the
+   * offsets of all the entries.
+   */
+  kPlain = 0,
+  /**
+   * Each entry stores the key as a delta to the previous key, followed by an
+   * array of restart points, where the whole key is stored.
+   */
+  kPrefixCompressed = 1,
+};
+
 struct BlockHandle {
   /* The offset of the block. */
   offset_t offset_;
@@ -130,6 +167,20 @@ struct SSTInfo {
   size_t bloom_filter_offset_;
   /* The path of the SSTable */
   std::string filename_;
+  /**
+   * The smallest and the largest internal keys, so that the SSTable is not
+   * opened to get its key range. Empty if unknown.
+   */
+  std::string smallest_key_;
+  std::string largest_key_;
+  /**
+   * The smallest and the largest sequence numbers of the records, used by
+   * the range tombstones. The whole range if unknown.
+   */
+  seq_t smallest_seq_{0};
+  seq_t largest_seq_{UINT64_MAX};
+  /* The IDs of the blob files that the records refer to, in order */
+  std::vector<uint64_t> blob_files_;
 };
 
 }  // namespace lsm
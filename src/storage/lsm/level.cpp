@@ -1,12 +1,14 @@
 #include "storage/lsm/level.hpp"
 
+#include <algorithm>
 #include <iostream>
 
 namespace wing {
 
 namespace lsm {
 
-GetResult SortedRun::Get(Slice key, uint64_t seq, std::string* value) {
+GetResult SortedRun::Get(
+    Slice key, uint64_t seq, std::string* value, seq_t* record_seq) {
   ParsedKey target_key(key, seq, RecordType::Value);
 
   /*
@@ -32,7 +34,7 @@ GetResult SortedRun::Get(Slice key, uint64_t seq, std::string* value) {
   }
 
   if (left < ssts_.size()) {
-    return ssts_[left]->Get(key, seq, value);
+    return ssts_[left]->Get(key, seq, value, record_seq);
   }
   return GetResult::kNotFound;
 
@@ -45,12 +47,41 @@ GetResult SortedRun::Get(Slice key, uint64_t seq, std::string* value) {
   */
 }
 
+void SortedRun::MultiGet(std::span<LookupKey* const> keys, uint64_t seq) {
+  size_t begin = 0;
+  while (begin < keys.size()) {
+    /* The first SSTable whose largest key >= the key, like Get. */
+    ParsedKey target_key(keys[begin]->user_key_, seq, RecordType::Value);
+    auto sst = std::partition_point(ssts_.begin(), ssts_.end(),
+        [&](auto& x) { return x->GetLargestKey() < target_key; });
+    if (sst == ssts_.end()) {
+      return;
+    }
+    /* The following keys in the same SSTable. */
+    size_t end = begin + 1;
+    while (end < keys.size() &&
+           !((*sst)->GetLargestKey() <
+               ParsedKey(keys[end]->user_key_, seq, RecordType::Value))) {
+      end += 1;
+    }
+    (*sst)->MultiGet(keys.subspan(begin, end - begin), seq);
+    begin = end;
+  }
+}
+
 SortedRunIterator SortedRun::Seek(Slice key, uint64_t seq) {
   SortedRunIterator it = Begin();
   it.Seek(key, seq);
   return it;
 }
 
+bool SortedRun::PrefixMayMatch(Slice key, uint64_t seq, Slice prefix) {
+  ParsedKey target_key(key, seq, RecordType::Value);
+  auto it = std::partition_point(ssts_.begin(), ssts_.end(),
+      [&](auto& sst) { return sst->GetLargestKey() < target_key; });
+  return it != ssts_.end() && (*it)->PrefixMayMatch(key, seq, prefix);
+}
+
 SortedRunIterator SortedRun::Begin() { 
   SortedRunIterator it(this, SSTableIterator(), 0);
   it.SeekToFirst();
@@ -132,10 +163,11 @@ void SortedRunIterator::Next() {
   }
 }
 
-GetResult Level::Get(Slice key, uint64_t seq, std::string* value) {
+GetResult Level::Get(
+    Slice key, uint64_t seq, std::string* value, seq_t* record_seq) {
 
   for (int i = runs_.size() - 1; i >= 0; --i) {
-    auto res = runs_[i]->Get(key, seq, value);
+    auto res = runs_[i]->Get(key, seq, value, record_seq);
     if (res != GetResult::kNotFound) {
       return res;
     }
@@ -143,6 +175,15 @@ GetResult Level::Get(Slice key, uint64_t seq, std::string* value) {
   return GetResult::kNotFound;
 }
 
+void Level::MultiGet(std::vector<LookupKey*>* keys, uint64_t seq) {
+  for (int i = runs_.size() - 1; i >= 0 && !keys->empty(); --i) {
+    runs_[i]->MultiGet(*keys, seq);
+    std::erase_if(*keys, [](LookupKey* key) {
+      return key->result_ != GetResult::kNotFound;
+    });
+  }
+}
+
 void Level::Append(std::vector<std::shared_ptr<SortedRun>> runs) {
   for (auto& run : runs) {
     size_ += run->size();
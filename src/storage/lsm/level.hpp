@@ -10,13 +10,15 @@ class SortedRunIterator;
 
 class SortedRun {
  public:
-  SortedRun(
-      const std::vector<SSTInfo>& ssts, size_t block_size, bool use_direct_io)
+  SortedRun(const std::vector<SSTInfo>& ssts, size_t block_size,
+      bool use_direct_io, Cache* cache = nullptr,
+      TableCache* table_cache = nullptr, ValueLog* value_log = nullptr,
+      ReadaheadOptions readahead = {}, bool use_mmap = false)
     : block_size_(block_size), use_direct_io_(use_direct_io) {
     size_ = 0;
     for (auto& sst : ssts) {
-      ssts_.push_back(
-          std::make_shared<SSTable>(sst, block_size_, use_direct_io_));
+      ssts_.push_back(std::make_shared<SSTable>(sst, block_size_,
+          use_direct_io_, cache, table_cache, value_log, readahead, use_mmap));
       size_ += sst.size_;
     }
   }
@@ -40,8 +42,17 @@ class SortedRun {
    * If the record has type RecordType::Deletion, then it does nothing to the
    * value, and returns GetResult::kDelete If there is no such record, it
    * returns GetResult::kNotFound.
+   * The sequence number of the record is stored in record_seq if it is not
+   * nullptr.
    * */
-  GetResult Get(Slice key, uint64_t seq, std::string* value);
+  GetResult Get(Slice key, uint64_t seq, std::string* value,
+      seq_t* record_seq = nullptr);
+
+  /**
+   * Get the keys sorted by user key. The keys are split among the SSTables,
+   * and each SSTable gets its keys in a batch.
+   */
+  void MultiGet(std::span<LookupKey* const> keys, uint64_t seq);
 
   /* Return an iterator positioned at the first record >= (key, seq). */
   SortedRunIterator Seek(Slice key, uint64_t seq);
@@ -49,6 +60,13 @@ class SortedRun {
   /* Return an iterator positioned at the beginning of the SSTable */
   SortedRunIterator Begin();
 
+  /**
+   * Return false if no record >= (key, seq) in the sorted run has the
+   * prefix, which is the prefix of key. Only the SSTable that may have
+   * (key, seq) is checked, since the records with the prefix are adjacent.
+   */
+  bool PrefixMayMatch(Slice key, uint64_t seq, Slice prefix);
+
   /* Get the number of SSTables. */
   size_t SSTCount() const { return ssts_.size(); }
 
@@ -141,7 +159,14 @@ class Level {
     return runs_;
   }
 
-  GetResult Get(Slice key, uint64_t seq, std::string* value);
+  GetResult Get(Slice key, uint64_t seq, std::string* value,
+      seq_t* record_seq = nullptr);
+
+  /**
+   * Get the keys sorted by user key from the newest sorted run to the
+   * oldest one. The keys that are found or deleted are removed from keys.
+   */
+  void MultiGet(std::vector<LookupKey*>* keys, uint64_t seq);
 
   /* Get the level id */
   int GetID() const { return level_id_; }
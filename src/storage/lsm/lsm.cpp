@@ -1,7 +1,10 @@
 #include "storage/lsm/lsm.hpp"
 
+#include <algorithm>
 #include <fstream>
+#include <future>
 
+#include "common/serializer.hpp"
 #include "common/stopwatch.hpp"
 #include "storage/lsm/compaction_job.hpp"
 #include "storage/lsm/stats.hpp"
@@ -11,17 +14,54 @@ namespace wing {
 namespace lsm {
 
 DBImpl::DBImpl(const Options& options)
-  : options_(options), cache_(options_.cache) {
+  : options_(options),
+    cache_(options_.block_cache ? options_.block_cache
+                                : std::make_shared<Cache>(options_.cache)),
+    table_cache_(options_.table_cache
+                     ? options_.table_cache
+                     : std::make_shared<TableCache>(
+                           options_.table_cache_options)),
+    row_cache_(options_.row_cache_options.capacity > 0
+                   ? std::make_unique<RowCache>(options_.row_cache_options)
+                   : nullptr),
+    value_log_(std::make_unique<ValueLog>(options_.db_path.string() + "/")),
+    scheduler_(options_.scheduler ? options_.scheduler
+                                  : std::make_shared<Scheduler>(
+                                        options_.max_background_flushes +
+                                        options_.max_background_compactions)),
+    subcompaction_scheduler_(
+        options_.subcompaction_scheduler || options_.max_subcompactions == 1
+            ? options_.subcompaction_scheduler
+            /* A pool of 0 threads has a thread for each core. */
+            : std::make_shared<Scheduler>(options_.max_subcompactions == 0
+                                              ? 0
+                                              : options_.max_subcompactions - 1)),
+    readahead_scheduler_(
+        options_.readahead_scheduler || options_.max_readahead_blocks == 0
+            ? options_.readahead_scheduler
+            : std::make_shared<Scheduler>(options_.readahead_threads)),
+    write_controller_(options_.delayed_write_rate),
+    id_(Cache::NewId()) {
+  if (!(options_.blob_gc_age_cutoff >= 0 && options_.blob_gc_age_cutoff <= 1)) {
+    DB_ERR("Invalid blob_gc_age_cutoff: {}", options_.blob_gc_age_cutoff);
+  }
   if (options_.create_new) {
     seq_ = 0;
-    sv_ = std::make_shared<SuperVersion>(std::make_shared<MemTable>(),
+    sv_ = std::make_shared<SuperVersion>(
+        std::make_shared<MemTable>(options_.memtable_rep),
         std::make_shared<std::vector<std::shared_ptr<MemTable>>>(),
         std::make_shared<Version>());
     filename_gen_ =
         std::make_unique<FileNameGenerator>(options_.db_path.string() + "/", 0);
+    if (options_.enable_wal) {
+      NewLog(sv_->GetMt().get());
+    }
+    /* So that the database can be recovered from the logs after a crash. */
+    WriteSnapshot();
   } else {
     LoadMetadata();
   }
+  last_allocated_seq_ = seq_.load();
   if (options_.compaction_strategy_name == "leveled") {
     compaction_picker_ = std::make_unique<LeveledCompactionPicker>(
         options_.compaction_size_ratio,
@@ -44,25 +84,44 @@ DBImpl::DBImpl(const Options& options)
         options_.level0_compaction_trigger);
   }
 
-  threads_.emplace_back([&]() { FlushThread(); });
-  threads_.emplace_back([&]() { CompactionThread(); });
+  {
+    /* Flush the MemTables recovered from the logs. */
+    std::unique_lock lck(db_mutex_);
+    MaybeScheduleFlush();
+    MaybeScheduleCompaction();
+  }
 }
 
 DBImpl::~DBImpl() {
   FlushAll();
-  stop_signal_ = true;
-  flush_cv_.notify_all();
-  compact_cv_.notify_all();
-  for (auto& thread : threads_) {
-    thread.join();
+  {
+    /* The scheduled jobs refer to this database. */
+    std::unique_lock lck(db_mutex_);
+    stop_signal_ = true;
+    bg_cv_.wait(lck, [&]() {
+      return flushes_scheduled_ == 0 && compactions_scheduled_ == 0;
+    });
   }
   Save();
+  /* The SuperVersions cached by the threads refer to this database. */
+  std::vector<std::shared_ptr<SuperVersion>*> cached;
+  {
+    std::unique_lock lck(sv_mutex_);
+    cached = ScrapeSVSlots();
+    sv_slots_.clear();
+  }
+  for (auto sv : cached) {
+    delete sv;
+  }
 }
 
-void DBImpl::StopWrite() {
-  db_mutex_.unlock();
-  std::this_thread::sleep_for(std::chrono::milliseconds(100));
-  db_mutex_.lock();
+void DBImpl::StopWrite(std::unique_lock<std::mutex>& lck) {
+  auto start = std::chrono::steady_clock::now();
+  bg_cv_.wait(lck);
+  GetStatsContext()->total_write_stop_micros.fetch_add(
+      std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - start)
+          .count());
 }
 
 void DBImpl::SwitchMemtable(bool force) {
@@ -70,7 +129,7 @@ void DBImpl::SwitchMemtable(bool force) {
   auto old_sv = GetSV();
   while (old_sv->GetImms()->size() >= options_.max_immutable_count) {
     old_sv.reset();
-    StopWrite();
+    StopWrite(db_lck);
     old_sv = GetSV();
   }
   if ((force && old_sv->GetMt()->size() > 0) ||
@@ -81,103 +140,303 @@ void DBImpl::SwitchMemtable(bool force) {
     new_imm->push_back(mt);
     new_imm->insert(
         new_imm->end(), old_sv->GetImms()->begin(), old_sv->GetImms()->end());
-    auto new_mt = std::make_shared<MemTable>();
+    auto new_mt = std::make_shared<MemTable>(options_.memtable_rep);
+    if (options_.enable_wal) {
+      NewLog(new_mt.get());
+    }
     auto new_sv = std::make_shared<SuperVersion>(new_mt, new_imm, version);
     InstallSV(new_sv);
     DB_INFO("{}", new_sv->ToString());
-    flush_cv_.notify_one();
+    MaybeScheduleFlush();
   }
 }
 
 void DBImpl::Put(Slice key, Slice value) {
-  std::unique_lock lck(write_mutex_);
-  auto seq = ++seq_;
-  auto sv = GetSV();
-  sv->GetMt()->Put(key, seq, value);
-  if (sv->GetMt()->size() > options_.sst_file_size) {
-    SwitchMemtable();
-  }
+  WriteBatch batch;
+  batch.Put(key, value);
+  Write(batch);
 }
 
 void DBImpl::Del(Slice key) {
+  WriteBatch batch;
+  batch.Del(key);
+  Write(batch);
+}
+
+void DBImpl::DeleteRange(Slice begin, Slice end) {
+  WriteBatch batch;
+  batch.DeleteRange(begin, end);
+  Write(batch);
+}
+
+void DBImpl::Write(const WriteBatch& batch) {
+  if (batch.Count() == 0) {
+    return;
+  }
+  Writer w;
+  w.batch_ = &batch;
+  WriteImpl(&w);
+}
+
+void DBImpl::WaitForWriteTurn(
+    Writer* w, std::unique_lock<std::mutex>& lck) {
+  writers_.push_back(w);
+  w->cv_.wait(lck, [&]() { return w->done_ || writers_.front() == w; });
+}
+
+void DBImpl::FinishWrite(size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    auto w = writers_.front();
+    writers_.pop_front();
+    w->done_ = true;
+    w->cv_.notify_one();
+  }
+  if (!writers_.empty()) {
+    writers_.front()->cv_.notify_one();
+  }
+}
+
+void DBImpl::WriteImpl(Writer* w) {
+  /* The maximum size of the operations committed as a group. */
+  static constexpr size_t kMaxGroupCommitSize = 1 << 20;
   std::unique_lock lck(write_mutex_);
-  auto seq = ++seq_;
-  auto sv = GetSV();
-  sv->GetMt()->Del(key, seq);
-  if (sv->GetMt()->size() > options_.sst_file_size) {
-    SwitchMemtable();
+  WaitForWriteTurn(w, lck);
+  if (!w->done_) {
+    /* w is the leader now. */
+    auto sv = GetSV();
+    if (sv->GetMt()->size() > options_.sst_file_size) {
+      WaitForPendingWrites(lck);
+      SwitchMemtable();
+      sv = GetSV();
+    }
+    /* Take the writers in the queue as a group. */
+    std::vector<Writer*> group;
+    size_t group_size = 0;
+    for (auto x : writers_) {
+      if (x->exclusive_ || group_size > kMaxGroupCommitSize) {
+        break;
+      }
+      x->seq_ = last_allocated_seq_ + 1;
+      x->mt_ = sv->GetMt().get();
+      last_allocated_seq_ += x->batch_->Count();
+      group.push_back(x);
+      group_size += x->batch_->size();
+    }
+    /**
+     * The writers behind the group wait until the group is logged, so only
+     * the leader uses the log here. They also wait if the group is delayed,
+     * and join the next group.
+     */
+    lck.unlock();
+    write_controller_.DelayWrite(group_size);
+    if (log_) {
+      WriteBatch group_batch;
+      for (auto x : group) {
+        group_batch.Append(*x->batch_);
+      }
+      group_batch.SetSeq(group.front()->seq_);
+      log_->AddRecord(group_batch.GetRep());
+      GetStatsContext()->total_wal_bytes.fetch_add(
+          log_->Flush(options_.wal_sync), std::memory_order_relaxed);
+    }
+    lck.lock();
+    FinishWrite(group.size());
   }
+  lck.unlock();
+  /**
+   * The MemTable is not switched until this write is visible, because the
+   * leader that switches it waits for all the pending writes.
+   */
+  auto seq = w->seq_;
+  w->batch_->Iterate([&](seq_t, RecordType type, Slice key, Slice value) {
+    /* The cached rows are invalidated before the write is visible. */
+    if (row_cache_ != nullptr) {
+      if (type == RecordType::RangeDeletion) {
+        row_cache_->Clear(seq);
+      } else {
+        row_cache_->Erase(key, seq);
+      }
+    }
+    if (type == RecordType::Value) {
+      w->mt_->Put(key, seq++, value);
+    } else if (type == RecordType::Deletion) {
+      w->mt_->Del(key, seq++);
+    } else {
+      w->mt_->DeleteRange(key, value, seq++);
+    }
+  });
+  PublishWrite(w->seq_, w->seq_ + w->batch_->Count() - 1);
+}
+
+void DBImpl::PublishWrite(seq_t first_seq, seq_t last_seq) {
+  std::unique_lock lck(publish_mutex_);
+  applied_.emplace(first_seq, last_seq);
+  auto visible = seq_.load(std::memory_order_relaxed);
+  while (!applied_.empty() && applied_.begin()->first == visible + 1) {
+    visible = applied_.begin()->second;
+    applied_.erase(applied_.begin());
+  }
+  if (visible != seq_.load(std::memory_order_relaxed)) {
+    seq_.store(visible, std::memory_order_release);
+    publish_cv_.notify_all();
+  }
+  publish_cv_.wait(lck,
+      [&]() { return seq_.load(std::memory_order_relaxed) >= last_seq; });
+}
+
+void DBImpl::WaitForPendingWrites(std::unique_lock<std::mutex>& lck) {
+  auto last_seq = last_allocated_seq_;
+  /* The writers in the queue cannot proceed, because we are at the front. */
+  lck.unlock();
+  {
+    std::unique_lock publish_lck(publish_mutex_);
+    publish_cv_.wait(publish_lck, [&]() {
+      return seq_.load(std::memory_order_relaxed) >= last_seq;
+    });
+  }
+  lck.lock();
 }
 
 void DBImpl::DropAll() {
   WaitForFlushAndCompaction();
-  std::unique_lock db_lck(db_mutex_);
-  auto sv = GetSV();
-  auto new_sv = std::make_shared<SuperVersion>(std::make_shared<MemTable>(),
-      std::make_shared<std::vector<std::shared_ptr<MemTable>>>(),
-      std::make_shared<Version>());
-  auto version = sv->GetVersion();
-  for (auto& level : version->GetLevels()) {
-    for (auto& sr : level.GetRuns()) {
-      sr->SetRemoveTag(true);
+  Writer w;
+  w.exclusive_ = true;
+  std::unique_lock write_lck(write_mutex_);
+  WaitForWriteTurn(&w, write_lck);
+  WaitForPendingWrites(write_lck);
+  {
+    std::unique_lock db_lck(db_mutex_);
+    auto sv = GetSV();
+    auto new_sv = std::make_shared<SuperVersion>(
+        std::make_shared<MemTable>(options_.memtable_rep),
+        std::make_shared<std::vector<std::shared_ptr<MemTable>>>(),
+        std::make_shared<Version>());
+    auto version = sv->GetVersion();
+    for (auto& level : version->GetLevels()) {
+      for (auto& sr : level.GetRuns()) {
+        sr->SetRemoveTag(true);
+      }
+    }
+    if (options_.enable_wal) {
+      NewLog(new_sv->GetMt().get());
+    }
+    InstallSV(new_sv);
+    /* The readers of the old SuperVersion do not insert into the cache. */
+    if (row_cache_ != nullptr) {
+      row_cache_->Clear(seq_.load() + 1);
     }
+    LogVersionEdit(VersionEdit(*version, *new_sv->GetVersion()));
+    RemoveObsoleteBlobFiles(*version, *new_sv->GetVersion());
+    auto old_mts = *sv->GetImms();
+    old_mts.push_back(sv->GetMt());
+    RemoveLogs(old_mts);
   }
-  InstallSV(new_sv);
+  FinishWrite(1);
 }
 
-bool DBImpl::Get(Slice key, std::string* value) {
-  auto sv = GetSV();
-  auto seq = seq_;
-  return sv->Get(key, seq, value);
+bool DBImpl::Get(Slice key, std::string* value, const Snapshot* snapshot) {
+  LocalSV sv(this);
+  auto seq = ReadSeq(snapshot);
+  if (row_cache_ == nullptr) {
+    return sv->Get(key, seq, value);
+  }
+  std::optional<std::string> row;
+  if (!row_cache_->Lookup(key, seq, &row)) {
+    if (sv->Get(key, seq, value)) {
+      row = *value;
+    }
+    row_cache_->Insert(key, seq, row);
+    return row.has_value();
+  }
+  if (row) {
+    *value = std::move(*row);
+  }
+  return row.has_value();
 }
 
-void DBImpl::SaveMetadata() {
-  auto metadata_file = options_.db_path.string() + "/metadata";
-  FileWriter writer(
-      std::make_unique<SeqWriteFile>(metadata_file, options_.use_direct_io),
-      1 << 20);
-  auto sv = GetSV();
-  auto version = sv->GetVersion();
-  writer.AppendValue<uint64_t>(seq_)
-      .AppendValue<uint64_t>(filename_gen_->GetID())
-      .AppendValue<uint64_t>(version->GetLevels().size());
-  for (auto& level : version->GetLevels()) {
-    writer.AppendValue<uint64_t>(level.GetID())
-        .AppendValue<uint64_t>(level.GetRuns().size());
-    for (auto& run : level.GetRuns()) {
-      writer.AppendValue<uint64_t>(run->GetSSTs().size());
-      for (auto& sst : run->GetSSTs()) {
-        auto& info = sst->GetSSTInfo();
-        writer.AppendValue<uint64_t>(info.count_)
-            .AppendValue<uint64_t>(info.size_)
-            .AppendValue<uint64_t>(info.sst_id_)
-            .AppendValue<uint64_t>(info.index_offset_)
-            .AppendValue<uint64_t>(info.bloom_filter_offset_)
-            .AppendValue<uint64_t>(info.filename_.size())
-            .AppendString(info.filename_);
-      }
+std::vector<std::optional<std::string>> DBImpl::MultiGet(
+    std::span<const Slice> keys, const Snapshot* snapshot) {
+  LocalSV sv(this);
+  auto seq = ReadSeq(snapshot);
+  std::vector<LookupKey> lookups(keys.size());
+  std::vector<LookupKey*> sorted;
+  for (size_t i = 0; i < keys.size(); i++) {
+    lookups[i].user_key_ = keys[i];
+    sorted.push_back(&lookups[i]);
+  }
+  std::sort(sorted.begin(), sorted.end(), [](LookupKey* a, LookupKey* b) {
+    return a->user_key_ < b->user_key_;
+  });
+  sv->MultiGet(std::move(sorted), seq);
+  std::vector<std::optional<std::string>> ret(keys.size());
+  for (size_t i = 0; i < keys.size(); i++) {
+    if (lookups[i].result_ == GetResult::kFound) {
+      ret[i] = std::move(lookups[i].value_);
     }
   }
-  writer.Flush();
+  return ret;
 }
 
-void DBImpl::LoadMetadata() {
-  auto metadata_filename = options_.db_path.string() + "/metadata";
-  auto file =
-      std::make_unique<ReadFile>(metadata_filename, options_.use_direct_io);
+void DBImpl::SetEditState(VersionEdit* edit) {
+  auto sv = GetSV();
+  /* The logs of the MemTables that have not been flushed yet. */
+  size_t min_log_number = sv->GetMt()->GetLogNumber();
+  for (auto& imm : *sv->GetImms()) {
+    min_log_number = std::min(min_log_number, imm->GetLogNumber());
+  }
+  edit->SetSeq(seq_.load());
+  edit->SetNextFileId(filename_gen_->GetID());
+  edit->SetMinLogNumber(min_log_number);
+}
+
+void DBImpl::LogVersionEdit(VersionEdit edit) {
+  if (manifest_edits_ >= options_.manifest_checkpoint_interval) {
+    /* The current Version includes the edit. */
+    WriteSnapshot();
+    return;
+  }
+  SetEditState(&edit);
+  manifest_->AddRecord(edit.Encode());
+  manifest_->Flush(options_.wal_sync);
+  manifest_edits_ += 1;
+}
+
+void DBImpl::WriteSnapshot() {
+  auto manifest_file = options_.db_path.string() + "/MANIFEST";
+  VersionEdit edit(Version(), *GetSV()->GetVersion());
+  SetEditState(&edit);
+  /* Write to a temporary file and rename it, so that it is atomic. */
+  manifest_ = std::make_unique<LogWriter>(
+      std::make_unique<SeqWriteFile>(manifest_file + ".tmp", false), 0);
+  manifest_->AddRecord(edit.Encode());
+  manifest_->Flush(options_.wal_sync);
+  std::filesystem::rename(manifest_file + ".tmp", manifest_file);
+  manifest_edits_ = 0;
+}
+
+/**
+ * Read the metadata file of the databases written before the MANIFEST:
+ * [seq][next file id][number of levels] and each level is [level id]
+ * [number of runs], each run is [number of SSTables], and each SSTable is
+ * [count][size][sst id][index offset][bloom filter offset]
+ * [filename length][filename], all of which are uint64_t but the filename.
+ * The key ranges of the SSTables are read from the files.
+ */
+static VersionLayout LoadLegacyMetadata(const std::string& metadata_file,
+    bool use_direct_io, seq_t* seq, uint64_t* next_file_id) {
+  auto file = std::make_unique<ReadFile>(metadata_file, use_direct_io);
   FileReader reader(file.get(), 1 << 20, 0);
-  seq_ = reader.ReadValue<uint64_t>();
-  auto latest_file_id = reader.ReadValue<uint64_t>();
+  *seq = reader.ReadValue<uint64_t>();
+  *next_file_id = reader.ReadValue<uint64_t>();
   auto num_levels = reader.ReadValue<uint64_t>();
-  std::vector<Level> levels;
+  VersionLayout layout(num_levels);
   for (uint64_t i = 0; i < num_levels; i++) {
-    auto id = reader.ReadValue<uint64_t>();
-    auto num_run = reader.ReadValue<uint64_t>();
-    std::vector<std::shared_ptr<SortedRun>> runs;
-    for (uint64_t j = 0; j < num_run; j++) {
-      auto num_sst = reader.ReadValue<uint64_t>();
-      std::vector<SSTInfo> ssts;
-      for (uint64_t k = 0; k < num_sst; k++) {
+    reader.ReadValue<uint64_t>();
+    auto num_runs = reader.ReadValue<uint64_t>();
+    for (uint64_t j = 0; j < num_runs; j++) {
+      auto num_ssts = reader.ReadValue<uint64_t>();
+      auto& ssts = layout[i].emplace_back();
+      for (uint64_t k = 0; k < num_ssts; k++) {
         SSTInfo info;
         info.count_ = reader.ReadValue<uint64_t>();
         info.size_ = reader.ReadValue<uint64_t>();
@@ -186,26 +445,187 @@ void DBImpl::LoadMetadata() {
         info.bloom_filter_offset_ = reader.ReadValue<uint64_t>();
         auto len = reader.ReadValue<uint64_t>();
         info.filename_ = reader.ReadString(len);
-        ssts.push_back(info);
+        ssts.push_back(std::move(info));
+      }
+    }
+  }
+  return layout;
+}
+
+void DBImpl::LoadMetadata() {
+  auto manifest_file = options_.db_path.string() + "/MANIFEST";
+  auto metadata_file = options_.db_path.string() + "/metadata";
+  VersionLayout layout;
+  RangeTombstoneList range_dels;
+  uint64_t latest_file_id;
+  uint64_t min_log_number;
+  /* A database written before the MANIFEST is upgraded to it. */
+  bool legacy = !std::filesystem::exists(manifest_file) &&
+                std::filesystem::exists(metadata_file);
+  if (legacy) {
+    seq_t seq;
+    layout = LoadLegacyMetadata(
+        metadata_file, options_.use_direct_io, &seq, &latest_file_id);
+    DB_INFO("Upgrade {} to the MANIFEST", metadata_file);
+    seq_ = seq;
+    /* The MemTables were flushed on close, so no log is replayed. */
+    min_log_number = latest_file_id;
+  } else {
+    LogReader reader(manifest_file);
+    Slice payload;
+    if (!reader.ReadRecord(&payload)) {
+      DB_ERR("Invalid MANIFEST: {}", manifest_file);
+    }
+    /* The first record is a snapshot, and the others are edits. */
+    VersionEdit edit;
+    size_t num_edits = 0;
+    do {
+      edit = VersionEdit::Decode(payload);
+      edit.Apply(&layout);
+      num_edits += 1;
+    } while (reader.ReadRecord(&payload));
+    DB_INFO("Replay {} records from {}", num_edits, manifest_file);
+    seq_ = edit.GetSeq();
+    latest_file_id = edit.GetNextFileId();
+    min_log_number = edit.GetMinLogNumber();
+    range_dels = edit.GetRangeTombstones();
+  }
+  std::vector<Level> levels;
+  std::set<std::string> live_files;
+  for (size_t i = 0; i < layout.size(); i++) {
+    std::vector<std::shared_ptr<SortedRun>> runs;
+    for (auto& ssts : layout[i]) {
+      for (auto& info : ssts) {
+        live_files.insert(
+            std::filesystem::path(info.filename_).filename().string());
+        for (auto id : info.blob_files_) {
+          live_files.insert(fmt::format("{}.blob", id));
+        }
       }
       runs.push_back(std::make_shared<SortedRun>(
-          ssts, options_.block_size, options_.use_direct_io));
+          ssts, options_.block_size, options_.use_direct_io, cache_.get(),
+          table_cache_.get(), value_log_.get(),
+          ReadaheadOptions{options_.max_readahead_blocks,
+              readahead_scheduler_.get()},
+          options_.use_mmap_reads));
     }
-    levels.emplace_back(id, std::move(runs));
+    levels.emplace_back(i, std::move(runs));
   }
   auto version = std::make_shared<Version>(std::move(levels));
-  sv_ = std::make_shared<SuperVersion>(std::make_shared<MemTable>(),
-      std::make_shared<std::vector<std::shared_ptr<MemTable>>>(),
-      std::move(version));
-  DB_INFO("SuperVersion: {}", sv_->ToString());
+  version->SetRangeTombstones(std::move(range_dels));
+  /**
+   * Files created after the MANIFEST was written, e.g. the logs of new
+   * MemTables, must not be overwritten by new files.
+   * SSTables and blob files that are not in the MANIFEST are the outputs of
+   * unfinished flushes or compactions, so they are removed.
+   */
+  for (auto& entry : std::filesystem::directory_iterator(options_.db_path)) {
+    auto name = entry.path().filename().string();
+    auto ext = entry.path().extension().string();
+    if (ext == ".log") {
+      latest_file_id = std::max<uint64_t>(
+          latest_file_id, std::stoull(entry.path().stem().string()) + 1);
+    } else if ((ext == ".sst" || ext == ".blob") && !live_files.count(name)) {
+      std::filesystem::remove(entry.path());
+    }
+  }
   filename_gen_ = std::make_unique<FileNameGenerator>(
       options_.db_path.string() + "/", latest_file_id);
+  auto imms = std::make_shared<std::vector<std::shared_ptr<MemTable>>>();
+  RecoverLogs(min_log_number, imms.get());
+  sv_ = std::make_shared<SuperVersion>(
+      std::make_shared<MemTable>(options_.memtable_rep), std::move(imms),
+      std::move(version));
+  if (options_.enable_wal) {
+    NewLog(sv_->GetMt().get());
+  }
+  /* So that the next restart replays only the snapshot. */
+  WriteSnapshot();
+  if (legacy) {
+    std::filesystem::remove(metadata_file);
+  }
+  DB_INFO("SuperVersion: {}", sv_->ToString());
+}
+
+void DBImpl::NewLog(MemTable* mt) {
+  auto [filename, log_number] = filename_gen_->Generate("log");
+  log_ = std::make_unique<LogWriter>(
+      std::make_unique<SeqWriteFile>(filename, false), log_number);
+  mt->SetLogNumber(log_number);
+}
+
+void DBImpl::RemoveLogs(const std::vector<std::shared_ptr<MemTable>>& mts) {
+  if (!options_.enable_wal) {
+    return;
+  }
+  for (auto& mt : mts) {
+    std::filesystem::remove(
+        filename_gen_->GetFileName(mt->GetLogNumber(), "log"));
+  }
+}
+
+void DBImpl::RecoverLogs(
+    size_t min_log_number, std::vector<std::shared_ptr<MemTable>>* imms) {
+  std::vector<size_t> log_numbers;
+  for (auto& entry : std::filesystem::directory_iterator(options_.db_path)) {
+    if (entry.path().extension() != ".log") {
+      continue;
+    }
+    auto log_number = std::stoull(entry.path().stem().string());
+    if (log_number < min_log_number) {
+      /* Its MemTable has been flushed. */
+      std::filesystem::remove(entry.path());
+    } else {
+      log_numbers.push_back(log_number);
+    }
+  }
+  std::sort(log_numbers.begin(), log_numbers.end());
+  auto seq = seq_.load();
+  for (auto log_number : log_numbers) {
+    auto filename = filename_gen_->GetFileName(log_number, "log");
+    auto imm = std::make_shared<MemTable>(options_.memtable_rep);
+    LogReader reader(filename);
+    Slice payload;
+    while (reader.ReadRecord(&payload)) {
+      WriteBatch(payload).Iterate(
+          [&](seq_t s, RecordType type, Slice key, Slice value) {
+            if (type == RecordType::Value) {
+              imm->Put(key, s, value);
+            } else if (type == RecordType::Deletion) {
+              imm->Del(key, s);
+            } else {
+              imm->DeleteRange(key, value, s);
+            }
+            seq = std::max(seq, s);
+          });
+    }
+    if (imm->size() == 0) {
+      std::filesystem::remove(filename);
+      continue;
+    }
+    DB_INFO("Recover {} bytes from log {}", imm->size(), filename);
+    imm->SetLogNumber(log_number);
+    /* The newest MemTable is at the front. */
+    imms->insert(imms->begin(), std::move(imm));
+  }
+  seq_ = seq;
 }
 
-void DBImpl::Save() { SaveMetadata(); }
+void DBImpl::Save() {
+  std::unique_lock lck(db_mutex_);
+  WriteSnapshot();
+}
 
 void DBImpl::FlushAll() {
-  SwitchMemtable(true);
+  {
+    Writer w;
+    w.exclusive_ = true;
+    std::unique_lock lck(write_mutex_);
+    WaitForWriteTurn(&w, lck);
+    WaitForPendingWrites(lck);
+    SwitchMemtable(true);
+    FinishWrite(1);
+  }
   while (true) {
     {
       auto sv = GetSV();
@@ -218,215 +638,449 @@ void DBImpl::FlushAll() {
 }
 
 void DBImpl::WaitForFlushAndCompaction() {
-  while (true) {
-    db_mutex_.lock();
-    if (!flush_flag_ && !compact_flag_) {
-      db_mutex_.unlock();
-      return;
+  std::unique_lock lck(db_mutex_);
+  bg_cv_.wait(lck, [&]() {
+    return flushes_scheduled_ == 0 && compactions_scheduled_ == 0;
+  });
+}
+
+void DBImpl::MaybeScheduleFlush() {
+  if (stop_signal_) {
+    return;
+  }
+  /**
+   * If there are too many sorted runs in Level 0, the flush waits for the
+   * compaction, which schedules the flush when it finishes.
+   */
+  auto version = GetSV()->GetVersion();
+  if (version->GetLevels().size() > 0 &&
+      version->GetLevels()[0].GetRuns().size() >=
+          options_.level0_stop_writes_trigger) {
+    return;
+  }
+  for (auto& imm : PickMemTables()) {
+    if (flushes_scheduled_ >= options_.max_background_flushes) {
+      break;
     }
-    db_mutex_.unlock();
-    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    imm->SetFlushInProgress(true);
+    flushes_scheduled_ += 1;
+    scheduler_->Schedule(
+        [this, imm]() { BackgroundFlush(imm); }, JobPriority::kHigh);
   }
 }
 
-void DBImpl::FlushThread() {
-  while (!stop_signal_) {
-    /* Wait for the signal from SwitchMemtable */
-    std::unique_lock lck(db_mutex_);
-    if (stop_signal_) {
-      flush_flag_ = false;
-      return;
+void DBImpl::MaybeScheduleCompaction() {
+  while (!stop_signal_ &&
+         compactions_scheduled_ < options_.max_background_compactions) {
+    std::shared_ptr<Compaction> compaction =
+        compaction_picker_->Get(GetSV()->GetVersion().get());
+    if (!compaction) {
+      break;
     }
-    /* Pick the memtables that require flushing */
-    std::vector<std::shared_ptr<MemTable>> imms;
-    {
-      auto old_sv = GetSV();
-      while (old_sv->GetVersion()->GetLevels().size() > 0 &&
-             old_sv->GetVersion()->GetLevels()[0].GetRuns().size() >=
-                 options_.level0_stop_writes_trigger) {
-        old_sv.reset();
-        StopWrite();
-        old_sv = GetSV();
-      }
-      imms = PickMemTables();
-      if (imms.empty()) {
-        old_sv.reset();
-        flush_flag_ = false;
-        flush_cv_.wait(lck);
-        continue;
-      }
+    compaction->SetCompactionInProcess(true);
+    compactions_scheduled_ += 1;
+    scheduler_->Schedule([this, compaction]() mutable {
+      BackgroundCompaction(std::move(compaction));
+    }, JobPriority::kLow);
+  }
+}
 
-      for (auto& imm : imms) {
-        imm->SetFlushInProgress(true);
-      }
-      flush_flag_ = true;
-    }
-    /* Flush the memtables */
-    std::vector<std::shared_ptr<SortedRun>> runs;
-    {
-      db_mutex_.unlock();
-      for (auto& imm : imms) {
-        CompactionJob worker(filename_gen_.get(), options_.block_size,
-            options_.sst_file_size, options_.write_buffer_size,
-            options_.bloom_bits_per_key, options_.use_direct_io);
-        auto ssts = worker.Run(imm->Begin());
-        if (ssts.empty()) {
-          continue;
-        }
-        runs.push_back(std::make_shared<SortedRun>(
-            ssts, options_.block_size, options_.use_direct_io));
-        GetStatsContext()->total_input_bytes.fetch_add(
-            runs.back()->size(), std::memory_order_relaxed);
-      }
-      db_mutex_.lock();
-    }
-    /* Install the new SuperVersion */
-    {
-      for (auto& imm : imms) {
-        imm->SetFlushComplete(true);
-      }
-      auto old_sv = GetSV();
-      auto mt = old_sv->GetMt();
-      auto new_imm = std::make_shared<std::vector<std::shared_ptr<MemTable>>>();
-      auto new_version = std::make_shared<Version>(*old_sv->GetVersion());
-      /* Filter out all completed Memtables */
-      for (auto imm : *old_sv->GetImms()) {
-        if (!imm->GetFlushComplete()) {
-          new_imm->push_back(imm);
-        }
-      }
-      /* Append the sorted runs to the first level (L0) of the LSM tree. */
-      new_version->Append(0, std::move(runs));
-      auto new_sv =
-          std::make_shared<SuperVersion>(std::move(mt), new_imm, new_version);
-      DB_INFO("{}", new_sv->ToString());
-      InstallSV(std::move(new_sv));
-      compact_cv_.notify_one();
+void DBImpl::BackgroundFlush(std::shared_ptr<MemTable> imm) {
+  std::unique_lock lck(db_mutex_);
+  if (stop_signal_) {
+    imm->SetFlushInProgress(false);
+    flushes_scheduled_ -= 1;
+    bg_cv_.notify_all();
+    return;
+  }
+  /* Flush the memtable */
+  std::shared_ptr<SortedRun> run;
+  {
+    double bloom_bits_per_key = GetBloomBitsPerKey(0);
+    db_mutex_.unlock();
+    CompactionJob worker(filename_gen_.get(), options_.block_size,
+        options_.sst_file_size, options_.write_buffer_size,
+        bloom_bits_per_key, options_.use_direct_io,
+        options_.sst_format, options_.block_restart_interval,
+        options_.partition_index_and_filters, options_.blocked_bloom_filter,
+        options_.prefix_extractor.get(),
+        BlobWriteOptions{options_.min_blob_size, options_.blob_file_size, 0,
+            value_log_.get()});
+    /* The older records in the MemTable are deleted by its tombstones. */
+    auto range_dels = imm->GetRangeTombstones();
+    auto snapshots = GetSnapshotList();
+    auto ssts = worker.Run(imm->Begin(), &range_dels, &snapshots);
+    if (!ssts.empty()) {
+      run = std::make_shared<SortedRun>(ssts, options_.block_size,
+          options_.use_direct_io, cache_.get(), table_cache_.get(),
+          value_log_.get(),
+          ReadaheadOptions{options_.max_readahead_blocks,
+              readahead_scheduler_.get()},
+          options_.use_mmap_reads);
+      GetStatsContext()->total_input_bytes.fetch_add(
+          run->size(), std::memory_order_relaxed);
     }
+    db_mutex_.lock();
   }
+  imm->SetFlushComplete(true);
+  flushed_runs_[imm.get()] = std::move(run);
+  InstallFlushResults();
+  flushes_scheduled_ -= 1;
+  /* More MemTables may be switched during the flush. */
+  MaybeScheduleFlush();
+  MaybeScheduleCompaction();
+  /* This database may be destroyed once the lock is released. */
+  bg_cv_.notify_all();
 }
 
-void DBImpl::CompactionThread() {
-  while (!stop_signal_) {
-    std::unique_lock lck(db_mutex_);
-
-    if (stop_signal_) {
-      compact_flag_ = false;
-      return;
+void DBImpl::InstallFlushResults() {
+  auto old_sv = GetSV();
+  auto& imms = *old_sv->GetImms();
+  /* The oldest MemTable is the last one. */
+  std::vector<std::shared_ptr<MemTable>> flushed;
+  std::vector<std::shared_ptr<SortedRun>> runs;
+  for (auto it = imms.rbegin(); it != imms.rend(); ++it) {
+    auto result = flushed_runs_.find(it->get());
+    if (result == flushed_runs_.end()) {
+      break;
     }
-
-    // new compation task
-    std::unique_ptr<Compaction> compaction = compaction_picker_->Get(GetSV()->GetVersion().get());
-
-    if (!compaction) {
-      compact_flag_ = false;
-      compact_cv_.wait(lck);
-      continue;
+    flushed.push_back(*it);
+    if (result->second != nullptr) {
+      runs.push_back(std::move(result->second));
     }
+    flushed_runs_.erase(result);
+  }
+  if (flushed.empty()) {
+    return;
+  }
+  auto new_imm = std::make_shared<std::vector<std::shared_ptr<MemTable>>>(
+      imms.begin(), imms.end() - flushed.size());
+  auto new_version = std::make_shared<Version>(*old_sv->GetVersion());
+  /* Append the sorted runs to the first level (L0) of the LSM tree. */
+  new_version->Append(0, std::move(runs));
+  /* The tombstones may delete the records in the older sorted runs. */
+  auto range_dels = new_version->GetRangeTombstones();
+  for (auto& mt : flushed) {
+    range_dels.Append(mt->GetRangeTombstones());
+  }
+  new_version->SetRangeTombstones(std::move(range_dels));
+  auto new_sv =
+      std::make_shared<SuperVersion>(old_sv->GetMt(), new_imm, new_version);
+  DB_INFO("{}", new_sv->ToString());
+  InstallSV(std::move(new_sv));
+  /* The records are in SSTables now, so the logs are not needed. */
+  LogVersionEdit(VersionEdit(*old_sv->GetVersion(), *new_version));
+  RemoveLogs(flushed);
+}
 
-    compact_flag_ = true;
-    db_mutex_.unlock();
-
-    // need to do compaction
-
-    std::vector<SSTInfo> sst_infos;
-    if (compaction->is_trivial_move()) 
-      sst_infos.push_back(compaction->input_ssts()[0]->GetSSTInfo());
-    else {
-      std::list<SSTableIterator> sst_iters;
-      IteratorHeap<SSTableIterator> iter_heap;
-
-      for (auto& i : compaction->input_ssts()) {
-        sst_iters.push_back(i.get());
-        iter_heap.Push(&sst_iters.back());
-      }
-      
-      if (compaction->target_sorted_run() != nullptr) {
-        for (auto& i : compaction->target_sorted_run()->GetSSTs()) {
-          sst_iters.push_back(i.get());
-          iter_heap.Push(&sst_iters.back());
+/**
+ * The range tombstones that may still delete records in the Version. A
+ * tombstone is retired once no SSTable in its range has a record older than
+ * it. The MemTables only have newer records, since it has been flushed.
+ */
+static RangeTombstoneList LiveRangeTombstones(
+    const Version& version, const RangeTombstoneList& range_dels) {
+  RangeTombstoneList ret;
+  for (auto& tombstone : range_dels.GetTombstones()) {
+    bool live = false;
+    for (auto& level : version.GetLevels()) {
+      for (auto& run : level.GetRuns()) {
+        for (auto& sst : run->GetSSTs()) {
+          if (sst->GetSmallestKey().user_key_ < Slice(tombstone.end_) &&
+              !(sst->GetLargestKey().user_key_ < Slice(tombstone.begin_)) &&
+              sst->GetSSTInfo().smallest_seq_ < tombstone.seq_) {
+            live = true;
+            break;
+          }
         }
+        if (live) break;
       }
-      
-      CompactionJob job(
-        filename_gen_.get(),
-        options_.block_size,
-        options_.sst_file_size,
-        options_.write_buffer_size,
-        options_.bloom_bits_per_key,
-        options_.use_direct_io
-      );
-
-      sst_infos = job.Run(iter_heap);
+      if (live) break;
+    }
+    if (live) {
+      ret.Add(tombstone);
     }
+  }
+  return ret;
+}
 
+void DBImpl::BackgroundCompaction(std::shared_ptr<Compaction> compaction) {
+  std::unique_lock lck(db_mutex_);
+  if (stop_signal_) {
+    compaction->SetCompactionInProcess(false);
+    compactions_scheduled_ -= 1;
+    bg_cv_.notify_all();
+    return;
+  }
+  double bloom_bits_per_key = GetBloomBitsPerKey(compaction->target_level());
+  auto range_dels = GetSV()->GetVersion()->GetRangeTombstones();
+  auto blob_gc_cutoff = GetBlobGCCutoff();
+  db_mutex_.unlock();
+  /**
+   * The snapshots taken later see all the input records, so they need only
+   * the newest ones, which are always kept.
+   */
+  auto snapshots = GetSnapshotList();
 
-    db_mutex_.lock();
+  // need to do compaction
 
-    // create a new supervision and install
+  std::vector<SSTInfo> sst_infos;
+  if (!compaction->is_trivial_move())
+    sst_infos = RunCompaction(*compaction, bloom_bits_per_key, range_dels,
+        blob_gc_cutoff, snapshots);
 
-    const auto& sv = GetSV();
-    const auto& version = sv->GetVersion();
-    const auto& levels = version->GetLevels();
+  db_mutex_.lock();
 
-    std::vector<std::shared_ptr<SortedRun>> runs;
+  // create a new supervision and install
+
+  const auto& sv = GetSV();
+  const auto& version = sv->GetVersion();
+  const auto& levels = version->GetLevels();
+
+  std::vector<std::shared_ptr<SortedRun>> runs;
+  if (compaction->is_trivial_move()) {
+    /**
+     * The input SSTables do not overlap the target sorted run, so they are
+     * inserted into it as they are.
+     */
+    auto ssts = compaction->input_ssts();
+    if (compaction->target_sorted_run() != nullptr) {
+      auto& target_ssts = compaction->target_sorted_run()->GetSSTs();
+      ssts.insert(ssts.end(), target_ssts.begin(), target_ssts.end());
+    }
+    std::sort(ssts.begin(), ssts.end(), [](auto& a, auto& b) {
+      return a->GetSmallestKey() < b->GetSmallestKey();
+    });
+    runs.push_back(std::make_shared<SortedRun>(
+        ssts, options_.block_size, options_.use_direct_io));
+    GetStatsContext()->total_trivial_moves.fetch_add(
+        compaction->input_ssts().size());
+  } else if (!sst_infos.empty()) {
     runs.push_back(
       std::make_shared<SortedRun>(
-        sst_infos, options_.block_size, options_.use_direct_io
+        sst_infos, options_.block_size, options_.use_direct_io, cache_.get(),
+        table_cache_.get(), value_log_.get(),
+        ReadaheadOptions{options_.max_readahead_blocks,
+            readahead_scheduler_.get()},
+        options_.use_mmap_reads
       )
     );
+  }
 
-    const std::vector<std::shared_ptr<SortedRun>>& old_runs = levels[compaction->src_level()].GetRuns();
-    std::vector<std::shared_ptr<SortedRun>> new_runs;
-    if (compaction->src_level() == 0) {
-      new_runs = old_runs;
-      for (const auto& i : compaction->input_runs())
-        std::erase(new_runs, i);
-    } else {
-      std::vector<std::shared_ptr<SSTable>> old_ssts;
-      old_ssts.insert(old_ssts.end(), old_runs[0]->GetSSTs().begin(), old_runs[0]->GetSSTs().end());
-      for (const auto& i : compaction->input_ssts()) {
-        std::erase(old_ssts, i);
-      }
+  const std::vector<std::shared_ptr<SortedRun>>& old_runs = levels[compaction->src_level()].GetRuns();
+  std::vector<std::shared_ptr<SortedRun>> new_runs;
+  if (compaction->src_level() == 0) {
+    new_runs = old_runs;
+    for (const auto& i : compaction->input_runs())
+      std::erase(new_runs, i);
+  } else {
+    std::vector<std::shared_ptr<SSTable>> old_ssts;
+    old_ssts.insert(old_ssts.end(), old_runs[0]->GetSSTs().begin(), old_runs[0]->GetSSTs().end());
+    for (const auto& i : compaction->input_ssts()) {
+      std::erase(old_ssts, i);
+    }
+    if (!old_ssts.empty()) {
       new_runs.push_back(std::make_shared<SortedRun>(
         old_ssts,
         old_runs[0]->block_size(),
         old_runs[0]->use_direct_io()
       ));
     }
+  }
 
-    std::vector<Level> new_levels;
-    for (int i = 0; i < std::max(compaction->target_level() + 1, (int)levels.size()); ++i) {
-      if (i == compaction->src_level()) new_levels.emplace_back(i, std::move(new_runs));
-      else if (i == compaction->target_level()) new_levels.emplace_back(i, std::move(runs));
-      else new_levels.emplace_back(i, levels[i].GetRuns());
+  std::vector<Level> new_levels;
+  for (int i = 0; i < std::max(compaction->target_level() + 1, (int)levels.size()); ++i) {
+    if (i == compaction->src_level()) new_levels.emplace_back(i, std::move(new_runs));
+    else if (i == compaction->target_level()) new_levels.emplace_back(i, std::move(runs));
+    else new_levels.emplace_back(i, levels[i].GetRuns());
+  }
+
+  auto new_version = std::make_shared<Version>(std::move(new_levels));
+  new_version->SetRangeTombstones(
+      LiveRangeTombstones(*new_version, version->GetRangeTombstones()));
+  auto new_sv = std::make_shared<SuperVersion>(
+    sv->GetMt(),
+    sv->GetImms(),
+    std::move(new_version)
+  );
+
+  InstallSV(new_sv);
+  LogVersionEdit(VersionEdit(*version, *new_sv->GetVersion()));
+  RemoveObsoleteBlobFiles(*version, *new_sv->GetVersion());
+
+  // remove old SSTables
+
+  if (!compaction->is_trivial_move()) {
+    for (auto& i : compaction->input_ssts())
+      i->SetRemoveTag(true);
+    if (compaction->target_sorted_run() != nullptr)
+      compaction->target_sorted_run()->SetRemoveTag(true);
+  }
+  compaction->SetCompactionInProcess(false);
+  /* Drop the input SSTables before anyone waiting for the job wakes up. */
+  compaction.reset();
+
+  compactions_scheduled_ -= 1;
+  /* There may be more to compact, and the stalled flush can go on. */
+  MaybeScheduleCompaction();
+  MaybeScheduleFlush();
+  bg_cv_.notify_all();
+}
+
+double DBImpl::GetBloomBitsPerKey(size_t level) {
+  if (!options_.per_level_bloom_bits) {
+    return options_.bloom_bits_per_key;
+  }
+  return compaction_picker_->GetBloomBitsPerKey(
+      GetSV()->GetVersion().get(), level, options_.bloom_bits_per_key);
+}
+
+/* The blob files that the SSTables of the Version refer to */
+static std::set<uint64_t> GetBlobFiles(const Version& version) {
+  std::set<uint64_t> ret;
+  for (auto& level : version.GetLevels()) {
+    for (auto& run : level.GetRuns()) {
+      for (auto& sst : run->GetSSTs()) {
+        auto& ids = sst->GetSSTInfo().blob_files_;
+        ret.insert(ids.begin(), ids.end());
+      }
     }
+  }
+  return ret;
+}
 
-    auto new_version = std::make_shared<Version>(std::move(new_levels));
-    auto new_sv = std::make_shared<SuperVersion>(
-      sv->GetMt(),
-      sv->GetImms(),
-      std::move(new_version)
-    );
+uint64_t DBImpl::GetBlobGCCutoff() {
+  auto files = GetBlobFiles(*GetSV()->GetVersion());
+  size_t num_old = files.size() * options_.blob_gc_age_cutoff;
+  if (num_old == 0) {
+    return 0;
+  }
+  /* All the blob files are old if the cutoff is 1. */
+  if (num_old >= files.size()) {
+    return *files.rbegin() + 1;
+  }
+  return *std::next(files.begin(), num_old);
+}
 
-    InstallSV(new_sv);
+void DBImpl::RemoveObsoleteBlobFiles(
+    const Version& old_version, const Version& new_version) {
+  auto live = GetBlobFiles(new_version);
+  for (auto id : GetBlobFiles(old_version)) {
+    if (!live.count(id)) {
+      value_log_->GetFile(id)->SetRemoveTag(true);
+    }
+  }
+}
 
-    // remove old SSTables
+std::vector<SSTInfo> DBImpl::RunCompaction(const Compaction& compaction,
+    double bloom_bits_per_key, const RangeTombstoneList& range_dels,
+    uint64_t blob_gc_cutoff, const SnapshotList& snapshots) {
+  auto inputs = compaction.input_ssts();
+  if (compaction.target_sorted_run() != nullptr) {
+    auto& ssts = compaction.target_sorted_run()->GetSSTs();
+    inputs.insert(inputs.end(), ssts.begin(), ssts.end());
+  }
+  /* The SSTables whose records are all deleted are dropped without reading. */
+  std::erase_if(inputs, [&](const std::shared_ptr<SSTable>& sst) {
+    if (!range_dels.CoversRange(sst->GetSmallestKey().user_key_,
+            sst->GetLargestKey().user_key_, sst->GetSSTInfo().smallest_seq_,
+            sst->GetSSTInfo().largest_seq_, &snapshots)) {
+      return false;
+    }
+    GetStatsContext()->total_range_deleted_ssts.fetch_add(
+        1, std::memory_order_relaxed);
+    return true;
+  });
+  /**
+   * Split the key range at the largest keys of the input SSTables, so that
+   * the subcompactions read about the same number of SSTables. All the
+   * records of a user key are in the same subcompaction.
+   */
+  std::vector<std::string> bounds;
+  for (auto& sst : inputs) {
+    bounds.emplace_back(sst->GetLargestKey().user_key_);
+  }
+  std::sort(bounds.begin(), bounds.end());
+  bounds.erase(std::unique(bounds.begin(), bounds.end()), bounds.end());
+  if (!bounds.empty()) {
+    bounds.pop_back();
+  }
+  /* More subcompactions than cores would take turns on the cores. */
+  size_t cores = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+  size_t num = options_.max_subcompactions;
+  if (num == 0 || num > cores) {
+    num = cores;
+  }
+  num = std::min(std::max<size_t>(num, 1), bounds.size() + 1);
+  std::vector<std::optional<std::string>> splits{std::nullopt};
+  for (size_t i = 1; i < num; i++) {
+    splits.push_back(bounds[i * bounds.size() / num]);
+  }
+  splits.push_back(std::nullopt);
 
-    if (!compaction->is_trivial_move()) {
-      for (auto& i : compaction->input_ssts())
-        i->SetRemoveTag(true);
-      if (compaction->target_sorted_run() != nullptr)
-        compaction->target_sorted_run()->SetRemoveTag(true);
+  std::vector<std::vector<SSTInfo>> outputs(num);
+  auto subcompaction = [&](size_t k) {
+    auto& lower = splits[k];
+    auto& upper = splits[k + 1];
+    std::list<SSTableIterator> sst_iters;
+    IteratorHeap<Iterator> iter_heap;
+    for (auto& sst : inputs) {
+      if ((lower && sst->GetLargestKey().user_key_ <= Slice(*lower)) ||
+          (upper && sst->GetSmallestKey().user_key_ > Slice(*upper))) {
+        continue;
+      }
+      auto& it = sst_iters.emplace_back(sst.get());
+      if (lower) {
+        it.Seek(*lower, 0);
+      } else {
+        it.SeekToFirst();
+      }
+      iter_heap.Push(&it);
     }
+    KeyRangeIterator range_it(&iter_heap, lower, upper);
+    CompactionJob job(filename_gen_.get(), options_.block_size,
+        options_.sst_file_size, options_.write_buffer_size,
+        bloom_bits_per_key, options_.use_direct_io,
+        options_.sst_format, options_.block_restart_interval,
+        options_.partition_index_and_filters, options_.blocked_bloom_filter,
+        options_.prefix_extractor.get(),
+        BlobWriteOptions{options_.min_blob_size, options_.blob_file_size,
+            blob_gc_cutoff, value_log_.get()});
+    outputs[k] = job.Run(range_it, &range_dels, &snapshots);
+  };
+  /* The first subcompaction runs in this thread, and the others in the pool. */
+  std::vector<std::future<void>> futures;
+  for (size_t k = 1; k < num; k++) {
+    auto task = std::make_shared<std::packaged_task<void()>>(
+        [&subcompaction, k]() { subcompaction(k); });
+    futures.push_back(task->get_future());
+    subcompaction_scheduler_->Schedule(
+        [task]() { (*task)(); }, JobPriority::kLow);
+  }
+  subcompaction(0);
+  for (auto& future : futures) {
+    future.get();
+  }
+  GetStatsContext()->total_compactions.fetch_add(1);
+  GetStatsContext()->total_subcompactions.fetch_add(num);
+
+  std::vector<SSTInfo> ret;
+  for (auto& output : outputs) {
+    ret.insert(ret.end(), output.begin(), output.end());
   }
+  return ret;
 }
 
 std::vector<std::shared_ptr<MemTable>> DBImpl::PickMemTables() {
   std::vector<std::shared_ptr<MemTable>> ret;
-  for (auto imm : *sv_->GetImms()) {
-    if (!imm->GetFlushInProgress() && !imm->GetFlushComplete()) {
-      ret.push_back(std::move(imm));
+  /**
+   * The oldest MemTable goes first, so that its sorted run is appended to
+   * Level 0 before the newer ones.
+   */
+  auto imms = GetSV()->GetImms();
+  for (auto it = imms->rbegin(); it != imms->rend(); ++it) {
+    if (!(*it)->GetFlushInProgress() && !(*it)->GetFlushComplete()) {
+      ret.push_back(*it);
     }
   }
   return ret;
@@ -439,51 +1093,229 @@ std::shared_ptr<SuperVersion> DBImpl::GetSV() {
 }
 
 void DBImpl::InstallSV(std::shared_ptr<SuperVersion> sv) {
-  std::unique_lock lck(sv_mutex_);
-  sv_ = std::move(sv);
+  UpdateWriteState(sv.get());
+  std::vector<std::shared_ptr<SuperVersion>*> cached;
+  {
+    std::unique_lock lck(sv_mutex_);
+    sv_ = std::move(sv);
+    cached = ScrapeSVSlots();
+  }
+  /* The old SuperVersions may free MemTables and SSTables. */
+  for (auto old_sv : cached) {
+    delete old_sv;
+  }
+}
+
+DBImpl::SVSlot::~SVSlot() {
+  auto sv = ptr_.load();
+  if (sv != SVInUse()) {
+    delete sv;
+  }
+}
+
+DBImpl::LocalSV::LocalSV(DBImpl* db) : slot_(db->GetLocalSVSlot()) {
+  sv_ = slot_->ptr_.exchange(SVInUse(), std::memory_order_acquire);
+  /* The slot is empty, or used by an outer LocalSV of the thread. */
+  if (sv_ == nullptr || sv_ == SVInUse()) {
+    sv_ = new std::shared_ptr<SuperVersion>(db->GetSV());
+  }
+}
+
+DBImpl::LocalSV::~LocalSV() {
+  auto expected = SVInUse();
+  /* The slot has been scraped, so the SuperVersion may be obsolete. */
+  if (!slot_->ptr_.compare_exchange_strong(
+          expected, sv_, std::memory_order_release)) {
+    delete sv_;
+  }
+}
+
+std::shared_ptr<SuperVersion>* DBImpl::SVInUse() {
+  static std::shared_ptr<SuperVersion> in_use;
+  return &in_use;
+}
+
+DBImpl::SVSlot* DBImpl::GetLocalSVSlot() {
+  thread_local std::unordered_map<uint64_t, std::shared_ptr<SVSlot>> slots;
+  auto& slot = slots[id_];
+  if (slot == nullptr) {
+    /* Forget the slots of the databases that have been destroyed. */
+    std::erase_if(slots, [](auto& x) {
+      return x.second != nullptr && x.second.use_count() == 1;
+    });
+    slot = std::make_shared<SVSlot>();
+    std::unique_lock lck(sv_mutex_);
+    /* Forget the slots of the threads that have exited. */
+    std::erase_if(sv_slots_, [](auto& x) { return x.use_count() == 1; });
+    sv_slots_.push_back(slot);
+  }
+  return slot.get();
+}
+
+std::vector<std::shared_ptr<SuperVersion>*> DBImpl::ScrapeSVSlots() {
+  std::vector<std::shared_ptr<SuperVersion>*> ret;
+  for (auto& slot : sv_slots_) {
+    auto sv = slot->ptr_.exchange(nullptr, std::memory_order_acq_rel);
+    if (sv != nullptr && sv != SVInUse()) {
+      ret.push_back(sv);
+    }
+  }
+  return ret;
+}
+
+/**
+ * How close x is to the stop trigger, which is in (0, 1] if x reaches the
+ * slowdown trigger, and 0 otherwise.
+ */
+static double WritePressure(size_t x, size_t slowdown, size_t stop) {
+  slowdown = std::min(slowdown, stop);
+  if (x < slowdown) {
+    return 0;
+  }
+  return std::min<double>(x - slowdown + 1, stop - slowdown + 1) /
+         (stop - slowdown + 1);
+}
+
+void DBImpl::UpdateWriteState(SuperVersion* sv) {
+  auto version = sv->GetVersion();
+  auto& levels = version->GetLevels();
+  size_t l0_runs = levels.size() > 0 ? levels[0].GetRuns().size() : 0;
+  size_t pending_bytes =
+      compaction_picker_ ? compaction_picker_->GetPendingCompactionBytes(
+                               version.get())
+                         : 0;
+  double pressure = std::max(
+      WritePressure(l0_runs, options_.level0_slowdown_writes_trigger,
+          options_.level0_stop_writes_trigger),
+      WritePressure(pending_bytes, options_.soft_pending_compaction_bytes_limit,
+          options_.hard_pending_compaction_bytes_limit));
+  /**
+   * The writes are delayed when the last MemTable is being filled. With
+   * fewer MemTables, the writes only stop when all of them are full.
+   */
+  if (options_.max_immutable_count >= 3) {
+    pressure = std::max(pressure,
+        WritePressure(sv->GetImms()->size(), options_.max_immutable_count - 1,
+            options_.max_immutable_count));
+  }
+  if (pressure >= 1) {
+    write_controller_.SetState(WriteState::kStopped);
+  } else if (pressure > 0) {
+    write_controller_.SetState(WriteState::kDelayed, pressure);
+  } else {
+    write_controller_.SetState(WriteState::kNormal);
+  }
+}
+
+const Snapshot* DBImpl::GetSnapshot() {
+  std::unique_lock lck(snapshot_mutex_);
+  auto seq = seq_.load(std::memory_order_acquire);
+  snapshots_.insert(seq);
+  return new Snapshot(seq, id_);
+}
+
+void DBImpl::ReleaseSnapshot(const Snapshot* snapshot) {
+  {
+    std::unique_lock lck(snapshot_mutex_);
+    auto it = snapshots_.find(snapshot->seq());
+    if (snapshot->db_id_ != id_ || it == snapshots_.end()) {
+      DB_ERR("Release a snapshot that is not taken from this database");
+    }
+    snapshots_.erase(it);
+  }
+  delete snapshot;
+}
+
+SnapshotList DBImpl::GetSnapshotList() {
+  std::unique_lock lck(snapshot_mutex_);
+  return SnapshotList(std::vector<seq_t>(snapshots_.begin(), snapshots_.end()));
 }
 
-DBIterator DBImpl::Begin() {
-  DBIterator it(GetSV(), seq_);
+DBIterator DBImpl::Begin(const Snapshot* snapshot) {
+  DBIterator it(LocalSV(this).get(), ReadSeq(snapshot), value_log_.get());
   it.SeekToFirst();
   return it;
 }
 
-DBIterator DBImpl::Seek(Slice key) {
-  DBIterator it(GetSV(), seq_);
+DBIterator DBImpl::Seek(Slice key, const Snapshot* snapshot) {
+  DBIterator it(LocalSV(this).get(), ReadSeq(snapshot), value_log_.get());
   it.Seek(key);
   return it;
 }
 
+DBIterator DBImpl::PrefixSeek(Slice key, const Snapshot* snapshot) {
+  auto& extractor = options_.prefix_extractor;
+  if (!extractor || !extractor->InDomain(key)) {
+    return Seek(key, snapshot);
+  }
+  DBIterator it(LocalSV(this).get(), ReadSeq(snapshot), value_log_.get());
+  it.Seek(key, extractor->Transform(key));
+  return it;
+}
+
 void DBIterator::SeekToFirst() {
+  prefix_.reset();
+  blob_value_.reset();
   it_.SeekToFirst();
   if (it_.Valid()) {
     current_key_ = ParsedKey(it_.key());
-    if (current_key_.record_type() == RecordType::Deletion ||
-        current_key_.seq() > seq_) {
+    if (IsDeleted(current_key_) || current_key_.seq() > seq_) {
       Next();
     }
   }
 }
 
 void DBIterator::Seek(Slice key) {
+  prefix_.reset();
+  blob_value_.reset();
   it_.Seek(key, seq_);
   if (it_.Valid()) {
     current_key_ = ParsedKey(it_.key());
-    if (current_key_.record_type() == RecordType::Deletion ||
-        current_key_.seq() > seq_) {
+    if (IsDeleted(current_key_) || current_key_.seq() > seq_) {
       Next();
     }
   }
 }
 
-bool DBIterator::Valid() { return it_.Valid(); }
+void DBIterator::Seek(Slice key, Slice prefix) {
+  prefix_ = prefix;
+  blob_value_.reset();
+  it_.Seek(key, seq_, prefix);
+  if (it_.Valid()) {
+    current_key_ = ParsedKey(it_.key());
+    if (IsDeleted(current_key_) || current_key_.seq() > seq_) {
+      Next();
+    }
+  }
+}
+
+bool DBIterator::IsDeleted(ParsedKey key) const {
+  return key.type_ == RecordType::Deletion ||
+         (!range_dels_.empty() && range_dels_.ShouldDelete(key, seq_));
+}
+
+bool DBIterator::Valid() {
+  /**
+   * The keys with the prefix are adjacent, so it stops at the first key
+   * without it. The skipped sorted runs may have keys after that.
+   */
+  return it_.Valid() && (!prefix_ || key().starts_with(*prefix_));
+}
 
 Slice DBIterator::key() const { return current_key_.user_key(); }
 
-Slice DBIterator::value() const { return it_.value(); }
+Slice DBIterator::value() const {
+  if (current_key_.record_type() != RecordType::BlobIndex) {
+    return it_.value();
+  }
+  if (!blob_value_) {
+    blob_value_ = value_log_->Read(BlobIndex::Decode(it_.value()));
+  }
+  return *blob_value_;
+}
 
 void DBIterator::Next() {
+  blob_value_.reset();
   it_.Next();
   while (true) {
     while (it_.Valid() && (seq_ < ParsedKey(it_.key()).seq_ ||
@@ -494,7 +1326,7 @@ void DBIterator::Next() {
     }
     if (it_.Valid()) {
       current_key_ = ParsedKey(it_.key());
-      if (current_key_.record_type() == RecordType::Deletion) {
+      if (IsDeleted(current_key_)) {
         it_.Next();
         continue;
       }
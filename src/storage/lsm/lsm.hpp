@@ -6,9 +6,12 @@
 #include <limits>
 #include <map>
 #include <mutex>
+#include <optional>
 #include <set>
 #include <shared_mutex>
+#include <span>
 #include <thread>
+#include <unordered_map>
 #include <utility>
 #include <variant>
 
@@ -16,7 +19,14 @@
 #include "storage/lsm/compaction_pick.hpp"
 #include "storage/lsm/memtable.hpp"
 #include "storage/lsm/options.hpp"
+#include "storage/lsm/scheduler.hpp"
+#include "storage/lsm/snapshot.hpp"
+#include "storage/lsm/value_log.hpp"
 #include "storage/lsm/version.hpp"
+#include "storage/lsm/version_edit.hpp"
+#include "storage/lsm/wal.hpp"
+#include "storage/lsm/write_batch.hpp"
+#include "storage/lsm/write_controller.hpp"
 
 namespace wing {
 
@@ -35,60 +45,317 @@ class DBImpl {
 
   void Put(Slice key, Slice value);
   void Del(Slice key);
-  // Return true if kFound, false if not
-  bool Get(Slice key, std::string *value);
+  /**
+   * Delete the keys in [begin, end). The range tombstone is kept in the
+   * MemTable and then in the Version, and the compactions drop the records
+   * it covers, or the whole SSTables if they are covered.
+   */
+  void DeleteRange(Slice begin, Slice end);
+  /* Apply all the updates in batch atomically. */
+  void Write(const WriteBatch &batch);
+  /**
+   * Return true if kFound, false if not. The reads below see the records
+   * in snapshot if it is not nullptr, and the latest records otherwise.
+   */
+  bool Get(Slice key, std::string *value,
+      const Snapshot *snapshot = nullptr);
+  /**
+   * Get the keys in a batch from the same SuperVersion. The result of each
+   * key is std::nullopt if it is not found.
+   */
+  std::vector<std::optional<std::string>> MultiGet(
+      std::span<const Slice> keys, const Snapshot *snapshot = nullptr);
+  /**
+   * Take a snapshot of the current records. It is cheap, and it stays
+   * consistent across reads until ReleaseSnapshot.
+   */
+  const Snapshot *GetSnapshot();
+  /* Release a snapshot of this database. It must be released only once. */
+  void ReleaseSnapshot(const Snapshot *snapshot);
   void Save();
   void FlushAll();
   void WaitForFlushAndCompaction();
-  size_t CurrentSeq() const { return seq_; }
+  size_t CurrentSeq() const { return seq_.load(std::memory_order_acquire); }
   /* Delete all things */
   void DropAll();
 
-  DBIterator Begin();
-  DBIterator Seek(Slice key);
+  DBIterator Begin(const Snapshot *snapshot = nullptr);
+  DBIterator Seek(Slice key, const Snapshot *snapshot = nullptr);
+  /**
+   * Seek in prefix mode. The iterator only returns the keys with the same
+   * prefix as key, and it skips the sorted runs whose bloom filters do not
+   * have the prefix. It is the same as Seek if there is no prefix extractor
+   * or key has no prefix.
+   */
+  DBIterator PrefixSeek(Slice key, const Snapshot *snapshot = nullptr);
   std::shared_ptr<SuperVersion> GetSV();
   const Options &GetOptions() const { return options_; }
+  CacheStats GetCacheStats() { return cache_->GetStats(); }
+  RowCacheStats GetRowCacheStats() {
+    return row_cache_ ? row_cache_->GetStats() : RowCacheStats{};
+  }
 
  private:
+  /**
+   * A pending write in the writer queue.
+   * An exclusive writer does not write anything. It only waits until
+   * all the writers before it have finished, e.g. to switch the MemTable.
+   */
+  struct Writer {
+    const WriteBatch* batch_{nullptr};
+    bool exclusive_{false};
+    bool done_{false};
+    /* Assigned by the leader: the first sequence number and the MemTable. */
+    seq_t seq_{0};
+    MemTable* mt_{nullptr};
+    std::condition_variable cv_;
+  };
+
+  /**
+   * Write the batch of w. The writer at the front of the queue commits
+   * the writers behind it as a group: it assigns each of them a range of
+   * sequence numbers and writes the group to the log with a single write.
+   * Then every writer of the group inserts its own batch into the MemTable
+   * in parallel, while the next group is being logged.
+   */
+  void WriteImpl(Writer* w);
+  // Require: write_mutex_ held
+  void WaitForWriteTurn(Writer* w, std::unique_lock<std::mutex>& lck);
+  // Require: write_mutex_ held
+  void FinishWrite(size_t count);
+  /**
+   * Mark [first_seq, last_seq] as applied, and make the applied sequence
+   * numbers visible in order. Wait until last_seq is visible.
+   */
+  void PublishWrite(seq_t first_seq, seq_t last_seq);
+  /**
+   * Wait until every assigned sequence number is visible, so that no writer
+   * is still inserting into the MemTable.
+   * Require: write_mutex_ held by the front writer
+   */
+  void WaitForPendingWrites(std::unique_lock<std::mutex>& lck);
+  // Require: write_mutex_ held
   void SwitchMemtable(bool force = false);
-  void FlushThread();
-  void CompactionThread();
+  /**
+   * Schedule a flush for each MemTable to flush, up to
+   * options_.max_background_flushes flushes.
+   * Require: DB Mutex held
+   */
+  void MaybeScheduleFlush();
+  /**
+   * Pick and schedule compactions, up to options_.max_background_compactions
+   * compactions. They do not share SSTables.
+   * Require: DB Mutex held
+   */
+  void MaybeScheduleCompaction();
+  /* Flush the immutable MemTable. It runs in the scheduler. */
+  void BackgroundFlush(std::shared_ptr<MemTable> imm);
+  /**
+   * Install the flushed MemTables into Level 0, from the oldest one to the
+   * first one that is not flushed yet, so that the sorted runs are in order.
+   * Require: DB Mutex held
+   */
+  void InstallFlushResults();
+  /* Run the compaction. It runs in the scheduler. */
+  void BackgroundCompaction(std::shared_ptr<Compaction> compaction);
+  /* The bloom bits per key of the new SSTables of the level. */
+  // Require: DB Mutex held
+  double GetBloomBitsPerKey(size_t level);
+  /**
+   * Merge the inputs of the compaction into new SSTables. It splits the
+   * compaction into at most options_.max_subcompactions subcompactions of
+   * disjoint key ranges, which run in parallel in this thread and in
+   * subcompaction_scheduler_. The new SSTables have
+   * bloom_bits_per_key bits per key in their filters. The records deleted by
+   * range_dels are dropped, and so are the input SSTables they cover, unless
+   * the snapshots see them. The values in the blob files whose IDs <
+   * blob_gc_cutoff are moved to new blob files.
+   */
+  std::vector<SSTInfo> RunCompaction(const Compaction& compaction,
+      double bloom_bits_per_key, const RangeTombstoneList& range_dels,
+      uint64_t blob_gc_cutoff, const SnapshotList& snapshots);
+  /* The sequence number that a read with snapshot sees. */
+  seq_t ReadSeq(const Snapshot* snapshot) const {
+    return snapshot != nullptr ? snapshot->seq()
+                               : seq_.load(std::memory_order_acquire);
+  }
+  /* The live snapshots, which the flushes and the compactions keep. */
+  SnapshotList GetSnapshotList();
+  /**
+   * The blob files whose IDs < the cutoff are the oldest
+   * options_.blob_gc_age_cutoff of the blob files in the current Version.
+   * Require: DB Mutex held
+   */
+  uint64_t GetBlobGCCutoff();
+  /**
+   * Set the remove tags of the blob files that old_version refers to but
+   * new_version does not, so that they are removed once unused.
+   */
+  void RemoveObsoleteBlobFiles(
+      const Version& old_version, const Version& new_version);
   std::vector<std::shared_ptr<MemTable>> PickMemTables();
+  /**
+   * Install the SuperVersion, and release the SuperVersions cached by the
+   * threads, so that the old one is freed once no one uses it.
+   * Require: DB Mutex held
+   */
   void InstallSV(std::shared_ptr<SuperVersion> sv);
-  void SaveMetadata();
+
+  /**
+   * The SuperVersion cached by a thread for this database. ptr_ is the
+   * cached one, nullptr if there is none, or SVInUse() while the thread
+   * uses it. InstallSV swaps nullptr into the slots, so a thread that
+   * finds its slot changed after using the SuperVersion frees it.
+   */
+  struct SVSlot {
+    ~SVSlot();
+
+    std::atomic<std::shared_ptr<SuperVersion>*> ptr_{nullptr};
+  };
+
+  /**
+   * It borrows the SuperVersion from the slot of the thread, and returns it
+   * when it is destroyed. The read path does not take sv_mutex_ or touch
+   * the reference count of the SuperVersion unless the slot is empty.
+   */
+  class LocalSV {
+   public:
+    LocalSV(DBImpl* db);
+    ~LocalSV();
+
+    LocalSV(const LocalSV&) = delete;
+    LocalSV& operator=(const LocalSV&) = delete;
+
+    const std::shared_ptr<SuperVersion>& get() const { return *sv_; }
+    SuperVersion* operator->() const { return sv_->get(); }
+
+   private:
+    SVSlot* slot_;
+    std::shared_ptr<SuperVersion>* sv_;
+  };
+
+  /* The address that marks a slot in use. */
+  static std::shared_ptr<SuperVersion>* SVInUse();
+  /* Return the slot of the thread, which is registered on the first use. */
+  SVSlot* GetLocalSVSlot();
+  /* Release the SuperVersions in the slots. */
+  // Require: sv_mutex_ held
+  std::vector<std::shared_ptr<SuperVersion>*> ScrapeSVSlots();
+  /**
+   * Delay or stop the writes according to the immutable MemTables, the
+   * sorted runs in Level 0 and the pending compaction bytes.
+   * Require: DB Mutex held
+   */
+  void UpdateWriteState(SuperVersion* sv);
+  /* Set the sequence number, the file ID and the log number of edit. */
+  void SetEditState(VersionEdit* edit);
+  /**
+   * Append the edit to the MANIFEST. It writes a snapshot instead if there
+   * have been enough edits since the last snapshot.
+   * Require: DB Mutex held, and the edit has been installed.
+   */
+  void LogVersionEdit(VersionEdit edit);
+  /* Replace the MANIFEST with a snapshot of the current Version. */
+  // Require: DB Mutex held
+  void WriteSnapshot();
+  /* Replay the MANIFEST and the logs. */
   void LoadMetadata();
+  /* Create a new log file for the MemTable. */
+  void NewLog(MemTable* mt);
+  /* Remove the log files of the MemTables. */
+  void RemoveLogs(const std::vector<std::shared_ptr<MemTable>>& mts);
+  /**
+   * Replay the log files whose number >= min_log_number.
+   * Each log file becomes an immutable MemTable.
+   */
+  void RecoverLogs(size_t min_log_number,
+      std::vector<std::shared_ptr<MemTable>>* imms);
 
+  /* Wait until a background job finishes. */
   // Require: DB Mutex held
-  void StopWrite();
+  void StopWrite(std::unique_lock<std::mutex>& lck);
 
   Options options_;
-  Cache cache_;
-  size_t seq_;
+  std::shared_ptr<Cache> cache_;
+  std::shared_ptr<TableCache> table_cache_;
+  /* nullptr if the row cache is disabled */
+  std::unique_ptr<RowCache> row_cache_;
+  std::unique_ptr<ValueLog> value_log_;
+  std::shared_ptr<Scheduler> scheduler_;
+  /* nullptr if a compaction has only one subcompaction */
+  std::shared_ptr<Scheduler> subcompaction_scheduler_;
+  /**
+   * It reads the data blocks ahead for the iterators, or nullptr if
+   * readahead is disabled. The SSTables refer to it, so it is destroyed
+   * after them.
+   */
+  std::shared_ptr<Scheduler> readahead_scheduler_;
+  WriteController write_controller_;
+  /* The visible sequence number. All the records <= seq_ are applied. */
+  std::atomic<seq_t> seq_{0};
+  /* The last sequence number assigned to a writer, protected by write_mutex_ */
+  seq_t last_allocated_seq_{0};
 
-  std::vector<std::thread> threads_;
-  std::condition_variable flush_cv_;
-  std::condition_variable compact_cv_;
+  /* Protected by db_mutex_ */
   bool stop_signal_{false};
-  bool compact_flag_{false};
-  bool flush_flag_{false};
+  size_t flushes_scheduled_{0};
+  size_t compactions_scheduled_{0};
+  /* The flushed MemTables that are not installed, and their sorted runs. */
+  std::unordered_map<MemTable*, std::shared_ptr<SortedRun>> flushed_runs_;
+  /* Notified when a background job finishes. */
+  std::condition_variable bg_cv_;
 
   std::mutex write_mutex_;
+  /* The writer queue, protected by write_mutex_ */
+  std::deque<Writer*> writers_;
+  /* The log of the current MemTable. Only the front writer uses it. */
+  std::unique_ptr<LogWriter> log_;
+  std::mutex publish_mutex_;
+  std::condition_variable publish_cv_;
+  /* The applied ranges that are not visible yet, protected by publish_mutex_ */
+  std::map<seq_t, seq_t> applied_;
   std::mutex db_mutex_;
   std::shared_mutex sv_mutex_;
   std::shared_ptr<SuperVersion> sv_;
+  std::mutex snapshot_mutex_;
+  /* The sequence numbers of the live snapshots, protected by snapshot_mutex_ */
+  std::multiset<seq_t> snapshots_;
+  /* The ID of the database in the slots of the threads */
+  const uint64_t id_;
+  /**
+   * The slots of the threads that have read the database, protected by
+   * sv_mutex_. A thread and the database share a slot, and the one that
+   * leaves later frees it.
+   */
+  std::vector<std::shared_ptr<SVSlot>> sv_slots_;
   std::unique_ptr<FileNameGenerator> filename_gen_;
+  /* The MANIFEST, protected by db_mutex_ */
+  std::unique_ptr<LogWriter> manifest_;
+  /* The number of edits after the snapshot in the MANIFEST. */
+  size_t manifest_edits_{0};
   std::unique_ptr<CompactionPicker> compaction_picker_;
 };
 
 class DBIterator final : public Iterator {
  public:
-  DBIterator(std::shared_ptr<SuperVersion> sv, seq_t seq)
-    : sv_(std::move(sv)), it_(sv_.get()), seq_(seq) {}
+  DBIterator(std::shared_ptr<SuperVersion> sv, seq_t seq,
+      ValueLog* value_log = nullptr)
+    : sv_(std::move(sv)),
+      it_(sv_.get()),
+      seq_(seq),
+      range_dels_(sv_->GetRangeTombstones()),
+      value_log_(value_log) {}
 
   void SeekToFirst();
 
   void Seek(Slice key);
 
+  /**
+   * Seek in prefix mode, so that it is invalid after the last key with the
+   * prefix. The prefix must be the prefix of key.
+   */
+  void Seek(Slice key, Slice prefix);
+
   bool Valid() override;
 
   Slice key() const override;
@@ -98,10 +365,20 @@ class DBIterator final : public Iterator {
   void Next() override;
 
  private:
+  /* A deletion, or a record deleted by a range tombstone */
+  bool IsDeleted(ParsedKey key) const;
+
   std::shared_ptr<SuperVersion> sv_;
   SuperVersionIterator it_;
   seq_t seq_;
+  /* The range tombstones of sv_ when the iterator is created */
+  RangeTombstoneList range_dels_;
+  ValueLog* value_log_;
+  /* The value of the current key if it is in the value log, read lazily */
+  mutable std::optional<std::string> blob_value_;
   InternalKey current_key_;
+  /* The prefix of the keys in prefix mode */
+  std::optional<std::string> prefix_;
 };
 
 }  // namespace lsm
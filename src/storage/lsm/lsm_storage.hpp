@@ -1,5 +1,7 @@
 #pragma once
 
+#include <unordered_set>
+
 #include "storage/lsm/lsm.hpp"
 #include "storage/storage.hpp"
 
@@ -27,7 +29,7 @@ class LSMStorage : public Storage {
     db->schema_ = std::get<0>(db_schema_result);
     for (uint32_t i = 0; i < db->schema_.GetTables().size(); i++) {
       auto name = db->schema_.GetTables()[i].GetName();
-      lsm::Options options0 = options;
+      lsm::Options options0 = db->options_;
       options0.create_new = false;
       options0.db_path = fmt::format("{}/tables/t'{}'", path.string(), name);
       auto lsm = std::make_unique<lsm::DBImpl>(options0);
@@ -84,6 +86,21 @@ class LSMStorage : public Storage {
       table_.tick_ += 1;
       return true;
     }
+    bool InsertBatch(const std::vector<
+        std::pair<std::string_view, std::string_view>>& kvs) override {
+      std::string v0;
+      std::unordered_set<std::string_view> keys;
+      lsm::WriteBatch batch;
+      for (auto& [key, value] : kvs) {
+        if (!keys.insert(key).second || table_.lsm_->Get(key, &v0)) {
+          return false;
+        }
+        batch.Put(key, value);
+      }
+      table_.lsm_->Write(batch);
+      table_.tick_ += kvs.size();
+      return true;
+    }
     bool Update(std::string_view key, std::string_view new_value) override {
       table_.lsm_->Put(key, new_value);
       return true;
@@ -104,17 +121,32 @@ class LSMStorage : public Storage {
       }
       return reinterpret_cast<const uint8_t*>(value_.data());
     }
+    /**
+     * Search the keys in a batch. The result of each key is nullptr if it
+     * is not found, and is valid until the next search.
+     */
+    std::vector<const uint8_t*> MultiSearch(
+        std::span<const std::string_view> keys) {
+      values_ = lsm_->MultiGet(keys);
+      std::vector<const uint8_t*> ret;
+      for (auto& value : values_) {
+        ret.push_back(value ? reinterpret_cast<const uint8_t*>(value->data())
+                            : nullptr);
+      }
+      return ret;
+    }
 
    private:
     lsm::DBImpl* lsm_;
     std::string value_;
+    std::vector<std::optional<std::string>> values_;
   };
 
   class LSMIterator : public wing::Iterator<const uint8_t*> {
    public:
     LSMIterator(lsm::DBImpl* lsm, std::tuple<std::string_view, bool, bool> L,
         std::tuple<std::string_view, bool, bool> R)
-      : it_(std::get<1>(L) ? lsm->Begin() : lsm->Seek(std::get<0>(L))) {
+      : it_(Seek(lsm, L, R)) {
       if (!std::get<1>(L) && !std::get<2>(L) && it_.Valid() &&
           it_.key() == std::get<0>(L)) {
         it_.Next();
@@ -140,6 +172,27 @@ class LSMStorage : public Storage {
     }
 
    private:
+    /**
+     * If both bounds have the same prefix, so do all the keys in the range,
+     * and the sorted runs without the prefix are skipped.
+     */
+    static lsm::DBIterator Seek(lsm::DBImpl* lsm,
+        const std::tuple<std::string_view, bool, bool>& L,
+        const std::tuple<std::string_view, bool, bool>& R) {
+      if (std::get<1>(L)) {
+        return lsm->Begin();
+      }
+      auto& extractor = lsm->GetOptions().prefix_extractor;
+      auto lkey = std::get<0>(L);
+      auto rkey = std::get<0>(R);
+      if (extractor && !std::get<1>(R) && extractor->InDomain(lkey) &&
+          extractor->InDomain(rkey) &&
+          extractor->Transform(lkey) == extractor->Transform(rkey)) {
+        return lsm->PrefixSeek(lkey);
+      }
+      return lsm->Seek(lkey);
+    }
+
     bool first_flag_{true};
     lsm::DBIterator it_;
     std::tuple<std::string, bool, bool> R_;
@@ -202,6 +255,31 @@ class LSMStorage : public Storage {
   LSMStorage(const std::filesystem::path& path, const lsm::Options& options) {
     db_path_ = path.string();
     options_ = options;
+    /**
+     * All the tables share one block cache, one table cache and the pools of
+     * background threads, so that the memory budget, the number of open
+     * files and the number of threads do not grow with the number of tables.
+     */
+    if (!options_.block_cache) {
+      options_.block_cache = std::make_shared<lsm::Cache>(options_.cache);
+    }
+    if (!options_.table_cache) {
+      options_.table_cache =
+          std::make_shared<lsm::TableCache>(options_.table_cache_options);
+    }
+    if (!options_.scheduler) {
+      options_.scheduler = std::make_shared<lsm::Scheduler>();
+    }
+    if (!options_.readahead_scheduler && options_.max_readahead_blocks > 0) {
+      options_.readahead_scheduler =
+          std::make_shared<lsm::Scheduler>(options_.readahead_threads);
+    }
+    if (!options_.subcompaction_scheduler && options_.max_subcompactions != 1) {
+      /* A pool of 0 threads has a thread for each core. */
+      options_.subcompaction_scheduler = std::make_shared<lsm::Scheduler>(
+          options_.max_subcompactions == 0 ? 0
+                                           : options_.max_subcompactions - 1);
+    }
   }
   Table& GetTable(std::string_view table_name) {
     auto it = tables_.find(table_name);
@@ -8,13 +8,25 @@ namespace wing {
 namespace lsm {
 
 void MemTable::Add(ParsedKey key, Slice value) {
+  size_.fetch_add(key.size() + value.size() + sizeof(offset_t) * 2,
+      std::memory_order_relaxed);
+  if (rep_ == MemTableRep::kSkipList) {
+    auto node = list_.AllocateNode(key.size(), value.size());
+    utils::Serializer(node->Data())
+        .WriteString(key.user_key_)
+        .Write(key.seq_)
+        .Write(key.type_)
+        .WriteString(value);
+    list_.Insert(node);
+    return;
+  }
+  std::unique_lock<std::shared_mutex> lck(mu_);
   auto ptr = (char *)alloc_.Allocate(key.size() + value.size());
   utils::Serializer(ptr)
       .WriteString(key.user_key_)
       .Write(key.seq_)
       .Write(key.type_)
       .WriteString(value);
-  size_ += key.size() + value.size() + sizeof(offset_t) * 2;
   auto parsed_key =
       ParsedKey(Slice(ptr, key.user_key_.size()), key.seq_, key.type_);
   auto copied_value = Slice(ptr + key.size(), value.size());
@@ -22,33 +34,93 @@ void MemTable::Add(ParsedKey key, Slice value) {
 }
 
 void MemTable::Put(Slice user_key, seq_t seq, Slice value) {
-  std::unique_lock<std::shared_mutex> lck(mu_);
   Add(ParsedKey(user_key, seq, RecordType::Value), value);
 }
 
 void MemTable::Del(Slice user_key, seq_t seq) {
-  std::unique_lock<std::shared_mutex> lck(mu_);
   Add(ParsedKey(user_key, seq, RecordType::Deletion), Slice());
 }
 
+void MemTable::DeleteRange(Slice begin, Slice end, seq_t seq) {
+  size_.fetch_add(begin.size() + end.size() + sizeof(seq_t),
+      std::memory_order_relaxed);
+  std::unique_lock lck(range_del_mu_);
+  range_dels_.Add(RangeTombstone{
+      std::string(begin), std::string(end), seq});
+  has_range_dels_.store(true, std::memory_order_release);
+}
+
+RangeTombstoneList MemTable::GetRangeTombstones() {
+  if (!has_range_dels_.load(std::memory_order_acquire)) {
+    return {};
+  }
+  std::unique_lock lck(range_del_mu_);
+  return range_dels_;
+}
+
+seq_t MemTable::MaxCoveringSeq(Slice user_key, seq_t seq) {
+  if (!has_range_dels_.load(std::memory_order_acquire)) {
+    return 0;
+  }
+  std::unique_lock lck(range_del_mu_);
+  return range_dels_.MaxCoveringSeq(user_key, seq);
+}
+
 void MemTable::Clear() {
+  {
+    std::unique_lock lck(range_del_mu_);
+    range_dels_ = RangeTombstoneList();
+    has_range_dels_ = false;
+  }
   std::unique_lock<std::shared_mutex> lck(mu_);
-  table_.clear();
+  if (rep_ == MemTableRep::kSkipList) {
+    list_.Clear();
+  } else {
+    table_.clear();
+    alloc_.Clear();
+  }
+  size_ = 0;
 }
 
-GetResult MemTable::Get(Slice user_key, seq_t seq, std::string *value) {
-  std::shared_lock<std::shared_mutex> lock(mu_);
-  auto it = table_.lower_bound(ParsedKey(user_key, seq, RecordType::Value));
-  if (it == table_.end() || it->first.user_key_ != user_key) {
-    return GetResult::kNotFound;
+GetResult MemTable::Get(
+    Slice user_key, seq_t seq, std::string *value, seq_t *record_seq) {
+  ParsedKey key;
+  Slice v;
+  if (rep_ == MemTableRep::kSkipList) {
+    auto it = MemTableIterator(this);
+    it.Seek(user_key, seq);
+    if (!it.Valid()) {
+      return GetResult::kNotFound;
+    }
+    key = ParsedKey(it.key());
+    v = it.value();
   } else {
-    switch (it->first.type_) {
-      case RecordType::Deletion:
-        return GetResult::kDelete;
-      case RecordType::Value:
-        *value = it->second;
-        return GetResult::kFound;
+    std::shared_lock<std::shared_mutex> lock(mu_);
+    auto it = table_.lower_bound(ParsedKey(user_key, seq, RecordType::Value));
+    if (it == table_.end()) {
+      return GetResult::kNotFound;
     }
+    key = it->first;
+    v = it->second;
+  }
+  if (key.user_key_ != user_key) {
+    return GetResult::kNotFound;
+  }
+  if (record_seq != nullptr) {
+    *record_seq = key.seq_;
+  }
+  switch (key.type_) {
+    case RecordType::Deletion:
+      return GetResult::kDelete;
+    case RecordType::Value:
+      *value = v;
+      return GetResult::kFound;
+    case RecordType::RangeDeletion:
+      /* The range tombstones are kept in range_dels_, not in the records. */
+      DB_ERR("Range tombstone in the MemTable records!");
+    case RecordType::BlobIndex:
+      /* The blob indexes are written by the flushes and the compactions. */
+      DB_ERR("Blob index in the MemTable records!");
   }
   DB_ERR("Incorrect key value!");
 }
@@ -1,6 +1,8 @@
 #pragma once
 
+#include <atomic>
 #include <map>
+#include <mutex>
 #include <shared_mutex>
 #include <string>
 
@@ -9,6 +11,8 @@
 #include "storage/lsm/format.hpp"
 #include "storage/lsm/iterator.hpp"
 #include "storage/lsm/options.hpp"
+#include "storage/lsm/range_del.hpp"
+#include "storage/lsm/skiplist.hpp"
 
 namespace wing {
 
@@ -18,17 +22,35 @@ class MemTableIterator;
 
 class MemTable {
  public:
-  MemTable() : size_(0) {}
+  MemTable(MemTableRep rep = MemTableRep::kSkipList)
+    : rep_(rep), size_(0), list_(&alloc_) {}
 
   void Put(Slice user_key, seq_t seq, Slice value);
 
   void Del(Slice user_key, seq_t seq);
 
-  /* Find a record with the same key and the largest sequence number <= seq */
-  GetResult Get(Slice user_key, seq_t seq, std::string* value);
+  /* Delete the keys in [begin, end) whose sequence numbers < seq. */
+  void DeleteRange(Slice begin, Slice end, seq_t seq);
 
-  size_t size() const { return size_; }
+  /**
+   * Find a record with the same key and the largest sequence number <= seq.
+   * The sequence number of the record is stored in record_seq if it is not
+   * nullptr. The range tombstones are not checked.
+   */
+  GetResult Get(Slice user_key, seq_t seq, std::string* value,
+      seq_t* record_seq = nullptr);
 
+  /* A copy of the range tombstones. */
+  RangeTombstoneList GetRangeTombstones();
+
+  /* See RangeTombstoneList::MaxCoveringSeq */
+  seq_t MaxCoveringSeq(Slice user_key, seq_t seq);
+
+  size_t size() const { return size_.load(std::memory_order_relaxed); }
+
+  MemTableRep GetRep() const { return rep_; }
+
+  /* Only for MemTableRep::kMap */
   std::map<ParsedKey, Slice>& GetTable() { return table_; }
 
   MemTableIterator Seek(Slice user_key, seq_t seq);
@@ -43,44 +65,88 @@ class MemTable {
 
   bool GetFlushComplete() const { return flush_complete_; }
 
+  /* The number of the log file that holds the records of this MemTable. */
+  void SetLogNumber(size_t log_number) { log_number_ = log_number; }
+
+  size_t GetLogNumber() const { return log_number_; }
+
   void Clear();
 
  private:
   void Add(ParsedKey key, Slice value);
 
+  MemTableRep rep_;
+  /* Protects table_ and alloc_ for MemTableRep::kMap */
   std::shared_mutex mu_;
   std::map<ParsedKey, Slice> table_;
-  uint64_t size_;
+  std::atomic<uint64_t> size_;
   ArenaAllocator alloc_;
+  /* For MemTableRep::kSkipList. It allocates nodes in alloc_. */
+  SkipList list_;
+  /* Protects range_dels_, which is rarely written. */
+  std::mutex range_del_mu_;
+  RangeTombstoneList range_dels_;
+  /* If range_dels_ is not empty. Get checks it without the lock. */
+  std::atomic<bool> has_range_dels_{false};
   bool flush_in_progress_{false};
   bool flush_complete_{false};
+  size_t log_number_{0};
 
   friend class MemTableIterator;
 };
 
 class MemTableIterator final : public Iterator {
  public:
-  MemTableIterator(MemTable* table) : table_(table) {}
+  MemTableIterator(MemTable* table)
+    : table_(table),
+      use_list_(table->rep_ == MemTableRep::kSkipList),
+      list_it_(&table->list_) {}
 
   void Seek(Slice key, seq_t seq) {
-    it_ = table_->table_.lower_bound(ParsedKey(key, seq, RecordType::Value));
+    ParsedKey pkey(key, seq, RecordType::Value);
+    if (use_list_) {
+      list_it_.Seek(pkey);
+    } else {
+      it_ = table_->table_.lower_bound(pkey);
+    }
   }
 
-  void SeekToFirst() { it_ = table_->table_.begin(); }
+  void SeekToFirst() {
+    if (use_list_) {
+      list_it_.SeekToFirst();
+    } else {
+      it_ = table_->table_.begin();
+    }
+  }
 
-  bool Valid() override { return it_ != table_->table_.end(); }
+  bool Valid() override {
+    return use_list_ ? list_it_.Valid() : it_ != table_->table_.end();
+  }
 
   Slice key() const override {
+    if (use_list_) {
+      return list_it_.key();
+    }
     return Slice(it_->first.user_key_.data(), it_->first.size());
   }
 
-  Slice value() const override { return it_->second; }
+  Slice value() const override {
+    return use_list_ ? list_it_.value() : it_->second;
+  }
 
-  void Next() override { it_++; }
+  void Next() override {
+    if (use_list_) {
+      list_it_.Next();
+    } else {
+      it_++;
+    }
+  }
 
  private:
   MemTable* table_;
+  bool use_list_;
   std::map<ParsedKey, Slice>::iterator it_;
+  SkipList::Iterator list_it_;
 };
 
 }  // namespace lsm
@@ -1,13 +1,27 @@
 #pragma once
 
 #include <filesystem>
+#include <memory>
 
 #include "storage/lsm/cache.hpp"
+#include "storage/lsm/format.hpp"
+#include "storage/lsm/prefix_extractor.hpp"
+#include "storage/lsm/row_cache.hpp"
+#include "storage/lsm/scheduler.hpp"
+#include "storage/lsm/table_cache.hpp"
 
 namespace wing {
 
 namespace lsm {
 
+/* The data structure of MemTable. */
+enum class MemTableRep {
+  /* std::map protected by a reader-writer lock */
+  kMap,
+  /* Lock-free skiplist */
+  kSkipList,
+};
+
 struct Options {
   /* The directory path of the database */
   std::filesystem::path db_path;
@@ -15,14 +29,82 @@ struct Options {
   uint64_t sst_file_size = 64 * 1024 * 1024;
   /* The target size of data block in SSTable */
   size_t block_size = 4 * 1024;
+  /* The format of data blocks in new SSTables */
+  SSTFormat sst_format = SSTFormat::kPrefixCompressed;
+  /* The number of keys between restart points in a prefix-compressed block */
+  size_t block_restart_interval = 16;
+  /**
+   * Split the index and the bloom filter of new SSTables into partitions that
+   * are read through the block cache, so that only the top-level index stays
+   * in memory. It needs the block cache, otherwise the partitions are read
+   * from the file in every lookup.
+   */
+  bool partition_index_and_filters = true;
+  /**
+   * Use the cache-line blocked bloom filter in new SSTables, so that a
+   * lookup costs about one cache miss.
+   */
+  bool blocked_bloom_filter = true;
+  /**
+   * If it is set, the bloom filters of new SSTables also have the prefixes
+   * of the keys, and the seeks in prefix mode skip the sorted runs whose
+   * filters do not have the prefix. See DBImpl::PrefixSeek.
+   */
+  std::shared_ptr<const PrefixExtractor> prefix_extractor;
+  /**
+   * The values whose sizes >= min_blob_size are written to the value log
+   * when the MemTables are flushed, and the SSTables only have their
+   * locations, so that the compactions do not rewrite them. 0 disables it.
+   */
+  size_t min_blob_size = 0;
+  /* The target size of the blob files in the value log */
+  uint64_t blob_file_size = 256 * 1024 * 1024;
+  /**
+   * The compactions move the values in the oldest blob files, which are this
+   * fraction of the blob files, to new blob files. An old blob file is
+   * removed when no SSTable refers to it. It must be in [0, 1].
+   */
+  double blob_gc_age_cutoff = 0.25;
   /* The size of write buffer */
   size_t write_buffer_size = 1024 * 1024;
   /* Use O_DIRECT or not */
   bool use_direct_io = false;
+  /**
+   * Map the SSTables into memory, and read the blocks from the mappings
+   * instead of the files and the block cache. It avoids the copies of the
+   * blocks if the SSTables fit in the page cache.
+   */
+  bool use_mmap_reads = false;
+  /**
+   * The maximum number of data blocks that an iterator, e.g. a scan or an
+   * input of a compaction, reads ahead in the background. The readahead
+   * grows from one block as the iterator moves on. 0 disables it.
+   */
+  size_t max_readahead_blocks = 8;
+  /* The number of threads that read the blocks ahead */
+  size_t readahead_threads = 4;
+  /**
+   * The thread pool that reads the blocks ahead, shared with other
+   * databases. If it is nullptr and readahead is enabled, the database
+   * creates its own pool with readahead_threads threads. It must not be
+   * scheduler, because the compactions wait for the blocks they read ahead.
+   */
+  std::shared_ptr<Scheduler> readahead_scheduler;
   /* Use bloom filter or not*/
   bool enable_bloom_filter = true;
   /* Whether we create a new database in the directory */
   bool create_new = true;
+  /* Write every update to the write-ahead log before the MemTable */
+  bool enable_wal = true;
+  /**
+   * Force the write-ahead log to the storage device on every group commit.
+   * Without it, writes survive a process crash but not a machine crash.
+   */
+  bool wal_sync = false;
+  /* The MANIFEST is rewritten as a snapshot after this number of edits. */
+  size_t manifest_checkpoint_interval = 128;
+  /* The data structure of MemTable */
+  MemTableRep memtable_rep = MemTableRep::kSkipList;
   /* The maximum number of immutable MemTables. */
   size_t max_immutable_count = 4;
   /* The name of compaction strategy. */
@@ -34,15 +116,75 @@ struct Options {
    * It stops writes when the number of sorted runs reaches this limit.
    */
   size_t level0_stop_writes_trigger = 20;
+  /* Writes are delayed when Level 0 has this number of sorted runs. */
+  size_t level0_slowdown_writes_trigger = 12;
+  /**
+   * Writes are delayed when the estimated bytes to compact reach the soft
+   * limit, and stopped when they reach the hard limit.
+   */
+  uint64_t soft_pending_compaction_bytes_limit = 1ull << 30;  // 1GiB
+  uint64_t hard_pending_compaction_bytes_limit = 4ull << 30;  // 4GiB
+  /**
+   * The write rate in bytes per second when writes are delayed. It is lowered
+   * further as the database gets closer to stopping writes.
+   */
+  uint64_t delayed_write_rate = 16 * 1024 * 1024;
   /* The default size ratio used in tiering/leveling compaction strategy. */
   size_t compaction_size_ratio = 10;
+  /**
+   * The maximum number of subcompactions in a compaction. Each of them merges
+   * a disjoint key range of the inputs. The first one runs in the thread of
+   * the compaction, and the others in subcompaction_scheduler. There are no
+   * more of them than cores, and 0 means the number of cores.
+   */
+  size_t max_subcompactions = 4;
   /* The number of bits per key in bloom filter, by default */
   size_t bloom_bits_per_key = 10;
+  /**
+   * Assign the bloom bits per key of each level by the level sizes, so that
+   * the lookups have fewer false positives with the same memory in total.
+   * See CompactionPicker::GetBloomBitsPerKey.
+   */
+  bool per_level_bloom_bits = true;
   /* The target scan length in part3 */
   double target_scan_length_part3 = 0;
   /* The target alpha in part3 */
   double target_alpha_part3 = 0;
+  /* The options of the block cache, used if block_cache is nullptr. */
   CacheOptions cache{};
+  /**
+   * The block cache shared with other databases. If it is nullptr, the
+   * database creates its own cache.
+   */
+  std::shared_ptr<Cache> block_cache;
+  /* The options of the table cache, used if table_cache is nullptr. */
+  TableCacheOptions table_cache_options{};
+  /**
+   * The cache of opened SSTables shared with other databases. If it is
+   * nullptr, the database creates its own cache.
+   */
+  std::shared_ptr<TableCache> table_cache;
+  /**
+   * The options of the row cache, which caches the results of Get above the
+   * MemTables and the SSTables. It is disabled by default.
+   */
+  RowCacheOptions row_cache_options{};
+  /* The maximum numbers of flushes and compactions running at the same time */
+  size_t max_background_flushes = 1;
+  size_t max_background_compactions = 2;
+  /**
+   * The thread pool that runs flushes and compactions, shared with other
+   * databases. If it is nullptr, the database creates its own pool with
+   * a thread for each flush and each compaction.
+   */
+  std::shared_ptr<Scheduler> scheduler;
+  /**
+   * The thread pool that runs the subcompactions, shared with other
+   * databases. If it is nullptr, the database creates its own pool with
+   * max_subcompactions - 1 threads. It must not be scheduler, because a
+   * compaction waits for its subcompactions.
+   */
+  std::shared_ptr<Scheduler> subcompaction_scheduler;
 };
 
 }  // namespace lsm
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "storage/lsm/format.hpp"
+
+namespace wing {
+
+namespace lsm {
+
+/**
+ * It maps a user key to its prefix, e.g. the leading columns of a composite
+ * key. The prefix of a key must be a byte prefix of it, so that the keys
+ * with the same prefix are adjacent in the key order.
+ *
+ * The prefixes of the keys are added to the bloom filters of the SSTables,
+ * so it must not change for a database.
+ */
+class PrefixExtractor {
+ public:
+  virtual ~PrefixExtractor() = default;
+
+  /* Return true if the key has a prefix. */
+  virtual bool InDomain(Slice key) const = 0;
+
+  /* Return the prefix of a key in the domain. */
+  virtual Slice Transform(Slice key) const = 0;
+};
+
+/* The first len bytes. The keys shorter than len have no prefix. */
+class FixedPrefixExtractor final : public PrefixExtractor {
+ public:
+  explicit FixedPrefixExtractor(size_t len) : len_(len) {}
+
+  bool InDomain(Slice key) const override { return key.size() >= len_; }
+
+  Slice Transform(Slice key) const override { return key.substr(0, len_); }
+
+ private:
+  size_t len_;
+};
+
+}  // namespace lsm
+
+}  // namespace wing
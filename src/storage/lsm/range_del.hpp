@@ -0,0 +1,97 @@
+#pragma once
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "storage/lsm/format.hpp"
+#include "storage/lsm/snapshot.hpp"
+
+namespace wing {
+
+namespace lsm {
+
+/**
+ * A range tombstone. It deletes the records whose user keys are in
+ * [begin_, end_) and whose sequence numbers are smaller than seq_.
+ */
+struct RangeTombstone {
+  std::string begin_;
+  std::string end_;
+  seq_t seq_;
+
+  bool Covers(Slice user_key) const {
+    return Slice(begin_) <= user_key && user_key < Slice(end_);
+  }
+};
+
+/**
+ * The range tombstones of a MemTable or a Version. DeleteRange is for bulk
+ * deletes, so there are few of them, and they are searched linearly.
+ */
+class RangeTombstoneList {
+ public:
+  void Add(RangeTombstone tombstone) {
+    tombstones_.push_back(std::move(tombstone));
+  }
+
+  void Append(const RangeTombstoneList& list) {
+    tombstones_.insert(
+        tombstones_.end(), list.tombstones_.begin(), list.tombstones_.end());
+  }
+
+  /**
+   * The largest sequence number <= seq of the tombstones that cover the
+   * user key, or 0 if there is none.
+   */
+  seq_t MaxCoveringSeq(Slice user_key, seq_t seq) const {
+    seq_t ret = 0;
+    for (auto& tombstone : tombstones_) {
+      if (tombstone.seq_ <= seq && tombstone.seq_ > ret &&
+          tombstone.Covers(user_key)) {
+        ret = tombstone.seq_;
+      }
+    }
+    return ret;
+  }
+
+  /* Return true if the record is deleted by a tombstone visible at seq. */
+  bool ShouldDelete(ParsedKey key, seq_t seq) const {
+    return MaxCoveringSeq(key.user_key_, seq) > key.seq_;
+  }
+
+  /**
+   * Return true if a tombstone deletes all the records of an SSTable, whose
+   * user keys are in [smallest, largest] and sequence numbers are in
+   * [min_seq, max_seq]. A snapshot between the records and the tombstone
+   * still sees them.
+   */
+  bool CoversRange(Slice smallest, Slice largest, seq_t min_seq,
+      seq_t max_seq, const SnapshotList* snapshots = nullptr) const {
+    return std::any_of(tombstones_.begin(), tombstones_.end(),
+        [&](const RangeTombstone& tombstone) {
+          return tombstone.seq_ > max_seq &&
+                 Slice(tombstone.begin_) <= smallest &&
+                 largest < Slice(tombstone.end_) &&
+                 (snapshots == nullptr ||
+                     !snapshots->AnyInRange(min_seq, tombstone.seq_));
+        });
+  }
+
+  bool empty() const { return tombstones_.empty(); }
+
+  size_t size() const { return tombstones_.size(); }
+
+  const std::vector<RangeTombstone>& GetTombstones() const {
+    return tombstones_;
+  }
+
+  std::vector<RangeTombstone>& GetTombstones() { return tombstones_; }
+
+ private:
+  std::vector<RangeTombstone> tombstones_;
+};
+
+}  // namespace lsm
+
+}  // namespace wing
@@ -0,0 +1,115 @@
+#include "storage/lsm/row_cache.hpp"
+
+namespace wing {
+
+namespace lsm {
+
+RowCache::RowCache(const RowCacheOptions& options) {
+  size_t num_shards = std::max<size_t>(options.num_shards, 1);
+  for (size_t i = 0; i < num_shards; i++) {
+    shards_.push_back(std::make_unique<Shard>(options.capacity / num_shards));
+  }
+}
+
+bool RowCache::Lookup(
+    Slice key, seq_t seq, std::optional<std::string>* value) {
+  return GetShard(key)->Lookup(key, seq, value);
+}
+
+void RowCache::Insert(Slice key, seq_t seq, std::optional<std::string> value) {
+  GetShard(key)->Insert(key, seq, std::move(value));
+}
+
+void RowCache::Erase(Slice key, seq_t seq) { GetShard(key)->Erase(key, seq); }
+
+void RowCache::Clear(seq_t seq) {
+  for (auto& shard : shards_) {
+    shard->Clear(seq);
+  }
+}
+
+RowCacheStats RowCache::GetStats() {
+  RowCacheStats ret;
+  for (auto& shard : shards_) {
+    auto stats = shard->GetStats();
+    ret.hits_ += stats.hits_;
+    ret.misses_ += stats.misses_;
+    ret.count_ += stats.count_;
+    ret.size_ += stats.size_;
+  }
+  return ret;
+}
+
+bool RowCache::Shard::Lookup(
+    Slice key, seq_t seq, std::optional<std::string>* value) {
+  std::unique_lock lck(mu_);
+  auto it = table_.find(key);
+  /* A row read after seq may be newer than the version visible at seq. */
+  if (it == table_.end() || it->second->seq_ > seq) {
+    stats_.misses_ += 1;
+    return false;
+  }
+  stats_.hits_ += 1;
+  lru_.splice(lru_.begin(), lru_, it->second);
+  *value = it->second->value_;
+  return true;
+}
+
+void RowCache::Shard::Insert(
+    Slice key, seq_t seq, std::optional<std::string> value) {
+  std::unique_lock lck(mu_);
+  /* The key may be written after the lookup has read it. */
+  if (seq < invalidated_seq_) {
+    return;
+  }
+  auto it = table_.find(key);
+  if (it != table_.end()) {
+    if (it->second->seq_ >= seq) {
+      return;
+    }
+    Remove(it->second);
+  }
+  size_t charge =
+      sizeof(Entry) + key.size() + (value ? value->size() : 0);
+  lru_.push_front(Entry{std::string(key), seq, std::move(value), charge});
+  table_.emplace(lru_.front().key_, lru_.begin());
+  stats_.size_ += charge;
+  stats_.count_ += 1;
+  while (stats_.size_ > capacity_ && !lru_.empty()) {
+    Remove(std::prev(lru_.end()));
+  }
+}
+
+void RowCache::Shard::Erase(Slice key, seq_t seq) {
+  std::unique_lock lck(mu_);
+  invalidated_seq_ = std::max(invalidated_seq_, seq);
+  auto it = table_.find(key);
+  if (it != table_.end()) {
+    Remove(it->second);
+  }
+}
+
+void RowCache::Shard::Clear(seq_t seq) {
+  std::unique_lock lck(mu_);
+  invalidated_seq_ = std::max(invalidated_seq_, seq);
+  table_.clear();
+  lru_.clear();
+  stats_.size_ = 0;
+  stats_.count_ = 0;
+}
+
+RowCacheStats RowCache::Shard::GetStats() {
+  std::unique_lock lck(mu_);
+  return stats_;
+}
+
+void RowCache::Shard::Remove(std::list<Entry>::iterator it) {
+  stats_.size_ -= it->charge_;
+  stats_.count_ -= 1;
+  table_.erase(it->key_);
+  lru_.erase(it);
+}
+
+}  // namespace lsm
+
+}  // namespace wing
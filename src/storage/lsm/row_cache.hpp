@@ -0,0 +1,112 @@
+#pragma once
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "storage/lsm/format.hpp"
+
+namespace wing {
+
+namespace lsm {
+
+struct RowCacheOptions {
+  /* The maximum memory used by the cached rows. 0 disables the row cache. */
+  size_t capacity = 0;
+  /* The number of shards. Each shard has its own lock. */
+  size_t num_shards = 16;
+};
+
+struct RowCacheStats {
+  uint64_t hits_{0};
+  uint64_t misses_{0};
+  /* The number of cached rows and their charge. */
+  uint64_t count_{0};
+  uint64_t size_{0};
+};
+
+/**
+ * A sharded LRU cache of the results of point lookups, keyed by user key.
+ * It caches the keys that are not found too, e.g. for the uniqueness checks
+ * of inserts.
+ *
+ * Each row has the sequence number of the lookup that reads it. The writers
+ * erase the keys they write before the writes are visible, and each shard
+ * remembers the largest sequence number it is invalidated at. A lookup that
+ * started before that may have read an older version, so it does not insert
+ * its result.
+ */
+class RowCache {
+ public:
+  RowCache(const RowCacheOptions& options);
+
+  /**
+   * Return true if the key is cached and the row is visible at seq. *value
+   * is std::nullopt if the key is not found.
+   */
+  bool Lookup(Slice key, seq_t seq, std::optional<std::string>* value);
+
+  /* Insert the result of a lookup at seq. */
+  void Insert(Slice key, seq_t seq, std::optional<std::string> value);
+
+  /* The key is written at seq. */
+  void Erase(Slice key, seq_t seq);
+
+  /* All the keys are written at seq, e.g. by a range deletion. */
+  void Clear(seq_t seq);
+
+  /* The sum of the counters of all the shards. */
+  RowCacheStats GetStats();
+
+ private:
+  struct Entry {
+    std::string key_;
+    seq_t seq_;
+    std::optional<std::string> value_;
+    size_t charge_;
+  };
+
+  class Shard {
+   public:
+    Shard(size_t capacity) : capacity_(capacity) {}
+
+    bool Lookup(Slice key, seq_t seq, std::optional<std::string>* value);
+
+    void Insert(Slice key, seq_t seq, std::optional<std::string> value);
+
+    void Erase(Slice key, seq_t seq);
+
+    void Clear(seq_t seq);
+
+    RowCacheStats GetStats();
+
+   private:
+    // Require: mu_ held
+    void Remove(std::list<Entry>::iterator it);
+
+    const size_t capacity_;
+    std::mutex mu_;
+    /* The most recently used one is at the front. */
+    std::list<Entry> lru_;
+    std::unordered_map<std::string_view, std::list<Entry>::iterator> table_;
+    /* The largest sequence number that the keys in the shard are written at */
+    seq_t invalidated_seq_{0};
+    RowCacheStats stats_;
+  };
+
+  Shard* GetShard(Slice key) {
+    /* The low bits are used by the hash table in the shard. */
+    auto hash = std::hash<std::string_view>()(key);
+    return shards_[(hash >> 32) % shards_.size()].get();
+  }
+
+  std::vector<std::unique_ptr<Shard>> shards_;
+};
+
+}  // namespace lsm
+
+}  // namespace wing
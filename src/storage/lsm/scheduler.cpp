@@ -0,0 +1,56 @@
+#include "storage/lsm/scheduler.hpp"
+
+#include <algorithm>
+
+namespace wing {
+
+namespace lsm {
+
+Scheduler::Scheduler(size_t num_threads) {
+  if (num_threads == 0) {
+    /* Flushes and compactions can run at the same time. */
+    num_threads = std::max<size_t>(std::thread::hardware_concurrency(), 2);
+  }
+  for (size_t i = 0; i < num_threads; i++) {
+    threads_.emplace_back([this]() { WorkerThread(); });
+  }
+}
+
+Scheduler::~Scheduler() {
+  {
+    std::unique_lock lck(mu_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  for (auto& thread : threads_) {
+    thread.join();
+  }
+}
+
+void Scheduler::Schedule(std::function<void()> job, JobPriority priority) {
+  {
+    std::unique_lock lck(mu_);
+    queue_.push(Job{priority, next_id_++, std::move(job)});
+  }
+  cv_.notify_one();
+}
+
+void Scheduler::WorkerThread() {
+  while (true) {
+    std::function<void()> func;
+    {
+      std::unique_lock lck(mu_);
+      cv_.wait(lck, [&]() { return stop_ || !queue_.empty(); });
+      if (stop_) {
+        return;
+      }
+      func = std::move(const_cast<Job&>(queue_.top()).func_);
+      queue_.pop();
+    }
+    func();
+  }
+}
+
+}  // namespace lsm
+
+}  // namespace wing
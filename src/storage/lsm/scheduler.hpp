@@ -0,0 +1,71 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace wing {
+
+namespace lsm {
+
+/* The priority of a background job. */
+enum class JobPriority {
+  /* Flushes, which unblock the writers waiting for MemTables. */
+  kHigh,
+  /* Compactions. */
+  kLow,
+};
+
+/**
+ * A pool of background threads shared by databases. Jobs with high priority
+ * run before jobs with low priority, and jobs with the same priority run in
+ * the order they are scheduled. A job must not wait for another job,
+ * because all the threads may be busy.
+ */
+class Scheduler {
+ public:
+  /* If num_threads is 0, it is the number of cores. */
+  explicit Scheduler(size_t num_threads = 0);
+
+  /* Wait for the running jobs. The jobs in the queue are dropped. */
+  ~Scheduler();
+
+  Scheduler(const Scheduler&) = delete;
+  Scheduler& operator=(const Scheduler&) = delete;
+
+  void Schedule(std::function<void()> job, JobPriority priority);
+
+  size_t GetThreadCount() const { return threads_.size(); }
+
+ private:
+  struct Job {
+    JobPriority priority_;
+    /* The order it is scheduled. */
+    uint64_t id_;
+    std::function<void()> func_;
+
+    /* std::priority_queue pops the largest one. */
+    bool operator<(const Job& rhs) const {
+      if (priority_ != rhs.priority_) {
+        return priority_ > rhs.priority_;
+      }
+      return id_ > rhs.id_;
+    }
+  };
+
+  void WorkerThread();
+
+  std::mutex mu_;
+  std::condition_variable cv_;
+  std::priority_queue<Job> queue_;
+  uint64_t next_id_{0};
+  bool stop_{false};
+  std::vector<std::thread> threads_;
+};
+
+}  // namespace lsm
+
+}  // namespace wing
@@ -0,0 +1,210 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <random>
+
+#include "common/allocator.hpp"
+#include "storage/lsm/format.hpp"
+
+namespace wing {
+
+namespace lsm {
+
+/**
+ * A skiplist ordered by ParsedKey, which supports concurrent inserts and
+ * reads. Reads take no lock, and inserts take only a short one around the
+ * arena allocation. Nodes are linked with compare-and-swap, level by level
+ * from the bottom, so a reader never sees a partially linked node at level
+ * 0. Nodes are never removed. They are freed together with the arena.
+ *
+ * Each node is allocated in the arena as:
+ * [Node header][next pointers of the upper levels][internal key][value]
+ */
+class SkipList {
+ public:
+  static constexpr int kMaxHeight = 12;
+  /* A node has height h + 1 with probability 1 / kBranching of height h. */
+  static constexpr uint32_t kBranching = 4;
+
+  struct Node {
+    uint32_t key_size_;
+    uint32_t value_size_;
+    uint32_t height_;
+    /* The next pointers. next_[0] is the lowest level. */
+    std::atomic<Node*> next_[1];
+
+    Node* Next(int level) {
+      return next_[level].load(std::memory_order_acquire);
+    }
+
+    void SetNext(int level, Node* x) {
+      next_[level].store(x, std::memory_order_release);
+    }
+
+    bool CASNext(int level, Node* expected, Node* x) {
+      return next_[level].compare_exchange_strong(expected, x);
+    }
+
+    char* Data() { return reinterpret_cast<char*>(&next_[height_]); }
+
+    /* The internal key: [user key][seq][type] */
+    Slice Key() { return Slice(Data(), key_size_); }
+
+    Slice Value() { return Slice(Data() + key_size_, value_size_); }
+  };
+
+  class Iterator {
+   public:
+    Iterator() = default;
+
+    Iterator(SkipList* list) : list_(list) {}
+
+    bool Valid() const { return node_ != nullptr; }
+
+    Slice key() const { return node_->Key(); }
+
+    Slice value() const { return node_->Value(); }
+
+    void Next() { node_ = node_->Next(0); }
+
+    void SeekToFirst() { node_ = list_->head_->Next(0); }
+
+    /* Find the first node >= key */
+    void Seek(const ParsedKey& key) { node_ = list_->FindGreaterOrEqual(key); }
+
+   private:
+    SkipList* list_{nullptr};
+    Node* node_{nullptr};
+  };
+
+  SkipList(ArenaAllocator* arena) : arena_(arena) { Clear(); }
+
+  /**
+   * Allocate a node with space for an internal key of key_size bytes and a
+   * value of value_size bytes. The caller fills Node::Data() and then calls
+   * Insert().
+   */
+  Node* AllocateNode(uint32_t key_size, uint32_t value_size) {
+    return NewNode(RandomHeight(), key_size, value_size);
+  }
+
+  /* Link x into the list. It is safe to call it concurrently. */
+  void Insert(Node* x) {
+    ParsedKey key(x->Key());
+    int height = x->height_;
+    int max_height = max_height_.load(std::memory_order_relaxed);
+    while (height > max_height) {
+      if (max_height_.compare_exchange_weak(max_height, height)) {
+        max_height = height;
+        break;
+      }
+    }
+    Node* prev[kMaxHeight];
+    Node* next[kMaxHeight];
+    Node* before = head_;
+    Node* bound = nullptr;
+    for (int level = max_height - 1; level >= 0; level--) {
+      FindSplice(key, before, level, bound, &prev[level], &next[level]);
+      before = prev[level];
+      bound = next[level];
+    }
+    for (int level = 0; level < height; level++) {
+      while (true) {
+        x->next_[level].store(next[level], std::memory_order_relaxed);
+        if (prev[level]->CASNext(level, next[level], x)) {
+          break;
+        }
+        /* Another node was inserted after prev[level]. Search again. */
+        FindSplice(key, prev[level], level, &prev[level], &next[level]);
+      }
+    }
+  }
+
+  /* Remove all the nodes. It is not thread-safe. The arena is cleared too. */
+  void Clear() {
+    arena_->Clear();
+    head_ = NewNode(kMaxHeight, 0, 0);
+    for (int i = 0; i < kMaxHeight; i++) {
+      head_->SetNext(i, nullptr);
+    }
+    max_height_.store(1, std::memory_order_relaxed);
+  }
+
+  Iterator Begin() {
+    Iterator it(this);
+    it.SeekToFirst();
+    return it;
+  }
+
+ private:
+  static int Compare(Node* x, const ParsedKey& key) {
+    auto res = ParsedKey(x->Key()) <=> key;
+    return res < 0 ? -1 : (res > 0 ? 1 : 0);
+  }
+
+  /* Find prev and next at level such that prev < key <= next */
+  static void FindSplice(const ParsedKey& key, Node* before, int level,
+      Node** prev, Node** next) {
+    FindSplice(key, before, level, nullptr, prev, next);
+  }
+
+  /* The same, but bound is known to be >= key, so it is not compared. */
+  static void FindSplice(const ParsedKey& key, Node* before, int level,
+      Node* bound, Node** prev, Node** next) {
+    while (true) {
+      Node* x = before->Next(level);
+      if (x == nullptr || x == bound || Compare(x, key) >= 0) {
+        *prev = before;
+        *next = x;
+        return;
+      }
+      before = x;
+    }
+  }
+
+  Node* FindGreaterOrEqual(const ParsedKey& key) const {
+    Node* x = head_;
+    Node* next = nullptr;
+    for (int level = max_height_.load(std::memory_order_relaxed) - 1;
+         level >= 0; level--) {
+      FindSplice(key, x, level, next, &x, &next);
+    }
+    return next;
+  }
+
+  Node* NewNode(int height, uint32_t key_size, uint32_t value_size) {
+    size_t size = sizeof(Node) + sizeof(std::atomic<Node*>) * (height - 1) +
+                  key_size + value_size;
+    /* Keep every node aligned. */
+    size = (size + alignof(Node) - 1) / alignof(Node) * alignof(Node);
+    uint8_t* ptr;
+    {
+      std::unique_lock lck(arena_mu_);
+      ptr = arena_->Allocate(size);
+    }
+    auto x = reinterpret_cast<Node*>(ptr);
+    x->key_size_ = key_size;
+    x->value_size_ = value_size;
+    x->height_ = height;
+    return x;
+  }
+
+  static int RandomHeight() {
+    static thread_local std::minstd_rand gen(std::random_device{}());
+    int height = 1;
+    while (height < kMaxHeight && gen() % kBranching == 0) {
+      height++;
+    }
+    return height;
+  }
+
+  ArenaAllocator* arena_;
+  std::mutex arena_mu_;
+  Node* head_;
+  std::atomic<int> max_height_;
+};
+
+}  // namespace lsm
+
+}  // namespace wing
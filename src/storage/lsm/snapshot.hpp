@@ -0,0 +1,72 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+#include "storage/lsm/format.hpp"
+
+namespace wing {
+
+namespace lsm {
+
+/**
+ * A consistent view of a database. The reads with it see the records whose
+ * sequence numbers <= seq(), and the compactions keep those records until
+ * it is released.
+ */
+class Snapshot {
+ public:
+  seq_t seq() const { return seq_; }
+
+ private:
+  Snapshot(seq_t seq, uint64_t db_id) : seq_(seq), db_id_(db_id) {}
+
+  seq_t seq_;
+  /* The ID of the database that takes it */
+  uint64_t db_id_;
+
+  friend class DBImpl;
+};
+
+/**
+ * The sequence numbers of the live snapshots in ascending order. They split
+ * the sequence numbers into stripes, and a compaction keeps the newest
+ * record of a user key in each stripe, so that every snapshot sees the same
+ * record as before.
+ */
+class SnapshotList {
+ public:
+  SnapshotList() = default;
+
+  explicit SnapshotList(std::vector<seq_t> seqs) : seqs_(std::move(seqs)) {}
+
+  /* The stripe of seq, i.e. the index of the first snapshot >= seq. */
+  size_t Stripe(seq_t seq) const {
+    return std::lower_bound(seqs_.begin(), seqs_.end(), seq) - seqs_.begin();
+  }
+
+  /**
+   * The sequence number that the records in the stripe are read at, i.e.
+   * the snapshot, or the latest one for the last stripe.
+   */
+  seq_t StripeSeq(size_t stripe) const {
+    return stripe < seqs_.size() ? seqs_[stripe] : UINT64_MAX;
+  }
+
+  /* Return true if a snapshot is in [begin, end). */
+  bool AnyInRange(seq_t begin, seq_t end) const {
+    auto it = std::lower_bound(seqs_.begin(), seqs_.end(), begin);
+    return it != seqs_.end() && *it < end;
+  }
+
+  bool empty() const { return seqs_.empty(); }
+
+  size_t size() const { return seqs_.size(); }
+
+ private:
+  std::vector<seq_t> seqs_;
+};
+
+}  // namespace lsm
+
+}  // namespace wing
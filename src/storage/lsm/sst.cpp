@@ -6,21 +6,77 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <cstring>
 #include <fstream>
 
 #include "common/bloomfilter.hpp"
+#include "common/logging.hpp"
+#include "storage/lsm/stats.hpp"
 
 namespace wing {
 
 namespace lsm {
 
-SSTable::SSTable(SSTInfo sst_info, size_t block_size, bool use_direct_io)
-  : sst_info_(std::move(sst_info)), block_size_(block_size) {
-  file_ = std::make_unique<ReadFile>(sst_info_.filename_, use_direct_io);
+SSTable::SSTable(SSTInfo sst_info, size_t block_size, bool use_direct_io,
+    Cache* cache, TableCache* table_cache, ValueLog* value_log,
+    ReadaheadOptions readahead, bool use_mmap)
+  : sst_info_(std::move(sst_info)),
+    block_size_(block_size),
+    use_direct_io_(use_direct_io),
+    cache_(cache),
+    table_cache_(table_cache),
+    value_log_(value_log),
+    readahead_(readahead),
+    use_mmap_(use_mmap),
+    id_(Cache::NewId()) {
+  if (value_log_ != nullptr) {
+    for (auto id : sst_info_.blob_files_) {
+      blob_files_.push_back(value_log_->GetFile(id));
+    }
+  }
+  if (sst_info_.smallest_key_.empty()) {
+    /* The key range is in the file. */
+    auto table = Open();
+    smallest_key_ = table->smallest_key_;
+    largest_key_ = table->largest_key_;
+    if (table_cache_ == nullptr) {
+      table_ = std::move(table);
+    }
+    return;
+  }
+  smallest_key_ = Slice(sst_info_.smallest_key_);
+  largest_key_ = Slice(sst_info_.largest_key_);
+}
 
-  FileReader reader_(file_.get(), 1 << 30, 0);
+SSTable::~SSTable() {
+  table_.reset();
+  if (table_cache_ != nullptr) {
+    table_cache_->Erase(id_);
+  }
+  if (remove_tag_) {
+    std::filesystem::remove(sst_info_.filename_);
+  }
+}
+
+std::shared_ptr<TableHandle> SSTable::Open() const {
+  auto table = std::make_shared<TableHandle>();
+  table->file_ = std::make_unique<ReadFile>(sst_info_.filename_, use_direct_io_);
+  if (use_mmap_) {
+    table->mmap_ = std::make_unique<MmapFile>(sst_info_.filename_);
+  }
+
+  FileReader reader_(table->file_.get(), 1 << 30, 0);
   reader_.Seek(sst_info_.index_offset_);
   size_t index_count = reader_.ReadValue<size_t>();
+  if ((index_count & kSSTFormatMagicMask) == kSSTFormatMagic) {
+    table->partitioned_ = index_count & kSSTPartitionedFlag;
+    table->blocked_bloom_ = index_count & kSSTBlockedBloomFlag;
+    table->prefix_filter_ = index_count & kSSTPrefixFilterFlag;
+    table->format_ = static_cast<SSTFormat>(
+        index_count & ~(kSSTFormatMagicMask | kSSTPartitionedFlag |
+                           kSSTBlockedBloomFlag | kSSTPrefixFilterFlag));
+    index_count = reader_.ReadValue<size_t>();
+  }
   for (size_t i = 0; i < index_count; ++i) {
     size_t key_length = reader_.ReadValue<size_t>();
     IndexValue index_value;
@@ -28,35 +84,64 @@ SSTable::SSTable(SSTInfo sst_info, size_t block_size, bool use_direct_io)
     index_value.block_.offset_ = reader_.ReadValue<offset_t>();
     index_value.block_.size_ = reader_.ReadValue<offset_t>();
     index_value.block_.count_ = reader_.ReadValue<offset_t>();
-    index_.push_back(index_value);
+    table->index_.push_back(index_value);
+    if (table->partitioned_) {
+      BlockHandle filter;
+      filter.offset_ = reader_.ReadValue<offset_t>();
+      filter.size_ = reader_.ReadValue<offset_t>();
+      filter.count_ = reader_.ReadValue<offset_t>();
+      table->filters_.push_back(filter);
+    }
   }
 
   size_t bloom_filter_length = reader_.ReadValue<size_t>();
-  bloom_filter_ = reader_.ReadString(bloom_filter_length);
+  table->bloom_filter_ = reader_.ReadString(bloom_filter_length);
 
   size_t smallest_key_length = reader_.ReadValue<size_t>();
-  smallest_key_ = reader_.ReadString(smallest_key_length);
+  table->smallest_key_ = reader_.ReadString(smallest_key_length);
   size_t largest_key_length = reader_.ReadValue<size_t>();
-  largest_key_ = reader_.ReadString(largest_key_length);
+  table->largest_key_ = reader_.ReadString(largest_key_length);
+  return table;
 }
 
-SSTable::~SSTable() {
-  if (remove_tag_) {
-    file_.reset();
-    std::filesystem::remove(sst_info_.filename_);
+std::shared_ptr<TableHandle> SSTable::GetTable() {
+  if (table_cache_ != nullptr) {
+    return table_cache_->Get(id_, [this]() { return Open(); });
   }
+  std::unique_lock lck(table_mu_);
+  if (!table_) {
+    table_ = Open();
+  }
+  return table_;
 }
 
 // find key0 == key && seq0 <= seq
-GetResult SSTable::Get(Slice key, uint64_t seq, std::string* value) {
-  if (!utils::BloomFilter::Find(key, bloom_filter_)) {
+GetResult SSTable::Get(
+    Slice key, uint64_t seq, std::string* value, seq_t* record_seq) {
+  /* The key range is known without opening the file. */
+  if (key < smallest_key_.user_key() || key > largest_key_.user_key()) {
+    return GetResult::kNotFound;
+  }
+  auto table = GetTable();
+  if (table->partitioned_) {
+    size_t partition = table->Seek(key, seq);
+    if (partition == table->index_.size() ||
+        !PartitionMayMatch(*table, partition, key)) {
+      return GetResult::kNotFound;
+    }
+  } else if (!table->MayMatch(key, table->bloom_filter_)) {
     return GetResult::kNotFound;
   }
 
-  SSTableIterator it = Seek(key, seq);
+  /* Point lookups read blocks with high priority in the cache. */
+  SSTableIterator it(this, std::move(table), CachePriority::kHigh);
+  it.Seek(key, seq);
   if (it.Valid() && ParsedKey(it.key()).user_key_ == key) {
-    if (ParsedKey(it.key()).type_ == RecordType::Value) {
-      *value = std::string(it.value());
+    if (record_seq != nullptr) {
+      *record_seq = ParsedKey(it.key()).seq_;
+    }
+    if (ParsedKey(it.key()).type_ != RecordType::Deletion) {
+      *value = ReadValue(ParsedKey(it.key()), it.value());
       return GetResult::kFound;
     } else {
       return GetResult::kDelete;
@@ -87,8 +172,140 @@ GetResult SSTable::Get(Slice key, uint64_t seq, std::string* value) {
   */
 }
 
+void SSTable::MultiGet(std::span<LookupKey* const> keys, uint64_t seq) {
+  auto table = GetTable();
+  /* The keys that may be in the SSTable, and their data blocks. */
+  std::vector<std::pair<LookupKey*, BlockHandle>> candidates;
+  size_t partition = SIZE_MAX;
+  AlignedBuffer filter_buf, index_buf;
+  std::optional<Cache::Handle> filter_handle, index_handle;
+  std::string_view filter;
+  BlockIterator index_it;
+  for (auto key : keys) {
+    auto user_key = key->user_key_;
+    if (user_key < smallest_key_.user_key()) {
+      continue;
+    }
+    if (user_key > largest_key_.user_key()) {
+      break;
+    }
+    size_t id = table->Seek(user_key, seq);
+    if (id == table->index_.size()) {
+      break;
+    }
+    if (!table->partitioned_) {
+      if (table->MayMatch(user_key, table->bloom_filter_)) {
+        candidates.emplace_back(key, table->index_[id].block_);
+      }
+      continue;
+    }
+    /* The keys are sorted, so each partition is loaded once. */
+    if (id != partition) {
+      partition = id;
+      auto& filter_block = table->filters_[id];
+      filter = std::string_view(ReadBlock(*table, filter_block,
+          CachePriority::kHigh, &filter_buf, &filter_handle),
+          filter_block.size_);
+      auto& index_block = table->index_[id].block_;
+      index_it = BlockIterator(ReadBlock(*table, index_block,
+          CachePriority::kHigh, &index_buf, &index_handle),
+          index_block, table->format_);
+    }
+    if (!table->MayMatch(user_key, filter)) {
+      continue;
+    }
+    index_it.Seek(user_key, seq);
+    BlockHandle block;
+    std::memcpy(&block, index_it.value().data(), sizeof(BlockHandle));
+    candidates.emplace_back(key, block);
+  }
+
+  /* The keys in the same data block are adjacent. */
+  AlignedBuffer buf;
+  std::optional<Cache::Handle> cache_handle;
+  std::optional<BlockHandle> loaded;
+  BlockIterator it;
+  for (auto& [key, block] : candidates) {
+    if (!loaded || loaded->offset_ != block.offset_) {
+      loaded = block;
+      it = BlockIterator(ReadBlock(*table, block, CachePriority::kHigh, &buf,
+          &cache_handle), block, table->format_);
+    }
+    it.Seek(key->user_key_, seq);
+    if (it.Valid() && ParsedKey(it.key()).user_key_ == key->user_key_) {
+      key->seq_ = ParsedKey(it.key()).seq_;
+      if (ParsedKey(it.key()).type_ != RecordType::Deletion) {
+        key->value_ = ReadValue(ParsedKey(it.key()), it.value());
+        key->result_ = GetResult::kFound;
+      } else {
+        key->result_ = GetResult::kDelete;
+      }
+    }
+  }
+}
+
+std::string SSTable::ReadValue(ParsedKey key, Slice value) const {
+  if (key.type_ != RecordType::BlobIndex) {
+    return std::string(value);
+  }
+  if (value_log_ == nullptr) {
+    DB_ERR("The SSTable {} has no value log!", sst_info_.filename_);
+  }
+  return value_log_->Read(BlobIndex::Decode(value));
+}
+
+const char* SSTable::ReadBlock(const TableHandle& table, BlockHandle block,
+    CachePriority priority, AlignedBuffer* buf,
+    std::optional<Cache::Handle>* cache_handle) {
+  /* Unpin the previous block. */
+  cache_handle->reset();
+  if (table.mmap_ != nullptr) {
+    return table.mmap_->data() + block.offset_;
+  }
+  if (cache_ != nullptr) {
+    *cache_handle = cache_->get(id_, block, priority);
+    if (cache_handle->has_value()) {
+      return (*cache_handle)->block().data();
+    }
+  }
+  if (buf->size() < block.size_) {
+    *buf = AlignedBuffer(std::max<size_t>(block.size_, 4096), 4096);
+  }
+  table.file_->Read(buf->data(), block.size_, block.offset_);
+  if (cache_ != nullptr) {
+    *cache_handle = cache_->insert(
+        id_, block, std::string(buf->data(), block.size_), priority);
+    return (*cache_handle)->block().data();
+  }
+  return buf->data();
+}
+
+bool SSTable::PartitionMayMatch(
+    const TableHandle& table, size_t partition, Slice key) {
+  AlignedBuffer buf;
+  std::optional<Cache::Handle> cache_handle;
+  auto& filter = table.filters_[partition];
+  /* Filters are as hot as the index, so they are cached with high priority. */
+  auto data = ReadBlock(table, filter, CachePriority::kHigh, &buf,
+      &cache_handle);
+  return table.MayMatch(key, std::string_view(data, filter.size_));
+}
+
+bool SSTable::PrefixMayMatch(Slice key, uint64_t seq, Slice prefix) {
+  auto table = GetTable();
+  if (!table->prefix_filter_) {
+    return true;
+  }
+  if (!table->partitioned_) {
+    return table->MayMatch(prefix, table->bloom_filter_);
+  }
+  size_t partition = table->Seek(key, seq);
+  return partition < table->index_.size() &&
+         PartitionMayMatch(*table, partition, prefix);
+}
+
 SSTableIterator SSTable::Seek(Slice key, uint64_t seq) {
-  SSTableIterator it = Begin();
+  SSTableIterator it(this);
   it.Seek(key, seq);
   return it;
 }
@@ -100,62 +317,133 @@ SSTableIterator SSTable::Begin() {
 }
 
 void SSTableIterator::Seek(Slice key, uint64_t seq) {
-  /*
-  for (block_id_ = 0; block_id_ < sst_->index_.size(); ++block_id_) {
-    IndexValue block_index = sst_->index_[block_id_];
-    InternalKey block_key = block_index.key_;
-    if (
-      block_key.user_key() < key ||
-      (block_key.user_key() == key && block_key.seq() > seq)
-    ) {
-      continue;
-    }
-    const auto& block_handle = sst_->index_[block_id_].block_;
-    // AlignedBuffer buffer(block_handle.size_, 4096);
-    buf_ = AlignedBuffer(block_handle.size_, 4096);
-    sst_->file_->Read(buf_.data(), block_handle.size_, block_handle.offset_);
-    block_it_ = BlockIterator(buf_.data(), block_handle);
-    block_it_.Seek(key, seq);
-    return;
+  if (!table_) {
+    table_ = sst_->GetTable();
   }
-  */
-
-  ParsedKey target_key(key, seq, RecordType::Value);
-  size_t left = 0;
-  size_t right = sst_->index_.size();
-  while (left < right) {
-    size_t mid = (left + right) / 2;
-    ParsedKey mid_parsed_key = sst_->index_[mid].key_;
-    if (mid_parsed_key < target_key) left = mid + 1;
-    else right = mid;
+  prefetched_.clear();
+  readahead_ = 0;
+  block_id_ = table_->Seek(key, seq);
+  if (block_id_ >= table_->index_.size()) {
+    block_it_ = BlockIterator();
+    return;
   }
-
-  block_id_ = left;
-  if (block_id_ < sst_->index_.size()) {
-    const auto& block_handle = sst_->index_[block_id_].block_;
-    // AlignedBuffer buffer(block_handle.size_, 4096);
-    buf_ = AlignedBuffer(block_handle.size_, 4096);
-    sst_->file_->Read(buf_.data(), block_handle.size_, block_handle.offset_);
-    block_it_ = BlockIterator(buf_.data(), block_handle);
-    block_it_.Seek(key, seq);
+  if (table_->partitioned_) {
+    LoadIndexPartition();
+    index_it_.Seek(key, seq);
   }
-  return;
+  LoadBlock();
+  block_it_.Seek(key, seq);
 }
 
 void SSTableIterator::SeekToFirst() {
+  if (!table_) {
+    table_ = sst_->GetTable();
+  }
+  prefetched_.clear();
+  readahead_ = 0;
   block_id_ = 0;
-  if (sst_->index_.size() == 0) {
+  if (table_->index_.size() == 0) {
     block_it_ = BlockIterator();
-    buf_ = AlignedBuffer();
     return;
   }
-  const auto& block_handle = sst_->index_[block_id_].block_;
-  buf_ = AlignedBuffer(block_handle.size_, 4096);
-  sst_->file_->Read(buf_.data(), block_handle.size_, block_handle.offset_);
-  block_it_ = BlockIterator(buf_.data(), block_handle);
+  if (table_->partitioned_) {
+    LoadIndexPartition();
+    index_it_.SeekToFirst();
+  }
+  LoadBlock();
   block_it_.SeekToFirst();
 }
 
+void SSTableIterator::LoadIndexPartition() {
+  const auto& block_handle = table_->index_[block_id_].block_;
+  /* Index partitions are cached with high priority like the filters. */
+  auto data = sst_->ReadBlock(*table_, block_handle, CachePriority::kHigh,
+      &index_buf_, &index_handle_);
+  index_it_ = BlockIterator(data, block_handle, table_->format_);
+}
+
+void SSTableIterator::LoadBlock() {
+  BlockHandle block_handle;
+  if (table_->partitioned_) {
+    auto value = index_it_.value();
+    std::memcpy(&block_handle, value.data(), sizeof(BlockHandle));
+  } else {
+    block_handle = table_->index_[block_id_].block_;
+  }
+  const char* data;
+  if (!prefetched_.empty() &&
+      prefetched_.front().block_.offset_ == block_handle.offset_) {
+    auto block = std::move(prefetched_.front());
+    prefetched_.pop_front();
+    cache_handle_ = std::move(block.cache_handle_);
+    if (cache_handle_) {
+      data = cache_handle_->block().data();
+    } else {
+      block.done_.get();
+      buf_ = std::move(*block.buf_);
+      data = buf_.data();
+      if (sst_->cache_ != nullptr) {
+        cache_handle_ = sst_->cache_->insert(sst_->id_, block_handle,
+            std::string(data, block_handle.size_), priority_);
+        data = cache_handle_->block().data();
+      }
+    }
+  } else {
+    prefetched_.clear();
+    data = sst_->ReadBlock(
+        *table_, block_handle, priority_, &buf_, &cache_handle_);
+  }
+  block_it_ = BlockIterator(data, block_handle, table_->format_);
+  Readahead();
+}
+
+void SSTableIterator::Readahead() {
+  /* The kernel reads the pages of the mapping. */
+  if (table_->mmap_ != nullptr) {
+    return;
+  }
+  /* The blocks after the ones in flight. */
+  std::vector<BlockHandle> blocks;
+  if (table_->partitioned_) {
+    BlockIterator it = index_it_;
+    for (it.Next(); it.Valid() && blocks.size() < readahead_; it.Next()) {
+      BlockHandle block;
+      std::memcpy(&block, it.value().data(), sizeof(BlockHandle));
+      blocks.push_back(block);
+    }
+  } else {
+    for (size_t i = block_id_ + 1;
+         i < table_->index_.size() && blocks.size() < readahead_; i++) {
+      blocks.push_back(table_->index_[i].block_);
+    }
+  }
+  for (size_t i = prefetched_.size(); i < blocks.size(); i++) {
+    auto& block = prefetched_.emplace_back();
+    block.block_ = blocks[i];
+    if (sst_->cache_ != nullptr) {
+      block.cache_handle_ = sst_->cache_->get(sst_->id_, blocks[i], priority_);
+      if (block.cache_handle_) {
+        continue;
+      }
+    }
+    block.buf_ = std::make_shared<AlignedBuffer>(
+        std::max<size_t>(blocks[i].size_, 4096), 4096);
+    GetStatsContext()->total_readahead_blocks.fetch_add(1);
+    auto promise = std::make_shared<std::promise<void>>();
+    block.done_ = promise->get_future();
+    sst_->readahead_.scheduler_->Schedule(
+        [table = table_, buf = block.buf_, handle = blocks[i], promise]() {
+          try {
+            table->file_->Read(buf->data(), handle.size_, handle.offset_);
+            promise->set_value();
+          } catch (...) {
+            promise->set_exception(std::current_exception());
+          }
+        },
+        JobPriority::kHigh);
+  }
+}
+
 bool SSTableIterator::Valid() { // TODO
   return block_it_.Valid();
 }
@@ -170,66 +458,168 @@ Slice SSTableIterator::value() const {
 
 void SSTableIterator::Next() {
   block_it_.Next();
-  if (!block_it_.Valid() && block_id_ < sst_->index_.size() - 1) {
+  if (block_it_.Valid()) {
+    return;
+  }
+  if (table_->partitioned_) {
+    index_it_.Next();
+    if (!index_it_.Valid()) {
+      if (block_id_ + 1 >= table_->index_.size()) {
+        return;
+      }
+      // move to next index partition
+      ++block_id_;
+      LoadIndexPartition();
+      index_it_.SeekToFirst();
+    }
+  } else if (block_id_ + 1 < table_->index_.size()) {
     // move to next block
     ++block_id_;
-    const auto& block_handle = sst_->index_[block_id_].block_;
-    buf_ = AlignedBuffer(block_handle.size_, 4096);
-    sst_->file_->Read(buf_.data(), block_handle.size_, block_handle.offset_);
-    block_it_ = BlockIterator(buf_.data(), block_handle);
-    block_it_.SeekToFirst();
+  } else {
+    return;
+  }
+  /* It is a sequential scan, so read more blocks ahead. */
+  readahead_ = std::min(sst_->readahead_.max_blocks_,
+      std::max<size_t>(readahead_ * 2, 1));
+  LoadBlock();
+  block_it_.SeekToFirst();
+}
+
+void SSTableBuilder::FinishDataBlock() {
+  block_builder_.Finish();
+  IndexValue index_value;
+  index_value.key_ = block_builder_.GetLastKey();
+  index_value.block_ = { (offset_t)current_block_offset_, (offset_t)block_builder_.size(), (offset_t)block_builder_.count() };
+  index_data_.push_back(index_value);
+  current_block_offset_ += block_builder_.size();
+  block_builder_.Clear();
+  if (partitioned_) {
+    partition_size_ += index_value.key_.size() + sizeof(BlockHandle);
+    if (partition_size_ >= block_size_) {
+      FinishPartition();
+    }
+  }
+}
+
+void SSTableBuilder::FinishPartition() {
+  if (partition_begin_ == index_data_.size()) {
+    return;
+  }
+  /* The filter of the keys in the data blocks of the partition. */
+  auto bloom_bits = CreateFilter(partition_hash_begin_, key_hashes_.size());
+  filters_.push_back(
+      {(offset_t)current_block_offset_, (offset_t)bloom_bits.size(), 0});
+  writer_->AppendString(bloom_bits);
+  current_block_offset_ += bloom_bits.size();
+
+  /* The index partition is a block that never becomes full. */
+  BlockBuilder partition(
+      SIZE_MAX, writer_.get(), format_, restart_interval_);
+  for (size_t i = partition_begin_; i < index_data_.size(); i++) {
+    auto& block = index_data_[i].block_;
+    partition.Append(ParsedKey(index_data_[i].key_),
+        Slice(reinterpret_cast<const char*>(&block), sizeof(BlockHandle)));
+  }
+  partition.Finish();
+  IndexValue index_value;
+  index_value.key_ = index_data_.back().key_;
+  index_value.block_ = {(offset_t)current_block_offset_,
+      (offset_t)partition.size(), (offset_t)partition.count()};
+  top_index_.push_back(index_value);
+  current_block_offset_ += partition.size();
+
+  partition_begin_ = index_data_.size();
+  partition_hash_begin_ = key_hashes_.size();
+  partition_size_ = 0;
+  /* Each partition has the prefixes of its own keys. */
+  last_prefix_.reset();
+}
+
+std::string SSTableBuilder::CreateFilter(size_t begin, size_t end) const {
+  std::string bloom_bits;
+  if (blocked_bloom_) {
+    utils::BlockedBloomFilter::Create(
+        end - begin, bloom_bits_per_key_, bloom_bits);
+    for (size_t i = begin; i < end; i++) {
+      utils::BlockedBloomFilter::Add(key_hashes_[i], bloom_bits);
+    }
+  } else {
+    utils::BloomFilter::Create(end - begin, bloom_bits_per_key_, bloom_bits);
+    for (size_t i = begin; i < end; i++) {
+      utils::BloomFilter::Add(key_hashes_[i], bloom_bits);
+    }
   }
+  return bloom_bits;
 }
 
 void SSTableBuilder::Append(ParsedKey key, Slice value) {
   if (!block_builder_.Append(key, value)) {
-    block_builder_.Finish();
-    IndexValue index_value;
-    index_value.key_ = block_builder_.GetLastKey();
-    index_value.block_ = { (offset_t)current_block_offset_, (offset_t)block_builder_.size(), (offset_t)block_builder_.count() };
-    index_data_.push_back(index_value);
-    current_block_offset_ += block_builder_.size();
-    block_builder_.Clear();
+    FinishDataBlock();
     block_builder_.Append(key, value);
   }
 
   size_t key_hash = utils::BloomFilter::BloomHash(key.user_key_);
   key_hashes_.push_back(key_hash);
+  if (prefix_extractor_ != nullptr &&
+      prefix_extractor_->InDomain(key.user_key_)) {
+    /* The keys are sorted, so each prefix is added once. */
+    auto prefix = prefix_extractor_->Transform(key.user_key_);
+    if (last_prefix_ != prefix) {
+      key_hashes_.push_back(utils::BloomFilter::BloomHash(prefix));
+      last_prefix_ = prefix;
+    }
+  }
   if (smallest_key_.user_key().size() == 0 || key < smallest_key_) {
     smallest_key_ = key;
   }
   if (largest_key_.user_key().size() == 0 || key > largest_key_) {
     largest_key_ = key;
   }
+  smallest_seq_ = std::min(smallest_seq_, key.seq_);
+  largest_seq_ = std::max(largest_seq_, key.seq_);
   ++count_;
 }
 
 void SSTableBuilder::Finish() { 
-  block_builder_.Finish();
-  IndexValue index_value;
-  index_value.key_ = block_builder_.GetLastKey();
-  index_value.block_ = { (offset_t)current_block_offset_, (offset_t)block_builder_.size(), (offset_t)block_builder_.count() };
-  index_data_.push_back(index_value);
-  current_block_offset_ += block_builder_.size();
-  block_builder_.Clear();
+  FinishDataBlock();
+  if (partitioned_) {
+    FinishPartition();
+  }
 
   index_offset_ = current_block_offset_;
-  writer_->AppendValue<size_t>(index_data_.size());
+  if (format_ != SSTFormat::kPlain || partitioned_ || blocked_bloom_ ||
+      prefix_extractor_ != nullptr) {
+    writer_->AppendValue<size_t>(kSSTFormatMagic |
+        static_cast<size_t>(format_) |
+        (partitioned_ ? kSSTPartitionedFlag : 0) |
+        (blocked_bloom_ ? kSSTBlockedBloomFlag : 0) |
+        (prefix_extractor_ != nullptr ? kSSTPrefixFilterFlag : 0));
+    current_block_offset_ += sizeof(size_t);
+  }
+  auto& index = partitioned_ ? top_index_ : index_data_;
+  writer_->AppendValue<size_t>(index.size());
   current_block_offset_ += sizeof(size_t);
-  for (const auto& index_value : index_data_) {
+  for (size_t i = 0; i < index.size(); i++) {
+    auto& index_value = index[i];
     writer_->AppendValue<size_t>(index_value.key_.size());
     writer_->AppendString(index_value.key_.GetSlice());
     writer_->AppendValue<offset_t>(index_value.block_.offset_);
     writer_->AppendValue<offset_t>(index_value.block_.size_);
     writer_->AppendValue<offset_t>(index_value.block_.count_);
     current_block_offset_ += sizeof(size_t) + index_value.key_.size() + sizeof(offset_t) * 3;
+    if (partitioned_) {
+      writer_->AppendValue<offset_t>(filters_[i].offset_);
+      writer_->AppendValue<offset_t>(filters_[i].size_);
+      writer_->AppendValue<offset_t>(filters_[i].count_);
+      current_block_offset_ += sizeof(offset_t) * 3;
+    }
   }
 
   bloom_filter_offset_ = current_block_offset_;
   std::string bloom_bits;
-  utils::BloomFilter::Create(key_hashes_.size(), bloom_bits_per_key_, bloom_bits);
-  for (const auto& hash : key_hashes_) {
-    utils::BloomFilter::Add(hash, bloom_bits);
+  /* The filter is in the partitions if the index is partitioned. */
+  if (!partitioned_) {
+    bloom_bits = CreateFilter(0, key_hashes_.size());
   }
   writer_->AppendValue<size_t>(bloom_bits.size());
   writer_->AppendString(bloom_bits);
@@ -1,5 +1,9 @@
 #pragma once
 
+#include <deque>
+#include <future>
+#include <optional>
+#include <span>
 #include <string>
 #include <vector>
 
@@ -10,6 +14,8 @@
 #include "storage/lsm/format.hpp"
 #include "storage/lsm/iterator.hpp"
 #include "storage/lsm/options.hpp"
+#include "storage/lsm/table_cache.hpp"
+#include "storage/lsm/value_log.hpp"
 
 namespace wing {
 
@@ -17,6 +23,14 @@ namespace lsm {
 
 class SSTableIterator;
 
+/* How the iterators of an SSTable read the data blocks ahead. */
+struct ReadaheadOptions {
+  /* The maximum number of blocks in flight. 0 disables readahead. */
+  size_t max_blocks_{0};
+  /* The threads that read the blocks. */
+  Scheduler* scheduler_{nullptr};
+};
+
 class SSTable {
  public:
   /**
@@ -25,8 +39,23 @@ class SSTable {
    * Below are global options (see lsm/options.hpp):
    * block_size: The size of data block in the SSTable
    * use_direct_io: Enable O_DIRECT or not.
+   * cache: The block cache. If it is nullptr, blocks are read from the file
+   * every time.
+   * table_cache: The cache of opened SSTables. If it is nullptr, the SSTable
+   * stays open after it is opened.
+   * value_log: The value log, which has the values of the RecordType::BlobIndex
+   * records. The SSTable holds the blob files that it refers to.
+   * readahead: How the iterators read the data blocks ahead.
+   * use_mmap: Map the file into memory, and read the blocks from the mapping.
+   * The blocks are not inserted into the cache then.
+   *
+   * The file is opened lazily on the first access, unless sst_info does not
+   * have the key range.
    */
-  SSTable(SSTInfo sst_info, size_t block_size, bool use_direct_io);
+  SSTable(SSTInfo sst_info, size_t block_size, bool use_direct_io,
+      Cache* cache = nullptr, TableCache* table_cache = nullptr,
+      ValueLog* value_log = nullptr, ReadaheadOptions readahead = {},
+      bool use_mmap = false);
 
   ~SSTable();
 
@@ -34,11 +63,22 @@ class SSTable {
    * Try to get the associated value of key with the sequence number <= seq.
    * If the record has type RecordType::Value, then it copies the value,
    * and returns GetResult::kFound
+   * If the record has type RecordType::BlobIndex, then it reads the value
+   * from the value log, and returns GetResult::kFound
    * If the record has type RecordType::Deletion, then it does nothing to the
    * value, and returns GetResult::kDelete If there is no such record, it
    * returns GetResult::kNotFound.
+   * The sequence number of the record is stored in record_seq if it is not
+   * nullptr.
    * */
-  GetResult Get(Slice key, uint64_t seq, std::string* value);
+  GetResult Get(Slice key, uint64_t seq, std::string* value,
+      seq_t* record_seq = nullptr);
+
+  /**
+   * Get the keys sorted by user key. The bloom filters are checked for all
+   * the keys first, and each data block is read once for all the keys in it.
+   */
+  void MultiGet(std::span<LookupKey* const> keys, uint64_t seq);
 
   /* Return an iterator positioned at the first record that is not smaller than
    * (key, seq). */
@@ -47,6 +87,14 @@ class SSTable {
   /* Return an iterator positioned at the beginning of the SSTable */
   SSTableIterator Begin();
 
+  /**
+   * Return false if no record >= (key, seq) in the SSTable has the prefix,
+   * which is the prefix of key. It checks the filter of the index partition
+   * of (key, seq), since the records with the prefix are adjacent. It
+   * returns true if the filters do not have the prefixes.
+   */
+  bool PrefixMayMatch(Slice key, uint64_t seq, Slice prefix);
+
   /* The largest key of the SSTable. */
   ParsedKey GetLargestKey() const { return largest_key_; }
 
@@ -66,22 +114,51 @@ class SSTable {
   const SSTInfo& GetSSTInfo() const { return sst_info_; }
 
  private:
+  /* Open the file, and read the index and the bloom filter. */
+  std::shared_ptr<TableHandle> Open() const;
+
+  /* Return the opened SSTable. */
+  std::shared_ptr<TableHandle> GetTable();
+
+  /**
+   * Read a block from the cache, or from the file into buf and insert it
+   * into the cache. Return the data of the block, which is pinned by
+   * cache_handle if it is in the cache.
+   */
+  const char* ReadBlock(const TableHandle& table, BlockHandle block,
+      CachePriority priority, AlignedBuffer* buf,
+      std::optional<Cache::Handle>* cache_handle);
+
+  /* Check the filter of the index partition that may have the key. */
+  bool PartitionMayMatch(const TableHandle& table, size_t partition, Slice key);
+
+  /* The value of a record, which is read from the value log if needed. */
+  std::string ReadValue(ParsedKey key, Slice value) const;
+
   /* The information of SSTable. */
   SSTInfo sst_info_;
-  /* The file manager. */
-  std::unique_ptr<ReadFile> file_;
-  /* The index data, which is initialized in construction. */
-  std::vector<IndexValue> index_;
   /* The block size of the data block. */
   size_t block_size_;
+  bool use_direct_io_;
   /* The key range of the SSTable, which is initialized in construction. */
   InternalKey smallest_key_, largest_key_;
   /* If it is picked as an input of a compaction task. */
   bool compaction_in_process_{false};
   /* If it is true, then the SSTable file will be removed in deconstrution. */
   bool remove_tag_{false};
-  /* The bloom filter buffer */
-  std::string bloom_filter_;
+  /* The block cache. */
+  Cache* cache_{nullptr};
+  TableCache* table_cache_{nullptr};
+  ValueLog* value_log_{nullptr};
+  ReadaheadOptions readahead_;
+  bool use_mmap_{false};
+  /* The blob files in sst_info_.blob_files_ */
+  std::vector<std::shared_ptr<BlobFile>> blob_files_;
+  /* The ID of the SSTable in the block cache and the table cache. */
+  uint64_t id_{0};
+  /* The opened SSTable if there is no table cache, protected by table_mu_ */
+  std::shared_ptr<TableHandle> table_;
+  std::mutex table_mu_;
 
   friend class SSTableIterator;
 };
@@ -90,7 +167,12 @@ class SSTableIterator final : public Iterator {
  public:
   SSTableIterator() = default;
 
-  SSTableIterator(SSTable* sst) : sst_(sst), buf_(sst->block_size_, 4096) {}
+  SSTableIterator(SSTable* sst, CachePriority priority = CachePriority::kLow)
+    : sst_(sst), priority_(priority) {}
+
+  SSTableIterator(SSTable* sst, std::shared_ptr<TableHandle> table,
+      CachePriority priority)
+    : sst_(sst), table_(std::move(table)), priority_(priority) {}
 
   /* Move the the beginning */
   void SeekToFirst();
@@ -108,23 +190,102 @@ class SSTableIterator final : public Iterator {
   void Next() override;
 
  private:
+  /**
+   * Read the data block, from the cache if possible, or take it from the
+   * blocks read ahead.
+   */
+  void LoadBlock();
+
+  /* Read the index partition block_id_. */
+  void LoadIndexPartition();
+
+  /**
+   * Start reading the data blocks after the current one, so that readahead_
+   * blocks are in flight. It stops at the end of the index partition.
+   */
+  void Readahead();
+
+  /* A data block that is read ahead. */
+  struct PrefetchedBlock {
+    BlockHandle block_;
+    /* The block in the cache, if it is cached when it is read ahead. */
+    std::optional<Cache::Handle> cache_handle_;
+    /* Shared with the read, so that the iterator can drop it any time. */
+    std::shared_ptr<AlignedBuffer> buf_;
+    std::future<void> done_;
+  };
+
   /* The reference to the SSTable */
   SSTable* sst_{nullptr};
-  /* Current data block id */
+  /* The opened SSTable. It is opened by the first seek. */
+  std::shared_ptr<TableHandle> table_;
+  /* The priority of the blocks read by this iterator in the cache. */
+  CachePriority priority_{CachePriority::kLow};
+  /**
+   * The current entry of the index. If the index is partitioned, it is the
+   * current index partition.
+   */
   size_t block_id_{0};
+  /* The iterator of the current index partition, which is pinned. */
+  BlockIterator index_it_;
+  AlignedBuffer index_buf_;
+  std::optional<Cache::Handle> index_handle_;
   /* The block iterator of the current data block. */
   BlockIterator block_it_;
-  /* The buffer */
+  /* The buffer, used if there is no cache */
   AlignedBuffer buf_;
+  /* The current data block in the cache, which is pinned. */
+  std::optional<Cache::Handle> cache_handle_;
+  /* The data blocks after the current one that are being read. */
+  std::deque<PrefetchedBlock> prefetched_;
+  /**
+   * The number of blocks to read ahead. It is 0 after a seek and 1 after the
+   * first block transition, and then doubles on every block transition up to
+   * max_blocks_, so that short scans do not read blocks they do not need.
+   */
+  size_t readahead_{0};
 };
 
+/**
+ * The index section starts with a format tag, i.e. kSSTFormatMagic | format,
+ * or'ed with kSSTPartitionedFlag if the index is partitioned, and with
+ * kSSTBlockedBloomFlag if the bloom filters are utils::BlockedBloomFilter,
+ * and with kSSTPrefixFilterFlag if the bloom filters also have the prefixes
+ * of the keys.
+ * SSTables written before the tag existed start with the number of index
+ * entries instead, which never has the magic bits, and use SSTFormat::kPlain.
+ *
+ * A partitioned index is split into index partitions of about a block each.
+ * An index partition is a block whose values are the BlockHandles of the data
+ * blocks. Each index partition has a bloom filter of the keys in its data
+ * blocks. Both are written between the data blocks and are read through the
+ * block cache. The index section is then the top-level index, i.e.
+ * [count] then [key length][last key][index partition handle][filter handle]
+ * for each partition, followed by an empty bloom filter.
+ */
+static constexpr size_t kSSTFormatMagic = 0x5753535400000000ull;
+static constexpr size_t kSSTFormatMagicMask = 0xffffffff00000000ull;
+static constexpr size_t kSSTPartitionedFlag = 0x10000;
+static constexpr size_t kSSTBlockedBloomFlag = 0x20000;
+static constexpr size_t kSSTPrefixFilterFlag = 0x40000;
+
 class SSTableBuilder {
  public:
   SSTableBuilder(std::unique_ptr<FileWriter> writer, size_t block_size,
-      size_t bloom_bits_per_key)
+      double bloom_bits_per_key,
+      SSTFormat format = SSTFormat::kPrefixCompressed,
+      size_t restart_interval = 16, bool partitioned = false,
+      bool blocked_bloom = false,
+      const PrefixExtractor* prefix_extractor = nullptr)
     : writer_(std::move(writer)),
-      block_builder_(block_size, writer_.get()),
-      bloom_bits_per_key_(bloom_bits_per_key) {}
+      block_builder_(block_size, writer_.get(), format, restart_interval),
+      block_size_(block_size),
+      bloom_bits_per_key_(bloom_bits_per_key),
+      format_(format),
+      restart_interval_(restart_interval),
+      partitioned_(partitioned),
+      blocked_bloom_(blocked_bloom),
+      prefix_extractor_(prefix_extractor) {}
 
   ~SSTableBuilder() = default;
   SSTableBuilder& operator=(SSTableBuilder&&) = default;
@@ -139,6 +300,10 @@ class SSTableBuilder {
 
   ParsedKey GetSmallestKey() const { return smallest_key_; }
 
+  seq_t GetSmallestSeq() const { return smallest_seq_; }
+
+  seq_t GetLargestSeq() const { return largest_seq_; }
+
   size_t size() const { return writer_->size(); }
 
   size_t count() const { return count_; }
@@ -148,16 +313,29 @@ class SSTableBuilder {
   size_t GetBloomFilterOffset() const { return bloom_filter_offset_; }
 
  private:
+  /* Finish the data block and add it to the index. */
+  void FinishDataBlock();
+
+  /* Write the current index partition and its filter. */
+  void FinishPartition();
+
+  /* The bloom filter of the key hashes in [begin, end). */
+  std::string CreateFilter(size_t begin, size_t end) const;
+
   /* The file writer */
   std::unique_ptr<FileWriter> writer_;
   /* The builder for the data block */
   BlockBuilder block_builder_;
+  /* The target block size */
+  size_t block_size_;
   /* The index data */
   std::vector<IndexValue> index_data_;
   /* The index offset */
   size_t index_offset_{0};
   /* The key range of the SSTable */
   InternalKey largest_key_, smallest_key_;
+  /* The range of the sequence numbers */
+  seq_t smallest_seq_{UINT64_MAX}, largest_seq_{0};
   /* The number of records in this SSTable. */
   size_t count_{0};
   /* Current offset */
@@ -167,7 +345,26 @@ class SSTableBuilder {
   /* The offset of the bloom filter */
   size_t bloom_filter_offset_{0};
   /* The number of bits per key in bloom filter */
-  size_t bloom_bits_per_key_{0};
+  double bloom_bits_per_key_{0};
+  /* The format of the data blocks */
+  SSTFormat format_;
+  size_t restart_interval_;
+  /* Partition the index and the filter or not */
+  bool partitioned_;
+  /* Use utils::BlockedBloomFilter or not */
+  bool blocked_bloom_;
+  /* Add the prefixes of the keys to the filters if it is not nullptr */
+  const PrefixExtractor* prefix_extractor_;
+  /* The last prefix added to the filter of the current partition */
+  std::optional<std::string> last_prefix_;
+  /* The top-level index and the filter partitions */
+  std::vector<IndexValue> top_index_;
+  std::vector<BlockHandle> filters_;
+  /* The first index entry and key hash of the current partition */
+  size_t partition_begin_{0};
+  size_t partition_hash_begin_{0};
+  /* The size of the current index partition */
+  size_t partition_size_{0};
 };
 
 }  // namespace lsm
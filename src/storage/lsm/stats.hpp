@@ -13,11 +13,36 @@ struct StatsContext {
   std::atomic<uint64_t> total_write_bytes{0};
   /* Total bytes of flushed MemTable */
   std::atomic<uint64_t> total_input_bytes{0};
+  /* Total bytes written to the write-ahead logs */
+  std::atomic<uint64_t> total_wal_bytes{0};
+  /* The number of compactions, and the subcompactions they are split into */
+  std::atomic<uint64_t> total_compactions{0};
+  std::atomic<uint64_t> total_subcompactions{0};
+  /* The number of SSTables moved to the next level without rewriting */
+  std::atomic<uint64_t> total_trivial_moves{0};
+  /* The number of sorted runs skipped by the prefix filters in seeks */
+  std::atomic<uint64_t> total_prefix_filtered_runs{0};
+  /* The number of SSTables dropped by the compactions without reading */
+  std::atomic<uint64_t> total_range_deleted_ssts{0};
+  /* The number of data blocks read ahead by the iterators */
+  std::atomic<uint64_t> total_readahead_blocks{0};
+  /* The time that writers are delayed, and stopped, by the write controller */
+  std::atomic<uint64_t> total_write_delay_micros{0};
+  std::atomic<uint64_t> total_write_stop_micros{0};
 
   void Reset() {
     total_read_bytes = 0;
     total_write_bytes = 0;
     total_input_bytes = 0;
+    total_wal_bytes = 0;
+    total_compactions = 0;
+    total_subcompactions = 0;
+    total_trivial_moves = 0;
+    total_prefix_filtered_runs = 0;
+    total_range_deleted_ssts = 0;
+    total_readahead_blocks = 0;
+    total_write_delay_micros = 0;
+    total_write_stop_micros = 0;
   }
 };
 
@@ -0,0 +1,64 @@
+#include "storage/lsm/table_cache.hpp"
+
+namespace wing {
+
+namespace lsm {
+
+std::shared_ptr<TableHandle> TableCache::Get(
+    uint64_t id, const std::function<std::shared_ptr<TableHandle>()>& open) {
+  {
+    std::unique_lock lck(mu_);
+    auto it = table_.find(id);
+    if (it != table_.end()) {
+      stats_.hits_ += 1;
+      lru_.splice(lru_.begin(), lru_, it->second);
+      return it->second->handle_;
+    }
+    stats_.misses_ += 1;
+  }
+  /* Reading the index and the bloom filter does not block other SSTables. */
+  auto handle = open();
+  std::unique_lock lck(mu_);
+  auto it = table_.find(id);
+  if (it != table_.end()) {
+    /* Another thread has opened it. */
+    return it->second->handle_;
+  }
+  lru_.push_front(Entry{id, handle, handle->charge()});
+  table_.emplace(id, lru_.begin());
+  stats_.size_ += lru_.front().charge_;
+  Evict();
+  return handle;
+}
+
+void TableCache::Erase(uint64_t id) {
+  std::unique_lock lck(mu_);
+  auto it = table_.find(id);
+  if (it == table_.end()) {
+    return;
+  }
+  stats_.size_ -= it->second->charge_;
+  lru_.erase(it->second);
+  table_.erase(it);
+}
+
+TableCacheStats TableCache::GetStats() {
+  std::unique_lock lck(mu_);
+  auto ret = stats_;
+  ret.open_files_ = lru_.size();
+  return ret;
+}
+
+void TableCache::Evict() {
+  while (!lru_.empty() && (lru_.size() > options_.max_open_files ||
+                              stats_.size_ > options_.capacity)) {
+    auto& e = lru_.back();
+    stats_.size_ -= e.charge_;
+    table_.erase(e.id_);
+    lru_.pop_back();
+  }
+}
+
+}  // namespace lsm
+
+}  // namespace wing
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "common/bloomfilter.hpp"
+#include "storage/lsm/file.hpp"
+#include "storage/lsm/format.hpp"
+
+namespace wing {
+
+namespace lsm {
+
+/* An opened SSTable: the file, and the index and the bloom filter in it. */
+struct TableHandle {
+  std::unique_ptr<ReadFile> file_;
+  /* The mapping of the file if the blocks are read from it. */
+  std::unique_ptr<MmapFile> mmap_;
+  /**
+   * The index. If it is partitioned, it is the top-level index, whose
+   * entries point to the index partitions.
+   */
+  std::vector<IndexValue> index_;
+  /* The filter partition of each index partition. */
+  std::vector<BlockHandle> filters_;
+  bool partitioned_{false};
+  /* The bloom filter of the whole SSTable, if it is not partitioned. */
+  std::string bloom_filter_;
+  /* The filters are utils::BlockedBloomFilter or utils::BloomFilter. */
+  bool blocked_bloom_{false};
+  /* The filters also have the prefixes of the keys. */
+  bool prefix_filter_{false};
+  SSTFormat format_{SSTFormat::kPlain};
+  InternalKey smallest_key_, largest_key_;
+
+  /* Check the bloom filter, which is bloom_filter_ or a filter partition. */
+  bool MayMatch(Slice user_key, std::string_view filter) const {
+    return blocked_bloom_ ? utils::BlockedBloomFilter::Find(user_key, filter)
+                          : utils::BloomFilter::Find(user_key, filter);
+  }
+
+  /* Return the first entry of index_ whose key >= (user_key, seq). */
+  size_t Seek(Slice user_key, seq_t seq) const {
+    ParsedKey target_key(user_key, seq, RecordType::Value);
+    size_t left = 0;
+    size_t right = index_.size();
+    while (left < right) {
+      size_t mid = (left + right) / 2;
+      if (ParsedKey(index_[mid].key_) < target_key) {
+        left = mid + 1;
+      } else {
+        right = mid;
+      }
+    }
+    return left;
+  }
+
+  /* The memory used by the index and the bloom filter. */
+  size_t charge() const {
+    size_t ret = bloom_filter_.size() + filters_.size() * sizeof(BlockHandle);
+    for (auto& index : index_) {
+      ret += sizeof(IndexValue) + index.key_.size();
+    }
+    return ret;
+  }
+};
+
+struct TableCacheOptions {
+  /* The maximum number of opened SSTables. */
+  size_t max_open_files = 1024;
+  /* The maximum memory used by the indexes and the bloom filters. */
+  size_t capacity = 64 * 1024 * 1024;  // 64MiB
+};
+
+struct TableCacheStats {
+  uint64_t hits_{0};
+  uint64_t misses_{0};
+  /* The number of cached SSTables and their charge. */
+  uint64_t open_files_{0};
+  uint64_t size_{0};
+};
+
+/**
+ * An LRU cache of opened SSTables. A handle that is evicted is closed when
+ * no iterator uses it. If the cache is full of SSTables in use, it may
+ * exceed its capacity temporarily.
+ */
+class TableCache {
+ public:
+  TableCache(const TableCacheOptions& options) : options_(options) {}
+
+  /**
+   * Return the handle of the SSTable id. If it is not cached, call open()
+   * without holding the lock, and insert the result.
+   */
+  std::shared_ptr<TableHandle> Get(
+      uint64_t id, const std::function<std::shared_ptr<TableHandle>()>& open);
+
+  /* Remove the SSTable, e.g. when it is deleted. */
+  void Erase(uint64_t id);
+
+  TableCacheStats GetStats();
+
+ private:
+  struct Entry {
+    uint64_t id_;
+    std::shared_ptr<TableHandle> handle_;
+    size_t charge_;
+  };
+
+  // Require: mu_ held
+  void Evict();
+
+  const TableCacheOptions options_;
+  std::mutex mu_;
+  /* The most recently used one is at the front. */
+  std::list<Entry> lru_;
+  std::unordered_map<uint64_t, std::list<Entry>::iterator> table_;
+  TableCacheStats stats_;
+};
+
+}  // namespace lsm
+
+}  // namespace wing
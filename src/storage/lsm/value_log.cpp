@@ -0,0 +1,75 @@
+#include "storage/lsm/value_log.hpp"
+
+#include "common/serializer.hpp"
+
+namespace wing {
+
+namespace lsm {
+
+std::string BlobIndex::Encode() const {
+  std::string rep(sizeof(uint64_t) * 3, 0);
+  utils::Serializer(rep.data()).Write(file_id_).Write(offset_).Write(size_);
+  return rep;
+}
+
+BlobIndex BlobIndex::Decode(Slice rep) {
+  utils::Deserializer des(rep.data());
+  BlobIndex index;
+  index.file_id_ = des.Read<uint64_t>();
+  index.offset_ = des.Read<uint64_t>();
+  index.size_ = des.Read<uint64_t>();
+  return index;
+}
+
+BlobFile::~BlobFile() {
+  file_.reset();
+  if (remove_tag_) {
+    std::filesystem::remove(filename_);
+  }
+}
+
+std::string BlobFile::Read(uint64_t offset, uint64_t size) {
+  {
+    std::unique_lock lck(mu_);
+    if (file_ == nullptr) {
+      file_ = std::make_unique<ReadFile>(filename_, false);
+    }
+  }
+  std::string ret(size, 0);
+  file_->Read(ret.data(), size, offset);
+  return ret;
+}
+
+std::shared_ptr<BlobFile> ValueLog::GetFile(uint64_t id) {
+  std::unique_lock lck(mu_);
+  auto& file = files_[id];
+  auto ret = file.lock();
+  if (ret == nullptr) {
+    ret = std::make_shared<BlobFile>(fmt::format("{}{}.blob", prefix_, id));
+    file = ret;
+  }
+  /* Forget the files that have been released. */
+  if (files_.size() > 64 && files_.size() % 64 == 0) {
+    std::erase_if(files_, [](auto& x) { return x.second.expired(); });
+  }
+  return ret;
+}
+
+BlobIndex BlobWriter::Add(Slice value) {
+  if (writer_ != nullptr && writer_->size() >= blob_file_size_) {
+    writer_.reset();
+  }
+  if (writer_ == nullptr) {
+    auto [filename, id] = file_gen_->Generate("blob");
+    writer_ = std::make_unique<FileWriter>(
+        std::make_unique<SeqWriteFile>(filename, false), 1 << 20);
+    file_id_ = id;
+  }
+  BlobIndex index{file_id_, writer_->size(), value.size()};
+  writer_->AppendString(value);
+  return index;
+}
+
+}  // namespace lsm
+
+}  // namespace wing
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "storage/lsm/file.hpp"
+#include "storage/lsm/format.hpp"
+
+namespace wing {
+
+namespace lsm {
+
+/**
+ * The location of a value in the value log. It is the value of a
+ * RecordType::BlobIndex record in an SSTable.
+ *
+ * Representation: [file id: uint64_t][offset: uint64_t][size: uint64_t]
+ */
+struct BlobIndex {
+  uint64_t file_id_;
+  uint64_t offset_;
+  uint64_t size_;
+
+  std::string Encode() const;
+
+  static BlobIndex Decode(Slice rep);
+};
+
+/**
+ * A file of the value log, which has the values one after another. The
+ * SSTables that refer to it hold it, so it is removed when the last of them
+ * is destroyed if the remove tag is set.
+ */
+class BlobFile {
+ public:
+  BlobFile(std::string filename) : filename_(std::move(filename)) {}
+
+  ~BlobFile();
+
+  /* Read the value at offset. The file is opened on the first read. */
+  std::string Read(uint64_t offset, uint64_t size);
+
+  void SetRemoveTag(bool remove_tag) { remove_tag_ = remove_tag; }
+
+ private:
+  std::string filename_;
+  /* The values are not aligned, so the blob files do not use O_DIRECT. */
+  std::unique_ptr<ReadFile> file_;
+  std::mutex mu_;
+  bool remove_tag_{false};
+};
+
+/**
+ * The value log of a database. It finds the blob files by their IDs, and
+ * does not keep them alive.
+ */
+class ValueLog {
+ public:
+  /* prefix: The prefix of the file names, i.e. the database path. */
+  ValueLog(std::string prefix) : prefix_(std::move(prefix)) {}
+
+  /* Return the blob file. It is created if no one holds it. */
+  std::shared_ptr<BlobFile> GetFile(uint64_t id);
+
+  /* Read the value. The blob file must be held by an SSTable. */
+  std::string Read(const BlobIndex& index) {
+    return GetFile(index.file_id_)->Read(index.offset_, index.size_);
+  }
+
+ private:
+  std::string prefix_;
+  std::mutex mu_;
+  std::unordered_map<uint64_t, std::weak_ptr<BlobFile>> files_;
+};
+
+/**
+ * It writes the values of a flush or a compaction to new blob files, and
+ * switches to a new file when the file reaches blob_file_size.
+ */
+class BlobWriter {
+ public:
+  BlobWriter(FileNameGenerator* gen, size_t blob_file_size)
+    : file_gen_(gen), blob_file_size_(blob_file_size) {}
+
+  BlobIndex Add(Slice value);
+
+ private:
+  FileNameGenerator* file_gen_;
+  size_t blob_file_size_;
+  std::unique_ptr<FileWriter> writer_;
+  uint64_t file_id_{0};
+};
+
+/* How a flush or a compaction writes the values to the value log. */
+struct BlobWriteOptions {
+  /* The values whose sizes >= min_blob_size_ are written to the value log. */
+  size_t min_blob_size_{0};
+  /* The target size of the blob files */
+  size_t blob_file_size_{0};
+  /**
+   * The values in the blob files whose IDs < gc_cutoff_ are moved to new
+   * blob files, so that the old ones are removed once the SSTables that
+   * refer to them are compacted.
+   */
+  uint64_t gc_cutoff_{0};
+  /* To read the values that are moved */
+  ValueLog* value_log_{nullptr};
+};
+
+}  // namespace lsm
+
+}  // namespace wing
@@ -1,12 +1,15 @@
 #include "storage/lsm/version.hpp"
 
+#include "storage/lsm/stats.hpp"
+
 namespace wing {
 
 namespace lsm {
 
-bool Version::Get(std::string_view user_key, seq_t seq, std::string* value) {
+bool Version::Get(std::string_view user_key, seq_t seq, std::string* value,
+    seq_t* record_seq) {
   for (int i = 0; i < levels_.size(); ++i) {
-    auto res = levels_[i].Get(user_key, seq, value);
+    auto res = levels_[i].Get(user_key, seq, value, record_seq);
     if (res != GetResult::kNotFound) {
       if (res == GetResult::kFound) return true;
       return false;
@@ -15,6 +18,12 @@ bool Version::Get(std::string_view user_key, seq_t seq, std::string* value) {
   return false;
 }
 
+void Version::MultiGet(std::vector<LookupKey*>* keys, seq_t seq) {
+  for (size_t i = 0; i < levels_.size() && !keys->empty(); ++i) {
+    levels_[i].MultiGet(keys, seq);
+  }
+}
+
 void Version::Append(
     uint32_t level_id, std::vector<std::shared_ptr<SortedRun>> sorted_runs) {
   while (levels_.size() <= level_id) {
@@ -31,13 +40,19 @@ void Version::Append(uint32_t level_id, std::shared_ptr<SortedRun> sorted_run) {
 
 bool SuperVersion::Get(
     std::string_view user_key, seq_t seq, std::string* value) {
-  auto res = mt_->Get(user_key, seq, value);
-  if (res == GetResult::kFound) return true;
+  /* The record is deleted if a newer range tombstone covers it. */
+  seq_t record_seq = 0;
+  auto res = mt_->Get(user_key, seq, value, &record_seq);
+  if (res == GetResult::kFound) {
+    return MaxCoveringSeq(user_key, seq) < record_seq;
+  }
   if (res == GetResult::kDelete) return false;
 
   for (int i = imms_->size() - 1; i >= 0; --i) {
-    auto res = (*imms_)[i]->Get(user_key, seq, value);
-    if (res == GetResult::kFound) return true;
+    auto res = (*imms_)[i]->Get(user_key, seq, value, &record_seq);
+    if (res == GetResult::kFound) {
+      return MaxCoveringSeq(user_key, seq) < record_seq;
+    }
     if (res == GetResult::kDelete) return false;
   }
 
@@ -60,7 +75,51 @@ bool SuperVersion::Get(
     if (res == GetResult::kDelete) return false;
   }
   */
-  return version_->Get(user_key, seq, value);
+  if (!version_->Get(user_key, seq, value, &record_seq)) {
+    return false;
+  }
+  return MaxCoveringSeq(user_key, seq) < record_seq;
+}
+
+void SuperVersion::MultiGet(std::vector<LookupKey*> keys, seq_t seq) {
+  /* The MemTables are probed key by key. */
+  std::vector<LookupKey*> rest;
+  for (auto key : keys) {
+    key->result_ = mt_->Get(key->user_key_, seq, &key->value_, &key->seq_);
+    for (int i = imms_->size() - 1;
+         i >= 0 && key->result_ == GetResult::kNotFound; --i) {
+      key->result_ =
+          (*imms_)[i]->Get(key->user_key_, seq, &key->value_, &key->seq_);
+    }
+    if (key->result_ == GetResult::kNotFound) {
+      rest.push_back(key);
+    }
+  }
+  version_->MultiGet(&rest, seq);
+  for (auto key : keys) {
+    if (key->result_ == GetResult::kFound &&
+        MaxCoveringSeq(key->user_key_, seq) > key->seq_) {
+      key->result_ = GetResult::kDelete;
+    }
+  }
+}
+
+seq_t SuperVersion::MaxCoveringSeq(Slice user_key, seq_t seq) const {
+  seq_t ret = mt_->MaxCoveringSeq(user_key, seq);
+  for (auto& imm : *imms_) {
+    ret = std::max(ret, imm->MaxCoveringSeq(user_key, seq));
+  }
+  return std::max(
+      ret, version_->GetRangeTombstones().MaxCoveringSeq(user_key, seq));
+}
+
+RangeTombstoneList SuperVersion::GetRangeTombstones() const {
+  RangeTombstoneList ret = version_->GetRangeTombstones();
+  for (auto& imm : *imms_) {
+    ret.Append(imm->GetRangeTombstones());
+  }
+  ret.Append(mt_->GetRangeTombstones());
+  return ret;
 }
 
 std::string SuperVersion::ToString() const {
@@ -91,16 +150,27 @@ void SuperVersionIterator::SeekToFirst() {
   }
 }
 
-void SuperVersionIterator::Seek(Slice key, seq_t seq) {
+void SuperVersionIterator::Seek(
+    Slice key, seq_t seq, std::optional<Slice> prefix) {
   it_ = IteratorHeap<Iterator>();
   // SeekToFirst();
   for (int i = 0; i < mt_its_.size(); ++i) {
     mt_its_[i].Seek(key, seq);
     if (mt_its_[i].Valid()) it_.Push(&mt_its_[i]);
   }
-  for (int i = 0; i < sst_its_.size(); ++i) {
-    sst_its_[i].Seek(key, seq);
-    if (sst_its_[i].Valid()) it_.Push(&sst_its_[i]);
+  /* sst_its_ has the sorted runs in the same order as the Version. */
+  size_t i = 0;
+  for (auto& l : sv_->version_->GetLevels()) {
+    for (auto& r : l.GetRuns()) {
+      auto& sst_it = sst_its_[i++];
+      if (prefix && !r->PrefixMayMatch(key, seq, *prefix)) {
+        GetStatsContext()->total_prefix_filtered_runs.fetch_add(
+            1, std::memory_order_relaxed);
+        continue;
+      }
+      sst_it.Seek(key, seq);
+      if (sst_it.Valid()) it_.Push(&sst_it);
+    }
   }
 }
 
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <optional>
+
 #include "storage/lsm/common.hpp"
 #include "storage/lsm/iterator_heap.hpp"
 #include "storage/lsm/level.hpp"
@@ -18,7 +20,15 @@ class Version {
 
   // Return true if the GetResult is kFound
   // Otherwise return false
-  bool Get(Slice user_key, seq_t seq, std::string* value);
+  // The range tombstones are not checked.
+  bool Get(Slice user_key, seq_t seq, std::string* value,
+      seq_t* record_seq = nullptr);
+
+  /**
+   * Get the keys sorted by user key, level by level. The keys that are
+   * found or deleted are removed from keys.
+   */
+  void MultiGet(std::vector<LookupKey*>* keys, seq_t seq);
 
   const std::vector<Level>& GetLevels() const { return levels_; }
 
@@ -35,8 +45,19 @@ class Version {
    * */
   void Append(uint32_t level_id, std::shared_ptr<SortedRun> sorted_run);
 
+  /**
+   * The range tombstones of the flushed MemTables. They are kept until the
+   * records they delete are compacted away.
+   */
+  const RangeTombstoneList& GetRangeTombstones() const { return range_dels_; }
+
+  void SetRangeTombstones(RangeTombstoneList range_dels) {
+    range_dels_ = std::move(range_dels);
+  }
+
  private:
   std::vector<Level> levels_;
+  RangeTombstoneList range_dels_;
 };
 
 class SuperVersionIterator;
@@ -60,6 +81,18 @@ class SuperVersion {
   // Otherwise return false
   bool Get(Slice user_key, seq_t seq, std::string* value);
 
+  /* Get the keys sorted by user key. The results are in the keys. */
+  void MultiGet(std::vector<LookupKey*> keys, seq_t seq);
+
+  /**
+   * The largest sequence number <= seq of the range tombstones that cover
+   * the user key, or 0 if there is none.
+   */
+  seq_t MaxCoveringSeq(Slice user_key, seq_t seq) const;
+
+  /* All the range tombstones in the MemTables and the Version. */
+  RangeTombstoneList GetRangeTombstones() const;
+
   std::string ToString() const;
 
  private:
@@ -89,8 +122,12 @@ class SuperVersionIterator final : public Iterator {
   /* Move the the beginning */
   void SeekToFirst();
 
-  /* Find the first record >= (user_key, seq) */
-  void Seek(Slice key, seq_t seq);
+  /**
+   * Find the first record >= (user_key, seq). If prefix is given, only the
+   * records with the prefix are needed, so the sorted runs whose filters do
+   * not have it are skipped.
+   */
+  void Seek(Slice key, seq_t seq, std::optional<Slice> prefix = std::nullopt);
 
   bool Valid() override;
 
@@ -0,0 +1,237 @@
+#include "storage/lsm/version_edit.hpp"
+
+#include <algorithm>
+#include <optional>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "common/logging.hpp"
+#include "common/serializer.hpp"
+
+namespace wing {
+
+namespace lsm {
+
+template <typename T>
+static void PutValue(std::string* dst, T x) {
+  dst->append(reinterpret_cast<const char*>(&x), sizeof(T));
+}
+
+VersionEdit::VersionEdit(const Version& base, const Version& target) {
+  auto& old_levels = base.GetLevels();
+  auto& new_levels = target.GetLevels();
+  num_levels_ = new_levels.size();
+  range_dels_ = target.GetRangeTombstones();
+  for (size_t i = 0; i < std::max(old_levels.size(), new_levels.size()); i++) {
+    /* The run of each SSTable in the old level. */
+    std::unordered_map<uint64_t, size_t> old_run;
+    if (i < old_levels.size()) {
+      auto& runs = old_levels[i].GetRuns();
+      for (size_t r = 0; r < runs.size(); r++) {
+        for (auto& sst : runs[r]->GetSSTs()) {
+          old_run[sst->GetSSTInfo().sst_id_] = r;
+        }
+      }
+    }
+    std::unordered_set<uint64_t> kept;
+    if (i < new_levels.size()) {
+      auto& runs = new_levels[i].GetRuns();
+      /* The kept runs must be in the same order as in the old level. */
+      std::optional<size_t> last_run;
+      for (size_t r = 0; r < runs.size(); r++) {
+        auto& ssts = runs[r]->GetSSTs();
+        /* The old run that the SSTables come from, and the added ones. */
+        std::optional<size_t> from;
+        std::vector<SSTInfo> added;
+        for (auto& sst : ssts) {
+          auto it = old_run.find(sst->GetSSTInfo().sst_id_);
+          if (it == old_run.end()) {
+            added.push_back(sst->GetSSTInfo());
+            continue;
+          }
+          if (from && *from != it->second) {
+            from.reset();
+            break;
+          }
+          from = it->second;
+        }
+        if (from && (!last_run || *last_run < *from)) {
+          last_run = from;
+          for (auto& sst : ssts) {
+            if (old_run.count(sst->GetSSTInfo().sst_id_)) {
+              kept.insert(sst->GetSSTInfo().sst_id_);
+            }
+          }
+          if (!added.empty()) {
+            new_runs_.push_back(NewRun{static_cast<uint32_t>(i),
+                static_cast<uint32_t>(r), true, std::move(added)});
+          }
+          continue;
+        }
+        NewRun run{static_cast<uint32_t>(i), static_cast<uint32_t>(r), false,
+            {}};
+        for (auto& sst : ssts) {
+          run.ssts_.push_back(sst->GetSSTInfo());
+        }
+        new_runs_.push_back(std::move(run));
+      }
+    }
+    for (auto& [id, _] : old_run) {
+      if (!kept.count(id)) {
+        deleted_ssts_.emplace_back(i, id);
+      }
+    }
+  }
+}
+
+void VersionEdit::Apply(VersionLayout* layout) const {
+  if (layout->size() < num_levels_) {
+    layout->resize(num_levels_);
+  }
+  std::vector<std::unordered_set<uint64_t>> deleted(layout->size());
+  for (auto& [level, id] : deleted_ssts_) {
+    deleted[level].insert(id);
+  }
+  for (size_t i = 0; i < layout->size(); i++) {
+    auto& runs = (*layout)[i];
+    for (auto& run : runs) {
+      std::erase_if(run, [&](const SSTInfo& info) {
+        return deleted[i].count(info.sst_id_);
+      });
+    }
+    /* Empty runs in the new Version are new runs. */
+    std::erase_if(runs, [](const auto& run) { return run.empty(); });
+  }
+  for (auto& run : new_runs_) {
+    auto& runs = (*layout)[run.level_];
+    if (!run.merged_) {
+      runs.insert(runs.begin() + run.position_, run.ssts_);
+      continue;
+    }
+    auto& ssts = runs[run.position_];
+    ssts.insert(ssts.end(), run.ssts_.begin(), run.ssts_.end());
+    std::sort(ssts.begin(), ssts.end(), [](auto& a, auto& b) {
+      return ParsedKey(a.smallest_key_) < ParsedKey(b.smallest_key_);
+    });
+  }
+  layout->resize(num_levels_);
+}
+
+std::string VersionEdit::Encode() const {
+  std::string rep;
+  PutValue<uint32_t>(&rep, kManifestMagic);
+  PutValue<uint32_t>(&rep, kManifestVersion);
+  PutValue<seq_t>(&rep, seq_);
+  PutValue<uint64_t>(&rep, next_file_id_);
+  PutValue<uint64_t>(&rep, min_log_number_);
+  PutValue<uint32_t>(&rep, num_levels_);
+  PutValue<uint64_t>(&rep, deleted_ssts_.size());
+  for (auto& [level, id] : deleted_ssts_) {
+    PutValue<uint32_t>(&rep, level);
+    PutValue<uint64_t>(&rep, id);
+  }
+  PutValue<uint64_t>(&rep, new_runs_.size());
+  for (auto& run : new_runs_) {
+    PutValue<uint32_t>(&rep, run.level_);
+    PutValue<uint32_t>(&rep, run.position_);
+    PutValue<uint8_t>(&rep, run.merged_);
+    PutValue<uint64_t>(&rep, run.ssts_.size());
+    for (auto& info : run.ssts_) {
+      PutValue<uint64_t>(&rep, info.count_);
+      PutValue<uint64_t>(&rep, info.size_);
+      PutValue<uint64_t>(&rep, info.sst_id_);
+      PutValue<uint64_t>(&rep, info.index_offset_);
+      PutValue<uint64_t>(&rep, info.bloom_filter_offset_);
+      PutValue<uint64_t>(&rep, info.filename_.size());
+      rep.append(info.filename_);
+      PutValue<uint64_t>(&rep, info.smallest_key_.size());
+      rep.append(info.smallest_key_);
+      PutValue<uint64_t>(&rep, info.largest_key_.size());
+      rep.append(info.largest_key_);
+      PutValue<seq_t>(&rep, info.smallest_seq_);
+      PutValue<seq_t>(&rep, info.largest_seq_);
+      PutValue<uint64_t>(&rep, info.blob_files_.size());
+      for (auto id : info.blob_files_) {
+        PutValue<uint64_t>(&rep, id);
+      }
+    }
+  }
+  PutValue<uint64_t>(&rep, range_dels_.size());
+  for (auto& tombstone : range_dels_.GetTombstones()) {
+    PutValue<uint64_t>(&rep, tombstone.begin_.size());
+    rep.append(tombstone.begin_);
+    PutValue<uint64_t>(&rep, tombstone.end_.size());
+    rep.append(tombstone.end_);
+    PutValue<seq_t>(&rep, tombstone.seq_);
+  }
+  return rep;
+}
+
+VersionEdit VersionEdit::Decode(Slice rep) {
+  if (rep.size() < sizeof(uint32_t) * 2) {
+    DB_ERR("Invalid MANIFEST record of size {}", rep.size());
+  }
+  utils::Deserializer des(rep.data());
+  auto magic = des.Read<uint32_t>();
+  auto version = des.Read<uint32_t>();
+  if (magic != kManifestMagic || version != kManifestVersion) {
+    DB_ERR("Unsupported MANIFEST record: magic {:#x}, version {}", magic,
+        version);
+  }
+  VersionEdit edit;
+  edit.seq_ = des.Read<seq_t>();
+  edit.next_file_id_ = des.Read<uint64_t>();
+  edit.min_log_number_ = des.Read<uint64_t>();
+  edit.num_levels_ = des.Read<uint32_t>();
+  auto num_deleted = des.Read<uint64_t>();
+  for (uint64_t i = 0; i < num_deleted; i++) {
+    auto level = des.Read<uint32_t>();
+    auto id = des.Read<uint64_t>();
+    edit.deleted_ssts_.emplace_back(level, id);
+  }
+  auto num_runs = des.Read<uint64_t>();
+  for (uint64_t i = 0; i < num_runs; i++) {
+    NewRun run;
+    run.level_ = des.Read<uint32_t>();
+    run.position_ = des.Read<uint32_t>();
+    run.merged_ = des.Read<uint8_t>();
+    auto num_ssts = des.Read<uint64_t>();
+    for (uint64_t j = 0; j < num_ssts; j++) {
+      SSTInfo info;
+      info.count_ = des.Read<uint64_t>();
+      info.size_ = des.Read<uint64_t>();
+      info.sst_id_ = des.Read<uint64_t>();
+      info.index_offset_ = des.Read<uint64_t>();
+      info.bloom_filter_offset_ = des.Read<uint64_t>();
+      auto len = des.Read<uint64_t>();
+      info.filename_ = des.ReadString(len);
+      len = des.Read<uint64_t>();
+      info.smallest_key_ = des.ReadString(len);
+      len = des.Read<uint64_t>();
+      info.largest_key_ = des.ReadString(len);
+      info.smallest_seq_ = des.Read<seq_t>();
+      info.largest_seq_ = des.Read<seq_t>();
+      auto num_blob_files = des.Read<uint64_t>();
+      for (uint64_t k = 0; k < num_blob_files; k++) {
+        info.blob_files_.push_back(des.Read<uint64_t>());
+      }
+      run.ssts_.push_back(std::move(info));
+    }
+    edit.new_runs_.push_back(std::move(run));
+  }
+  auto num_range_dels = des.Read<uint64_t>();
+  for (uint64_t i = 0; i < num_range_dels; i++) {
+    RangeTombstone tombstone;
+    auto len = des.Read<uint64_t>();
+    tombstone.begin_ = des.ReadString(len);
+    len = des.Read<uint64_t>();
+    tombstone.end_ = des.ReadString(len);
+    tombstone.seq_ = des.Read<seq_t>();
+    edit.range_dels_.Add(std::move(tombstone));
+  }
+  return edit;
+}
+
+}  // namespace lsm
+
+}  // namespace wing
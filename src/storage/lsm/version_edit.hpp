@@ -0,0 +1,105 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "storage/lsm/format.hpp"
+#include "storage/lsm/version.hpp"
+
+namespace wing {
+
+namespace lsm {
+
+/* The SSTables of each sorted run of each level, used to replay edits. */
+using VersionLayout = std::vector<std::vector<std::vector<SSTInfo>>>;
+
+/**
+ * Every record of the MANIFEST starts with kManifestMagic and
+ * kManifestVersion. The version is bumped when the layout below changes, so
+ * that a MANIFEST in another layout is rejected instead of misparsed.
+ */
+static constexpr uint32_t kManifestMagic = 0x574d4e46;
+static constexpr uint32_t kManifestVersion = 1;
+
+/**
+ * The difference between two Versions. It is a record of the MANIFEST.
+ *
+ * A sorted run of the new Version is either a run of the old Version with
+ * some SSTables removed or added, or a new run. Applying the edit removes
+ * the deleted SSTables of each level and the empty runs, and then inserts
+ * the new runs at their positions in the level, or adds the SSTables to the
+ * run at the position if it is merged, e.g., after a trivial move.
+ *
+ * A snapshot is the edit from the empty Version.
+ *
+ * Representation:
+ * [magic: uint32_t][format version: uint32_t]
+ * [seq: seq_t][next file id: uint64_t][min log number: uint64_t]
+ * [number of levels: uint32_t]
+ * [number of deleted SSTables: uint64_t] then [level: uint32_t][sst id]
+ * [number of new runs: uint64_t] then
+ * [level: uint32_t][position: uint32_t][merged: uint8_t]
+ * [number of SSTables: uint64_t] and each SSTable is
+ * [count][size][sst id][index offset][bloom filter offset]
+ * [filename length][filename][smallest key length][smallest key]
+ * [largest key length][largest key][smallest seq][largest seq]
+ * [number of blob files][blob file ids], all of which are uint64_t but the
+ * strings.
+ * [number of range tombstones: uint64_t] and each range tombstone is
+ * [begin length][begin][end length][end][seq], all of which are uint64_t
+ * but the strings.
+ *
+ * The range tombstones are few, so every edit has all the range tombstones
+ * of the new Version, and the last edit has those of the latest Version.
+ */
+class VersionEdit {
+ public:
+  VersionEdit() = default;
+
+  /* The edit that turns base into target. */
+  VersionEdit(const Version& base, const Version& target);
+
+  /* The last sequence number that is applied. */
+  void SetSeq(seq_t seq) { seq_ = seq; }
+  seq_t GetSeq() const { return seq_; }
+
+  /* The ID of the next file. */
+  void SetNextFileId(uint64_t id) { next_file_id_ = id; }
+  uint64_t GetNextFileId() const { return next_file_id_; }
+
+  /* The logs whose number < min log number have been flushed. */
+  void SetMinLogNumber(uint64_t number) { min_log_number_ = number; }
+  uint64_t GetMinLogNumber() const { return min_log_number_; }
+
+  const RangeTombstoneList& GetRangeTombstones() const { return range_dels_; }
+
+  void Apply(VersionLayout* layout) const;
+
+  std::string Encode() const;
+
+  static VersionEdit Decode(Slice rep);
+
+ private:
+  struct NewRun {
+    uint32_t level_;
+    /* The position of the run in the level. */
+    uint32_t position_;
+    /* If the SSTables are added to the existing run at the position. */
+    bool merged_;
+    std::vector<SSTInfo> ssts_;
+  };
+
+  seq_t seq_{0};
+  uint64_t next_file_id_{0};
+  uint64_t min_log_number_{0};
+  uint32_t num_levels_{0};
+  /* (level, sst id) */
+  std::vector<std::pair<uint32_t, uint64_t>> deleted_ssts_;
+  /* Ordered by (level, position) */
+  std::vector<NewRun> new_runs_;
+  RangeTombstoneList range_dels_;
+};
+
+}  // namespace lsm
+
+}  // namespace wing
@@ -0,0 +1,65 @@
+#include "storage/lsm/wal.hpp"
+
+#include <filesystem>
+
+#include "common/murmurhash.hpp"
+#include "common/serializer.hpp"
+
+namespace wing {
+
+namespace lsm {
+
+static constexpr size_t kLogChecksumSeed = 0x202410171530;
+static constexpr size_t kLogHeaderSize = sizeof(uint32_t) + sizeof(uint64_t);
+
+void LogWriter::AddRecord(Slice payload) {
+  auto offset = buffer_.size();
+  buffer_.resize(offset + kLogHeaderSize + payload.size());
+  utils::Serializer(buffer_.data() + offset)
+      .Write<uint32_t>(payload.size())
+      .Write<uint64_t>(
+          utils::Hash(payload.data(), payload.size(), kLogChecksumSeed))
+      .WriteString(payload);
+}
+
+size_t LogWriter::Flush(bool sync) {
+  if (buffer_.empty()) {
+    return 0;
+  }
+  file_->Write(buffer_.data(), buffer_.size());
+  auto size = buffer_.size();
+  buffer_.clear();
+  if (sync) {
+    file_->Sync();
+  }
+  return size;
+}
+
+LogReader::LogReader(const std::string& filename) {
+  data_.resize(std::filesystem::file_size(filename));
+  if (data_.size() > 0) {
+    ReadFile(filename, false).Read(data_.data(), data_.size(), 0);
+  }
+}
+
+bool LogReader::ReadRecord(Slice* payload) {
+  if (offset_ + kLogHeaderSize > data_.size()) {
+    return false;
+  }
+  auto des = utils::Deserializer(data_.data() + offset_);
+  size_t len = des.Read<uint32_t>();
+  uint64_t checksum = des.Read<uint64_t>();
+  if (offset_ + kLogHeaderSize + len > data_.size()) {
+    return false;
+  }
+  if (utils::Hash(des.data(), len, kLogChecksumSeed) != checksum) {
+    return false;
+  }
+  *payload = Slice(des.data(), len);
+  offset_ += kLogHeaderSize + len;
+  return true;
+}
+
+}  // namespace lsm
+
+}  // namespace wing
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "storage/lsm/file.hpp"
+#include "storage/lsm/format.hpp"
+
+namespace wing {
+
+namespace lsm {
+
+/**
+ * The write-ahead log (WAL).
+ *
+ * Each MemTable has its own log file. A log file is a sequence of records:
+ * [payload length: uint32_t][checksum: uint64_t][payload]
+ *
+ * The payload is the representation of a WriteBatch.
+ *
+ * A record that is truncated or whose checksum does not match is regarded as
+ * the end of the log, because it was being written when the process crashed.
+ *
+ * The MANIFEST uses the same format, and its payloads are VersionEdits.
+ */
+class LogWriter {
+ public:
+  LogWriter(std::unique_ptr<SeqWriteFile> file, size_t log_number)
+    : file_(std::move(file)), log_number_(log_number) {}
+
+  /* Append a record to the buffer. It is written by Flush(). */
+  void AddRecord(Slice payload);
+
+  /**
+   * Write all the buffered records with a single write.
+   * If sync is true, it also forces the log to the storage device.
+   * Return the number of bytes written.
+   */
+  size_t Flush(bool sync);
+
+  size_t GetLogNumber() const { return log_number_; }
+
+ private:
+  std::unique_ptr<SeqWriteFile> file_;
+  size_t log_number_;
+  std::string buffer_;
+};
+
+class LogReader {
+ public:
+  LogReader(const std::string& filename);
+
+  /* Read the next record. Return false if there are no more records. */
+  bool ReadRecord(Slice* payload);
+
+ private:
+  std::string data_;
+  size_t offset_{0};
+};
+
+}  // namespace lsm
+
+}  // namespace wing
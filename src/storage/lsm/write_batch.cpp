@@ -0,0 +1,43 @@
+#include "storage/lsm/write_batch.hpp"
+
+#include "common/serializer.hpp"
+
+namespace wing {
+
+namespace lsm {
+
+void WriteBatch::Put(Slice key, Slice value) {
+  Add(RecordType::Value, key, value);
+}
+
+void WriteBatch::Del(Slice key) { Add(RecordType::Deletion, key, Slice()); }
+
+void WriteBatch::DeleteRange(Slice begin, Slice end) {
+  Add(RecordType::RangeDeletion, begin, end);
+}
+
+void WriteBatch::Add(RecordType type, Slice key, Slice value) {
+  auto offset = rep_.size();
+  rep_.resize(offset + sizeof(RecordType) + sizeof(uint32_t) * 2 + key.size() +
+              value.size());
+  utils::Serializer(rep_.data() + offset)
+      .Write(type)
+      .Write<uint32_t>(key.size())
+      .WriteString(key)
+      .Write<uint32_t>(value.size())
+      .WriteString(value);
+  SetCount(Count() + 1);
+}
+
+void WriteBatch::Append(const WriteBatch& batch) {
+  rep_.append(batch.rep_.data() + kHeaderSize, batch.rep_.size() - kHeaderSize);
+  SetCount(Count() + batch.Count());
+}
+
+void WriteBatch::Clear() {
+  rep_.assign(kHeaderSize, 0);
+}
+
+}  // namespace lsm
+
+}  // namespace wing
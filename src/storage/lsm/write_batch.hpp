@@ -0,0 +1,95 @@
+#pragma once
+
+#include <string>
+
+#include "common/logging.hpp"
+#include "storage/lsm/format.hpp"
+
+namespace wing {
+
+namespace lsm {
+
+/**
+ * A list of updates that are applied atomically, with consecutive sequence
+ * numbers. Its representation is also the payload of a log record:
+ * [first seq: seq_t][count: uint32_t] then `count` entries of
+ * [type: RecordType][key length: uint32_t][key][value length: uint32_t][value]
+ * A range deletion is stored with RecordType::RangeDeletion, the begin of the
+ * range as the key, and the end as the value.
+ */
+class WriteBatch {
+ public:
+  WriteBatch() { Clear(); }
+
+  /* Create a batch from the payload of a log record. */
+  explicit WriteBatch(Slice rep) : rep_(rep) {}
+
+  void Put(Slice key, Slice value);
+
+  void Del(Slice key);
+
+  /* Delete the keys in [begin, end). */
+  void DeleteRange(Slice begin, Slice end);
+
+  /* Append all the updates in batch. */
+  void Append(const WriteBatch& batch);
+
+  void Clear();
+
+  /* The number of updates. */
+  uint32_t Count() const {
+    return *reinterpret_cast<const uint32_t*>(rep_.data() + sizeof(seq_t));
+  }
+
+  /* The size of the representation. */
+  size_t size() const { return rep_.size(); }
+
+  Slice GetRep() const { return rep_; }
+
+  /* The sequence number of the first update. */
+  seq_t GetSeq() const { return *reinterpret_cast<const seq_t*>(rep_.data()); }
+
+  void SetSeq(seq_t seq) { *reinterpret_cast<seq_t*>(rep_.data()) = seq; }
+
+  /* Call func(seq, type, key, value) for each update in order. */
+  template <typename F>
+  void Iterate(F&& func) const {
+    if (rep_.size() < kHeaderSize) {
+      return;
+    }
+    auto ptr = rep_.data() + kHeaderSize;
+    auto end = rep_.data() + rep_.size();
+    auto seq = GetSeq();
+    for (uint32_t i = 0, count = Count(); i < count; i++) {
+      auto type = *reinterpret_cast<const RecordType*>(ptr);
+      ptr += sizeof(RecordType);
+      auto klen = *reinterpret_cast<const uint32_t*>(ptr);
+      ptr += sizeof(uint32_t);
+      Slice key(ptr, klen);
+      ptr += klen;
+      auto vlen = *reinterpret_cast<const uint32_t*>(ptr);
+      ptr += sizeof(uint32_t);
+      Slice value(ptr, vlen);
+      ptr += vlen;
+      if (ptr > end) {
+        DB_ERR("Corrupted write batch!");
+      }
+      func(seq + i, type, key, value);
+    }
+  }
+
+ private:
+  static constexpr size_t kHeaderSize = sizeof(seq_t) + sizeof(uint32_t);
+
+  void Add(RecordType type, Slice key, Slice value);
+
+  void SetCount(uint32_t count) {
+    *reinterpret_cast<uint32_t*>(rep_.data() + sizeof(seq_t)) = count;
+  }
+
+  std::string rep_;
+};
+
+}  // namespace lsm
+
+}  // namespace wing
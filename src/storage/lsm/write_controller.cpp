@@ -0,0 +1,74 @@
+#include "storage/lsm/write_controller.hpp"
+
+#include <algorithm>
+#include <thread>
+
+#include "storage/lsm/stats.hpp"
+
+namespace wing {
+
+namespace lsm {
+
+void WriteController::SetState(WriteState state, double pressure) {
+  {
+    std::unique_lock lck(mu_);
+    if (state == WriteState::kDelayed) {
+      write_rate_ = delayed_write_rate_ *
+                    std::max(1 - pressure, 1 / kMaxSlowdown);
+      if (state_.load(std::memory_order_relaxed) != WriteState::kDelayed) {
+        /* Start with an empty bucket. */
+        tokens_ = 0;
+        last_refill_ = Clock::now();
+      }
+    }
+    state_.store(state, std::memory_order_relaxed);
+  }
+  if (state != WriteState::kStopped) {
+    cv_.notify_all();
+  }
+}
+
+double WriteController::GetWriteRate() {
+  std::unique_lock lck(mu_);
+  return write_rate_;
+}
+
+void WriteController::DelayWrite(uint64_t bytes) {
+  if (state_.load(std::memory_order_relaxed) == WriteState::kNormal) {
+    return;
+  }
+  std::unique_lock lck(mu_);
+  if (state_.load(std::memory_order_relaxed) == WriteState::kStopped) {
+    auto start = Clock::now();
+    cv_.wait(lck, [&]() {
+      return state_.load(std::memory_order_relaxed) != WriteState::kStopped;
+    });
+    GetStatsContext()->total_write_stop_micros.fetch_add(
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            Clock::now() - start)
+            .count());
+  }
+  if (state_.load(std::memory_order_relaxed) != WriteState::kDelayed) {
+    return;
+  }
+  auto now = Clock::now();
+  std::chrono::duration<double> elapsed = now - last_refill_;
+  std::chrono::duration<double> max_refill = kRefillInterval;
+  tokens_ = std::min(tokens_ + elapsed.count() * write_rate_,
+      max_refill.count() * write_rate_);
+  last_refill_ = now;
+  tokens_ -= bytes;
+  if (tokens_ >= 0) {
+    return;
+  }
+  /* Sleep until the debt is paid off by the refill. */
+  auto delay = std::chrono::duration<double>(-tokens_ / write_rate_);
+  lck.unlock();
+  std::this_thread::sleep_for(delay);
+  GetStatsContext()->total_write_delay_micros.fetch_add(
+      std::chrono::duration_cast<std::chrono::microseconds>(delay).count());
+}
+
+}  // namespace lsm
+
+}  // namespace wing
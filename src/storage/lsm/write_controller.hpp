@@ -0,0 +1,75 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+namespace wing {
+
+namespace lsm {
+
+enum class WriteState {
+  kNormal,
+  /* The writes are limited to a rate. */
+  kDelayed,
+  /* The writes wait until the background jobs catch up. */
+  kStopped,
+};
+
+/**
+ * It slows the writers down when the flushes and the compactions fall
+ * behind, so that the writers do not run into a full stop suddenly.
+ *
+ * The delayed writes take tokens from a token bucket, which is refilled at
+ * the write rate. A writer that takes more tokens than there are sleeps
+ * until the bucket is refilled.
+ */
+class WriteController {
+ public:
+  /* delayed_write_rate: The write rate in bytes per second when delayed. */
+  explicit WriteController(uint64_t delayed_write_rate)
+    : delayed_write_rate_(delayed_write_rate) {}
+
+  /**
+   * Set the state. If it is kDelayed, pressure in [0, 1) tells how close it
+   * is to stopping, and the write rate is lowered proportionally.
+   */
+  void SetState(WriteState state, double pressure = 0);
+
+  WriteState GetState() const { return state_.load(std::memory_order_relaxed); }
+
+  /* The current write rate in bytes per second, used when delayed. */
+  double GetWriteRate();
+
+  /**
+   * Called before writing bytes. It waits while the writes are stopped,
+   * and sleeps if the writes are delayed and there are not enough tokens.
+   * The time is added to the stall counters in StatsContext.
+   */
+  void DelayWrite(uint64_t bytes);
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  /* The tokens are refilled every interval, and no more are kept. */
+  static constexpr auto kRefillInterval = std::chrono::milliseconds(1);
+  /* The write rate is never lower than delayed_write_rate_ / kMaxSlowdown. */
+  static constexpr double kMaxSlowdown = 16;
+
+  const uint64_t delayed_write_rate_;
+  std::atomic<WriteState> state_{WriteState::kNormal};
+  std::mutex mu_;
+  /* Notified when the writes are not stopped anymore. */
+  std::condition_variable cv_;
+  /* The following are protected by mu_. */
+  double write_rate_{0};
+  /* The tokens in bytes, which are negative if the writers are in debt. */
+  double tokens_{0};
+  Clock::time_point last_refill_{};
+};
+
+}  // namespace lsm
+
+}  // namespace wing
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <memory>
+#include <string_view>
+#include <utility>
 #include <vector>
 
 #include "catalog/schema.hpp"
@@ -34,6 +36,21 @@ class ModifyHandle {
   virtual bool Delete(std::string_view key) = 0;
   virtual bool Insert(std::string_view key, std::string_view value) = 0;
   virtual bool Update(std::string_view key, std::string_view new_value) = 0;
+  /**
+   * Insert a list of (key, value). Return false if any key is duplicate.
+   * By default they are inserted one by one, so the (key, value)s before the
+   * duplicate one are inserted. Storages that support atomic batches should
+   * insert nothing in this case.
+   */
+  virtual bool InsertBatch(
+      const std::vector<std::pair<std::string_view, std::string_view>>& kvs) {
+    for (auto& [key, value] : kvs) {
+      if (!Insert(key, value)) {
+        return false;
+      }
+    }
+    return true;
+  }
 };
 
 /**
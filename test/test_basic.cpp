@@ -674,3 +674,22 @@ TEST(UtilsTest, BloomFilter) {
   DB_INFO("{}", fp / (double)N);
   ASSERT_TRUE(fp / (double)N <= 0.01);
 }
+
+TEST(UtilsTest, BlockedBloomFilter) {
+  std::string bf;
+  size_t N = 1e5;
+  wing::utils::BlockedBloomFilter::Create(N, 10, bf);
+  auto kv = wing::wing_testing::GenKVData(0x202410191700, 2 * N, 10, 9);
+  for (uint32_t i = 0; i < N; i++) {
+    wing::utils::BlockedBloomFilter::Add(kv[i].key(), bf);
+  }
+  for (uint32_t i = 0; i < N; i++) {
+    ASSERT_TRUE(wing::utils::BlockedBloomFilter::Find(kv[i].key(), bf));
+  }
+  size_t fp = 0;
+  for (uint32_t i = N; i < 2 * N; i++) {
+    fp += wing::utils::BlockedBloomFilter::Find(kv[i].key(), bf);
+  }
+  DB_INFO("{}", fp / (double)N);
+  ASSERT_TRUE(fp / (double)N <= 0.015);
+}
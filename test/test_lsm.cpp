@@ -1,3 +1,8 @@
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <fstream>
+
 #include "common/stopwatch.hpp"
 #include "gtest/gtest.h"
 #include "storage/lsm/block.hpp"
@@ -11,6 +16,7 @@
 #include "storage/lsm/stats.hpp"
 #include "storage/lsm/version.hpp"
 #include "test.hpp"
+#include "zipf.hpp"
 
 using namespace wing::lsm;
 using namespace wing::wing_testing;
@@ -80,6 +86,52 @@ TEST(LSMTest, MemTableSmallTest) {
     f.get();
 }
 
+TEST(LSMTest, MemTableBenchmark) {
+  size_t n = 2e5, TH = 4;
+  std::vector<std::vector<CompressedKVPair>> kvs;
+  for (uint32_t i = 0; i < TH; i++) {
+    kvs.push_back(GenKVData(0x202410172000 + i, n, 16, 64));
+  }
+  for (auto rep : {MemTableRep::kMap, MemTableRep::kSkipList}) {
+    auto name = rep == MemTableRep::kMap ? "map" : "skiplist";
+    for (size_t th : {size_t(1), TH}) {
+      MemTable t(rep);
+      wing::StopWatch sw;
+      std::vector<std::future<void>> pool;
+      for (uint32_t i = 0; i < th; i++) {
+        pool.push_back(std::async([&, i]() {
+          for (uint32_t j = 0; j < n; j++) {
+            t.Put(kvs[i][j].key(), i * n + j + 1, kvs[i][j].value());
+          }
+        }));
+      }
+      for (auto& f : pool)
+        f.get();
+      auto put_time = sw.GetTimeInSeconds();
+      sw.Reset();
+      for (uint32_t i = 0; i < th; i++) {
+        for (uint32_t j = 0; j < n; j++) {
+          std::string value;
+          ASSERT_EQ(t.Get(kvs[i][j].key(), th * n, &value), GetResult::kFound);
+          ASSERT_EQ(value, kvs[i][j].value());
+        }
+      }
+      auto get_time = sw.GetTimeInSeconds();
+      sw.Reset();
+      size_t count = 0;
+      ParsedKey last;
+      for (auto it = t.Begin(); it.Valid(); it.Next(), count++) {
+        ParsedKey key(it.key());
+        ASSERT_TRUE(count == 0 || last < key);
+        last = key;
+      }
+      ASSERT_EQ(count, th * n);
+      DB_INFO("{} with {} threads: put {} op/s, get {} op/s, scan {}s", name,
+          th, th * n / put_time, th * n / get_time, sw.GetTimeInSeconds());
+    }
+  }
+}
+
 TEST(LSMTest, FileWriterTest) {
   FileWriter writer(
       std::make_unique<SeqWriteFile>("__tmpLSMFileWriterTest", false), 4096);
@@ -118,39 +170,42 @@ TEST(LSMTest, FileWriterTest) {
 }
 
 TEST(LSMTest, BlockTest) {
-  FileWriter writer(
-      std::make_unique<SeqWriteFile>("__tmpLSMBlockTest", false), 4096);
-  BlockBuilder builder(16384, &writer);
-  uint32_t N = 512, klen = 5, vlen = 6;
-  auto kv = GenKVData(0x202403152328, N, klen, vlen);
-  /* Store the key-value pairs into the block */
-  std::sort(kv.begin(), kv.end());
-  for (uint32_t i = 0; i < N; i++) {
-    ASSERT_TRUE(builder.Append(
-        ParsedKey(kv[i].key(), 1, RecordType::Value), kv[i].value()));
-  }
-  builder.Finish();
-  /* Flush the block data to disk */
-  writer.Flush();
-  /* Read the block from the file */
-  auto buf = std::unique_ptr<char[]>(new char[writer.size()]);
-  ReadFile("__tmpLSMBlockTest", false).Read(buf.get(), writer.size(), 0);
-  for (uint32_t i = 0; i < N; i++) {
-    BlockHandle handle;
-    handle.offset_ = 0;
-    handle.size_ = builder.size();
-    handle.count_ = builder.count();
-    BlockIterator it(buf.get(), handle);
-    it.Seek(kv[i].key(), 1);
-    for (uint32_t j = i; j < N; j++) {
-      ASSERT_TRUE(it.Valid());
-      ASSERT_EQ(ParsedKey(it.key()).user_key_, kv[j].key());
-      ASSERT_EQ(it.value(), kv[j].value());
-      it.Next();
+  for (auto format : {SSTFormat::kPlain, SSTFormat::kPrefixCompressed}) {
+    FileWriter writer(
+        std::make_unique<SeqWriteFile>("__tmpLSMBlockTest", false), 4096);
+    BlockBuilder builder(16384, &writer, format);
+    uint32_t N = 512, klen = 5, vlen = 6;
+    auto kv = GenKVData(0x202403152328, N, klen, vlen);
+    /* Store the key-value pairs into the block */
+    std::sort(kv.begin(), kv.end());
+    for (uint32_t i = 0; i < N; i++) {
+      ASSERT_TRUE(builder.Append(
+          ParsedKey(kv[i].key(), 1, RecordType::Value), kv[i].value()));
     }
-    ASSERT_FALSE(it.Valid());
+    builder.Finish();
+    /* Flush the block data to disk */
+    writer.Flush();
+    ASSERT_EQ(builder.size(), writer.size());
+    /* Read the block from the file */
+    auto buf = std::unique_ptr<char[]>(new char[writer.size()]);
+    ReadFile("__tmpLSMBlockTest", false).Read(buf.get(), writer.size(), 0);
+    for (uint32_t i = 0; i < N; i++) {
+      BlockHandle handle;
+      handle.offset_ = 0;
+      handle.size_ = builder.size();
+      handle.count_ = builder.count();
+      BlockIterator it(buf.get(), handle, format);
+      it.Seek(kv[i].key(), 1);
+      for (uint32_t j = i; j < N; j++) {
+        ASSERT_TRUE(it.Valid());
+        ASSERT_EQ(ParsedKey(it.key()).user_key_, kv[j].key());
+        ASSERT_EQ(it.value(), kv[j].value());
+        it.Next();
+      }
+      ASSERT_FALSE(it.Valid());
+    }
+    std::remove("__tmpLSMBlockTest");
   }
-  std::remove("__tmpLSMBlockTest");
 }
 
 TEST(LSMTest, SSTableTest) {
@@ -214,6 +269,181 @@ TEST(LSMTest, SSTableTest) {
   std::remove("__tmpLSMSSTableTest");
 }
 
+TEST(LSMTest, SSTableFormatTest) {
+  /* Keys with a long common prefix, like serialized primary keys. */
+  uint32_t N = 1e5;
+  std::vector<std::pair<std::string, std::string>> kv;
+  for (uint32_t i = 0; i < N; i++) {
+    kv.emplace_back(fmt::format("table_orders/{:016}", i * 7),
+        fmt::format("value{}", i));
+  }
+  std::vector<size_t> sizes;
+  for (auto format : {SSTFormat::kPlain, SSTFormat::kPrefixCompressed}) {
+    SSTableBuilder builder(
+        std::make_unique<FileWriter>(
+            std::make_unique<SeqWriteFile>("__tmpLSMSSTableFormatTest", false),
+            4096),
+        4096, 10, format);
+    for (auto& [key, value] : kv) {
+      builder.Append(ParsedKey(key, 1, RecordType::Value), value);
+    }
+    builder.Finish();
+    SSTInfo info;
+    info.count_ = builder.count();
+    info.filename_ = "__tmpLSMSSTableFormatTest";
+    info.index_offset_ = builder.GetIndexOffset();
+    info.bloom_filter_offset_ = builder.GetBloomFilterOffset();
+    info.size_ = builder.size();
+    info.sst_id_ = 0;
+    sizes.push_back(builder.size());
+    /* The format is read from the file. */
+    SSTable sst(info, 4096, false);
+    for (uint32_t i = 0; i < N; i += 97) {
+      std::string value;
+      ASSERT_EQ(sst.Get(kv[i].first, 1, &value), GetResult::kFound);
+      ASSERT_EQ(value, kv[i].second);
+      ASSERT_EQ(sst.Get(fmt::format("table_orders/{:016}", i * 7 + 1), 1,
+                    &value),
+          GetResult::kNotFound);
+    }
+    uint32_t count = 0;
+    for (auto it = sst.Begin(); it.Valid(); it.Next(), count++) {
+      ASSERT_EQ(ParsedKey(it.key()).user_key_, kv[count].first);
+      ASSERT_EQ(it.value(), kv[count].second);
+    }
+    ASSERT_EQ(count, N);
+  }
+  DB_INFO("Plain: {} bytes, prefix-compressed: {} bytes", sizes[0], sizes[1]);
+  ASSERT_LT(sizes[1], sizes[0] * 0.7);
+  std::remove("__tmpLSMSSTableFormatTest");
+}
+
+TEST(LSMTest, SSTablePartitionedIndexTest) {
+  uint32_t N = 1e5;
+  std::vector<std::pair<std::string, std::string>> kv;
+  for (uint32_t i = 0; i < N; i++) {
+    kv.emplace_back(fmt::format("key{:016}", i * 7), fmt::format("value{}", i));
+  }
+  std::vector<size_t> charges;
+  for (bool partitioned : {false, true}) {
+    SSTableBuilder builder(
+        std::make_unique<FileWriter>(
+            std::make_unique<SeqWriteFile>(
+                "__tmpLSMSSTablePartitionedIndexTest", false),
+            4096),
+        4096, 10, SSTFormat::kPrefixCompressed, 16, partitioned);
+    for (auto& [key, value] : kv) {
+      builder.Append(ParsedKey(key, 1, RecordType::Value), value);
+    }
+    builder.Finish();
+    SSTInfo info;
+    info.count_ = builder.count();
+    info.filename_ = "__tmpLSMSSTablePartitionedIndexTest";
+    info.index_offset_ = builder.GetIndexOffset();
+    info.bloom_filter_offset_ = builder.GetBloomFilterOffset();
+    info.size_ = builder.size();
+    info.sst_id_ = 0;
+    CacheOptions cache_options;
+    cache_options.capacity = 64 * 4096;
+    Cache cache(cache_options);
+    TableCache table_cache(TableCacheOptions{});
+    SSTable sst(info, 4096, false, &cache, &table_cache);
+    for (uint32_t i = 0; i < N; i += 97) {
+      std::string value;
+      ASSERT_EQ(sst.Get(kv[i].first, 1, &value), GetResult::kFound);
+      ASSERT_EQ(value, kv[i].second);
+      ASSERT_EQ(sst.Get(fmt::format("key{:016}", i * 7 + 1), 1, &value),
+          GetResult::kNotFound);
+      auto it = sst.Seek(fmt::format("key{:016}", i * 7 + 1), 1);
+      ASSERT_TRUE(it.Valid());
+      ASSERT_EQ(ParsedKey(it.key()).user_key_, kv[i + 1].first);
+    }
+    ASSERT_FALSE(sst.Seek("key9", 1).Valid());
+    uint32_t count = 0;
+    for (auto it = sst.Begin(); it.Valid(); it.Next(), count++) {
+      ASSERT_EQ(ParsedKey(it.key()).user_key_, kv[count].first);
+      ASSERT_EQ(it.value(), kv[count].second);
+    }
+    ASSERT_EQ(count, N);
+    charges.push_back(table_cache.GetStats().size_);
+  }
+  /* Only the top-level index is in memory. */
+  DB_INFO("Memory of the opened SSTable: {} bytes, partitioned: {} bytes",
+      charges[0], charges[1]);
+  ASSERT_LT(charges[1] * 10, charges[0]);
+  std::remove("__tmpLSMSSTablePartitionedIndexTest");
+}
+
+TEST(LSMTest, CacheTest) {
+  auto block = [](uint32_t i) { return BlockHandle{i * 4096, 4096, 1}; };
+  for (auto policy : {CachePolicy::kClock, CachePolicy::kLRUK}) {
+    CacheOptions options;
+    options.capacity = 64 * 4096;
+    options.num_shards = 1;
+    options.policy = policy;
+    Cache cache(options);
+    /* Pinned blocks are never evicted, even beyond the capacity. */
+    {
+      std::vector<Cache::Handle> handles;
+      for (uint32_t i = 0; i < 128; i++) {
+        handles.push_back(
+            cache.insert(1, block(i), std::string(4096, 'a' + i % 26)));
+      }
+      for (uint32_t i = 0; i < 128; i++) {
+        ASSERT_EQ(handles[i].block(), std::string(4096, 'a' + i % 26));
+      }
+      ASSERT_EQ(cache.GetStats().size_, 128 * 4096);
+    }
+    ASSERT_LE(cache.GetStats().size_, 64 * 4096);
+    /* A hot set survives a large scan. */
+    for (int round = 0; round < 3; round++) {
+      for (uint32_t i = 0; i < 32; i++) {
+        if (!cache.get(2, block(i))) {
+          cache.insert(2, block(i), std::string(4096, 'h'));
+        }
+      }
+    }
+    for (uint32_t i = 0; i < 1000; i++) {
+      if (!cache.get(3, block(i), CachePriority::kLow)) {
+        cache.insert(3, block(i), std::string(4096, 's'), CachePriority::kLow);
+      }
+    }
+    auto stats = cache.GetStats();
+    for (uint32_t i = 0; i < 32; i++) {
+      auto handle = cache.get(2, block(i));
+      ASSERT_TRUE(handle.has_value());
+      ASSERT_EQ(handle->block(), std::string(4096, 'h'));
+    }
+    ASSERT_EQ(cache.GetStats().hits_, stats.hits_ + 32);
+    ASSERT_GT(stats.evictions_, 1000);
+    ASSERT_EQ(stats.misses_, 32 + 1000);
+  }
+  /* Throughput of concurrent lookups. */
+  CacheOptions options;
+  options.capacity = 1024 * 4096;
+  Cache cache(options);
+  for (uint32_t i = 0; i < 512; i++) {
+    cache.insert(1, block(i), std::string(4096, 'a'));
+  }
+  for (uint32_t TH : {1, 2, 4, 8}) {
+    uint32_t N = 2e5;
+    wing::StopWatch sw;
+    std::vector<std::thread> pool;
+    for (uint32_t t = 0; t < TH; t++) {
+      pool.emplace_back([&, t]() {
+        std::mt19937 rgen(t);
+        for (uint32_t i = 0; i < N; i++) {
+          ASSERT_TRUE(cache.get(1, block(rgen() % 512)).has_value());
+        }
+      });
+    }
+    for (auto& thread : pool) {
+      thread.join();
+    }
+    DB_INFO("{} threads: {} lookups/s", TH, TH * N / sw.GetTimeInSeconds());
+  }
+}
+
 TEST(LSMTest, SortedRunTest) {
   uint32_t klen = 9, vlen = 13, N = 3e6, fileN = 10;
   auto kv =
@@ -901,44 +1131,52 @@ bool SanityCheck(DBImpl* lsm) {
 }
 
 TEST(LSMTest, LSMSmallMultithreadGetPutTest) {
-  uint32_t TH = 4;
-  Options options;
-  options.compaction_strategy_name = "leveled";
-  options.sst_file_size = 1 << 20;
-  options.compaction_size_ratio = 4;
-  options.db_path = "__tmpLSMMultithreadGetPutTest/";
-  std::filesystem::remove_all(options.db_path);
-  std::filesystem::create_directories(options.db_path);
-  auto lsm = DBImpl::Create(options);
+  /* Throughput should rise with the number of threads. */
+  for (uint32_t TH : {1, 2, 4, 8}) {
+    Options options;
+    options.compaction_strategy_name = "leveled";
+    options.sst_file_size = 1 << 20;
+    options.compaction_size_ratio = 4;
+    options.db_path = "__tmpLSMMultithreadGetPutTest/";
+    std::filesystem::remove_all(options.db_path);
+    std::filesystem::create_directories(options.db_path);
+    auto lsm = DBImpl::Create(options);
 
-  std::vector<std::thread> pool;
-  for (uint32_t i = 0; i < TH; i++) {
-    pool.emplace_back([&, seed = i]() -> void {
-      uint32_t klen = 10, vlen = 130, N = 1e5;
-      double read_prob = 0.5;
-      auto kv = GenKVDataWithRandomLen(
-          0x202403180327 + seed, N, {klen - 1, klen}, {1, vlen});
-      std::mt19937_64 rgen(0x202403180327 + seed);
-      for (uint32_t i = 0; i < N; i++) {
-        std::uniform_real_distribution<> dis(0, 1);
-        lsm->Put(kv[i].key(), kv[i].value());
-        if (dis(rgen) < read_prob) {
-          std::string value;
-          std::uniform_int_distribution<> dis2(0, i);
-          int ri = dis2(rgen);
-          ASSERT_TRUE(lsm->Get(kv[ri].key(), &value));
-          ASSERT_EQ(value, kv[ri].value());
+    uint32_t klen = 10, vlen = 130, N = 1e5;
+    std::vector<std::vector<CompressedKVPair>> kvs;
+    for (uint32_t i = 0; i < TH; i++) {
+      kvs.push_back(GenKVDataWithRandomLen(
+          0x202403180327 + i, N, {klen - 1, klen}, {1, vlen}));
+    }
+    wing::StopWatch sw;
+    std::vector<std::thread> pool;
+    for (uint32_t i = 0; i < TH; i++) {
+      pool.emplace_back([&, seed = i]() -> void {
+        double read_prob = 0.5;
+        auto& kv = kvs[seed];
+        std::mt19937_64 rgen(0x202403180327 + seed);
+        for (uint32_t i = 0; i < N; i++) {
+          std::uniform_real_distribution<> dis(0, 1);
+          lsm->Put(kv[i].key(), kv[i].value());
+          if (dis(rgen) < read_prob) {
+            std::string value;
+            std::uniform_int_distribution<> dis2(0, i);
+            int ri = dis2(rgen);
+            ASSERT_TRUE(lsm->Get(kv[ri].key(), &value));
+            ASSERT_EQ(value, kv[ri].value());
+          }
         }
-      }
-    });
-  }
-  for (auto& f : pool)
-    f.join();
+      });
+    }
+    for (auto& f : pool)
+      f.join();
+    DB_INFO("{} threads: {} op/s", TH, TH * N / sw.GetTimeInSeconds());
 
-  lsm->WaitForFlushAndCompaction();
-  ASSERT_TRUE(SanityCheck(lsm.get()));
-  lsm.reset();
-  std::filesystem::remove_all(options.db_path);
+    lsm->WaitForFlushAndCompaction();
+    ASSERT_TRUE(SanityCheck(lsm.get()));
+    lsm.reset();
+    std::filesystem::remove_all(options.db_path);
+  }
 }
 
 TEST(LSMTest, LSMSaveTest) {
@@ -988,6 +1226,1450 @@ TEST(LSMTest, LSMSaveTest) {
   std::filesystem::remove_all(options.db_path);
 }
 
+TEST(LSMTest, LSMWALRecoveryTest) {
+  Options options;
+  options.compaction_strategy_name = "leveled";
+  options.sst_file_size = 1 << 20;
+  options.db_path = "__tmpLSMWALRecoveryTest/";
+  std::filesystem::remove_all(options.db_path);
+  std::filesystem::create_directories(options.db_path);
+  uint32_t klen = 10, vlen = 130, N = 1e5;
+  auto kv =
+      GenKVDataWithRandomLen(0x202410171600, N, {klen - 1, klen}, {1, vlen});
+  /* Crash without flushing MemTables or saving the metadata. */
+  auto pid = fork();
+  ASSERT_GE(pid, 0);
+  if (pid == 0) {
+    auto lsm = DBImpl::Create(options);
+    for (uint32_t i = 0; i < N; i++) {
+      lsm->Put(kv[i].key(), kv[i].value());
+    }
+    for (uint32_t i = 0; i < N; i += 2) {
+      lsm->Del(kv[i].key());
+    }
+    _exit(0);
+  }
+  int status = 0;
+  waitpid(pid, &status, 0);
+  ASSERT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+  options.create_new = false;
+  {
+    auto lsm = DBImpl::Create(options);
+    for (uint32_t i = 0; i < N; i++) {
+      std::string value;
+      if (i % 2 == 0) {
+        ASSERT_FALSE(lsm->Get(kv[i].key(), &value));
+      } else {
+        ASSERT_TRUE(lsm->Get(kv[i].key(), &value));
+        ASSERT_EQ(value, kv[i].value());
+      }
+    }
+    /* The recovered data is flushed and the logs are removed. */
+    lsm->FlushAll();
+    lsm->WaitForFlushAndCompaction();
+    ASSERT_TRUE(SanityCheck(lsm.get()));
+  }
+  {
+    auto lsm = DBImpl::Create(options);
+    for (uint32_t i = 1; i < N; i += 2) {
+      std::string value;
+      ASSERT_TRUE(lsm->Get(kv[i].key(), &value));
+      ASSERT_EQ(value, kv[i].value());
+    }
+  }
+  std::filesystem::remove_all(options.db_path);
+}
+
+TEST(LSMTest, LSMManifestTest) {
+  Options options;
+  options.compaction_strategy_name = "leveled";
+  options.sst_file_size = 64 * 1024;
+  options.level0_compaction_trigger = 2;
+  options.compaction_size_ratio = 2;
+  options.manifest_checkpoint_interval = 8;
+  options.db_path = "__tmpLSMManifestTest/";
+  std::filesystem::remove_all(options.db_path);
+  std::filesystem::create_directories(options.db_path);
+  auto layout = [](DBImpl* lsm) {
+    std::string ret;
+    for (auto& level : lsm->GetSV()->GetVersion()->GetLevels()) {
+      ret += fmt::format("L{}:", level.GetID());
+      for (auto& run : level.GetRuns()) {
+        ret += "[";
+        for (auto& sst : run->GetSSTs()) {
+          ret += fmt::format("{},", sst->GetSSTInfo().sst_id_);
+        }
+        ret += "]";
+      }
+    }
+    return ret;
+  };
+  uint32_t N = 50000;
+  auto kv = GenKVDataWithRandomLen(0x202410181200, N, {10, 10}, {1, 100});
+  /* Crash after many flushes and compactions without saving the Version. */
+  auto pid = fork();
+  ASSERT_GE(pid, 0);
+  if (pid == 0) {
+    auto lsm = DBImpl::Create(options);
+    for (uint32_t i = 0; i < N; i++) {
+      lsm->Put(kv[i].key(), kv[i].value());
+    }
+    lsm->FlushAll();
+    lsm->WaitForFlushAndCompaction();
+    std::ofstream(options.db_path / "layout") << layout(lsm.get());
+    _exit(0);
+  }
+  int status = 0;
+  waitpid(pid, &status, 0);
+  ASSERT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+  std::string expected;
+  std::getline(std::ifstream(options.db_path / "layout"), expected);
+  ASSERT_NE(expected.find("L1:["), std::string::npos);
+  options.create_new = false;
+  {
+    auto lsm = DBImpl::Create(options);
+    ASSERT_EQ(layout(lsm.get()), expected);
+    ASSERT_EQ(lsm->CurrentSeq(), N);
+    for (uint32_t i = 0; i < N; i++) {
+      std::string value;
+      ASSERT_TRUE(lsm->Get(kv[i].key(), &value));
+      ASSERT_EQ(value, kv[i].value());
+    }
+    /* Only the snapshot is left after the restart. */
+    LogReader reader(options.db_path / "MANIFEST");
+    Slice payload;
+    uint32_t num_records = 0;
+    while (reader.ReadRecord(&payload)) {
+      num_records += 1;
+    }
+    ASSERT_EQ(num_records, 1);
+  }
+  std::filesystem::remove_all(options.db_path);
+}
+
+TEST(LSMTest, LSMLegacyMetadataTest) {
+  Options options;
+  options.compaction_strategy_name = "leveled";
+  options.sst_file_size = 64 * 1024;
+  options.level0_compaction_trigger = 2;
+  options.compaction_size_ratio = 2;
+  options.db_path = "__tmpLSMLegacyMetadataTest/";
+  std::filesystem::remove_all(options.db_path);
+  std::filesystem::create_directories(options.db_path);
+  uint32_t N = 50000;
+  auto kv = GenKVDataWithRandomLen(0x202410181300, N, {10, 10}, {1, 100});
+  std::vector<std::vector<std::vector<SSTInfo>>> levels;
+  {
+    auto lsm = DBImpl::Create(options);
+    for (uint32_t i = 0; i < N; i++) {
+      lsm->Put(kv[i].key(), kv[i].value());
+    }
+    lsm->FlushAll();
+    lsm->WaitForFlushAndCompaction();
+    for (auto& level : lsm->GetSV()->GetVersion()->GetLevels()) {
+      auto& runs = levels.emplace_back();
+      for (auto& run : level.GetRuns()) {
+        auto& ssts = runs.emplace_back();
+        for (auto& sst : run->GetSSTs()) {
+          ssts.push_back(sst->GetSSTInfo());
+        }
+      }
+    }
+  }
+  ASSERT_GT(levels.size(), 1);
+  /* Replace the MANIFEST with the metadata file of the old databases. */
+  uint64_t next_file_id = 0;
+  for (auto& entry : std::filesystem::directory_iterator(options.db_path)) {
+    auto ext = entry.path().extension();
+    if (ext == ".sst" || ext == ".log") {
+      next_file_id = std::max<uint64_t>(
+          next_file_id, std::stoull(entry.path().stem().string()) + 1);
+    }
+    if (ext == ".log") {
+      std::filesystem::remove(entry.path());
+    }
+  }
+  std::filesystem::remove(options.db_path / "MANIFEST");
+  {
+    FileWriter writer(
+        std::make_unique<SeqWriteFile>(options.db_path / "metadata", false),
+        1 << 20);
+    writer.AppendValue<uint64_t>(N)
+        .AppendValue<uint64_t>(next_file_id)
+        .AppendValue<uint64_t>(levels.size());
+    for (size_t i = 0; i < levels.size(); i++) {
+      writer.AppendValue<uint64_t>(i).AppendValue<uint64_t>(levels[i].size());
+      for (auto& ssts : levels[i]) {
+        writer.AppendValue<uint64_t>(ssts.size());
+        for (auto& info : ssts) {
+          writer.AppendValue<uint64_t>(info.count_)
+              .AppendValue<uint64_t>(info.size_)
+              .AppendValue<uint64_t>(info.sst_id_)
+              .AppendValue<uint64_t>(info.index_offset_)
+              .AppendValue<uint64_t>(info.bloom_filter_offset_)
+              .AppendValue<uint64_t>(info.filename_.size())
+              .AppendString(info.filename_);
+        }
+      }
+    }
+    writer.Flush();
+  }
+  options.create_new = false;
+  auto check = [&](DBImpl* lsm) {
+    ASSERT_EQ(lsm->CurrentSeq(), N);
+    auto& new_levels = lsm->GetSV()->GetVersion()->GetLevels();
+    ASSERT_EQ(new_levels.size(), levels.size());
+    for (size_t i = 0; i < levels.size(); i++) {
+      ASSERT_EQ(new_levels[i].GetRuns().size(), levels[i].size());
+    }
+    for (uint32_t i = 0; i < N; i++) {
+      std::string value;
+      ASSERT_TRUE(lsm->Get(kv[i].key(), &value));
+      ASSERT_EQ(value, kv[i].value());
+    }
+  };
+  {
+    auto lsm = DBImpl::Create(options);
+    check(lsm.get());
+    /* The database is upgraded to the MANIFEST. */
+    ASSERT_TRUE(std::filesystem::exists(options.db_path / "MANIFEST"));
+    ASSERT_FALSE(std::filesystem::exists(options.db_path / "metadata"));
+  }
+  {
+    auto lsm = DBImpl::Create(options);
+    check(lsm.get());
+  }
+  std::filesystem::remove_all(options.db_path);
+}
+
+TEST(LSMTest, LSMTableCacheTest) {
+  Options options;
+  options.compaction_strategy_name = "leveled";
+  options.sst_file_size = 32 * 1024;
+  options.db_path = "__tmpLSMTableCacheTest/";
+  std::filesystem::remove_all(options.db_path);
+  std::filesystem::create_directories(options.db_path);
+  uint32_t N = 50000;
+  auto kv = GenKVDataWithRandomLen(0x202410181700, N, {10, 10}, {1, 100});
+  {
+    auto lsm = DBImpl::Create(options);
+    for (uint32_t i = 0; i < N; i++) {
+      lsm->Put(kv[i].key(), kv[i].value());
+    }
+    lsm->FlushAll();
+    lsm->WaitForFlushAndCompaction();
+  }
+  TableCacheOptions table_cache_options;
+  table_cache_options.max_open_files = 8;
+  options.table_cache = std::make_shared<TableCache>(table_cache_options);
+  options.create_new = false;
+  {
+    /* No SSTable is opened at startup. */
+    auto lsm = DBImpl::Create(options);
+    size_t num_ssts = 0;
+    for (auto& level : lsm->GetSV()->GetVersion()->GetLevels()) {
+      for (auto& run : level.GetRuns()) {
+        num_ssts += run->SSTCount();
+      }
+    }
+    ASSERT_GT(num_ssts, 8);
+    ASSERT_EQ(options.table_cache->GetStats().misses_, 0);
+    for (uint32_t i = 0; i < N; i++) {
+      std::string value;
+      ASSERT_TRUE(lsm->Get(kv[i].key(), &value));
+      ASSERT_EQ(value, kv[i].value());
+      ASSERT_LE(options.table_cache->GetStats().open_files_, 8);
+    }
+    uint32_t count = 0;
+    for (auto it = lsm->Begin(); it.Valid(); it.Next()) {
+      count += 1;
+    }
+    ASSERT_EQ(count, N);
+    auto stats = options.table_cache->GetStats();
+    ASSERT_GT(stats.misses_, num_ssts);
+    DB_INFO("{} SSTables, table cache hits {}, misses {}", num_ssts,
+        stats.hits_, stats.misses_);
+  }
+  std::filesystem::remove_all(options.db_path);
+}
+
+TEST(LSMTest, LSMSubcompactionTest) {
+  Options options;
+  options.compaction_strategy_name = "leveled";
+  options.sst_file_size = 32 * 1024;
+  options.max_subcompactions = 4;
+  options.db_path = "__tmpLSMSubcompactionTest/";
+  std::filesystem::remove_all(options.db_path);
+  std::filesystem::create_directories(options.db_path);
+  uint32_t N = 50000;
+  auto kv = GenKVDataWithRandomLen(0x202410181930, N, {10, 10}, {1, 100});
+  std::map<std::string, std::string> expected;
+  GetStatsContext()->Reset();
+  {
+    auto lsm = DBImpl::Create(options);
+    /* Overwrite the keys, so that subcompactions drop the old versions. */
+    for (int round = 0; round < 2; round++) {
+      for (uint32_t i = 0; i < N; i++) {
+        auto value = fmt::format("{}{}", kv[i].value(), round);
+        lsm->Put(kv[i].key(), value);
+        expected[std::string(kv[i].key())] = value;
+      }
+    }
+    lsm->FlushAll();
+    lsm->WaitForFlushAndCompaction();
+    /* There are no more subcompactions than cores. */
+    if (std::thread::hardware_concurrency() > 1) {
+      ASSERT_GT(GetStatsContext()->total_subcompactions.load(),
+          GetStatsContext()->total_compactions.load());
+    }
+    /* The outputs of the subcompactions form sorted runs. */
+    for (auto& level : lsm->GetSV()->GetVersion()->GetLevels()) {
+      for (auto& run : level.GetRuns()) {
+        auto& ssts = run->GetSSTs();
+        for (size_t i = 1; i < ssts.size(); i++) {
+          ASSERT_LT(ssts[i - 1]->GetLargestKey().user_key_,
+              ssts[i]->GetSmallestKey().user_key_);
+        }
+      }
+    }
+    for (auto& [key, value] : expected) {
+      std::string result;
+      ASSERT_TRUE(lsm->Get(key, &result));
+      ASSERT_EQ(result, value);
+    }
+    auto it = lsm->Begin();
+    for (auto& [key, value] : expected) {
+      ASSERT_TRUE(it.Valid());
+      ASSERT_EQ(it.key(), key);
+      ASSERT_EQ(it.value(), value);
+      it.Next();
+    }
+    ASSERT_FALSE(it.Valid());
+    DB_INFO("{} compactions, {} subcompactions",
+        GetStatsContext()->total_compactions.load(),
+        GetStatsContext()->total_subcompactions.load());
+  }
+  std::filesystem::remove_all(options.db_path);
+}
+
+TEST(LSMTest, LSMTrivialMoveTest) {
+  Options options;
+  options.compaction_strategy_name = "leveled";
+  options.sst_file_size = 32 * 1024;
+  options.enable_wal = false;
+  options.db_path = "__tmpLSMTrivialMoveTest/";
+  std::filesystem::remove_all(options.db_path);
+  std::filesystem::create_directories(options.db_path);
+  uint32_t N = 100000;
+  GetStatsContext()->Reset();
+  {
+    auto lsm = DBImpl::Create(options);
+    /* The keys are appended, so no SSTable overlaps the next level. */
+    for (uint32_t i = 0; i < N; i++) {
+      lsm->Put(fmt::format("{:010}", i), fmt::format("{:0100}", i));
+    }
+    lsm->FlushAll();
+    lsm->WaitForFlushAndCompaction();
+    ASSERT_TRUE(SanityCheck(lsm.get()));
+    ASSERT_GT(lsm->GetSV()->GetVersion()->GetLevels().size(), 2);
+    ASSERT_GT(GetStatsContext()->total_trivial_moves.load(), 0);
+    /* Only the flushes write SSTables, and the rest is the MANIFEST. */
+    ASSERT_LT(GetStatsContext()->total_write_bytes.load(),
+        GetStatsContext()->total_input_bytes.load() * 1.05);
+    for (uint32_t i = 0; i < N; i++) {
+      std::string result;
+      ASSERT_TRUE(lsm->Get(fmt::format("{:010}", i), &result));
+      ASSERT_EQ(result, fmt::format("{:0100}", i));
+    }
+    auto it = lsm->Begin();
+    for (uint32_t i = 0; i < N; i++) {
+      ASSERT_TRUE(it.Valid());
+      ASSERT_EQ(it.key(), fmt::format("{:010}", i));
+      it.Next();
+    }
+    ASSERT_FALSE(it.Valid());
+  }
+  std::filesystem::remove_all(options.db_path);
+}
+
+TEST(LSMTest, LSMMultiGetTest) {
+  Options options;
+  options.compaction_strategy_name = "leveled";
+  options.sst_file_size = 64 * 1024;
+  options.db_path = "__tmpLSMMultiGetTest/";
+  std::filesystem::remove_all(options.db_path);
+  std::filesystem::create_directories(options.db_path);
+  uint32_t N = 50000;
+  auto kv = GenKVDataWithRandomLen(0x202410191500, N, {10, 10}, {1, 100});
+  std::map<std::string, std::string> expected;
+  {
+    auto lsm = DBImpl::Create(options);
+    for (uint32_t i = 0; i < N; i++) {
+      lsm->Put(kv[i].key(), kv[i].value());
+      expected[std::string(kv[i].key())] = kv[i].value();
+    }
+    lsm->FlushAll();
+    lsm->WaitForFlushAndCompaction();
+    /* Some keys are deleted or updated in the MemTable. */
+    for (uint32_t i = 0; i < N; i += 7) {
+      lsm->Del(kv[i].key());
+      expected.erase(std::string(kv[i].key()));
+    }
+    for (uint32_t i = 3; i < N; i += 7) {
+      lsm->Put(kv[i].key(), "updated");
+      expected[std::string(kv[i].key())] = "updated";
+    }
+    /* Unsorted keys with duplicates and missing ones. */
+    std::vector<std::string> keys;
+    for (uint32_t i = 0; i < N; i += 3) {
+      keys.emplace_back(kv[i].key());
+      keys.push_back(fmt::format("{}missing", kv[i].key()));
+    }
+    keys.emplace_back(kv[0].key());
+    std::vector<Slice> slices(keys.begin(), keys.end());
+    auto results = lsm->MultiGet(slices);
+    ASSERT_EQ(results.size(), keys.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+      auto it = expected.find(keys[i]);
+      if (it == expected.end()) {
+        ASSERT_FALSE(results[i].has_value());
+      } else {
+        ASSERT_TRUE(results[i].has_value());
+        ASSERT_EQ(*results[i], it->second);
+      }
+    }
+    /* The keys in the same block share the block read. */
+    std::vector<std::string> batch;
+    for (auto it = expected.begin(); batch.size() < 256; ++it) {
+      batch.push_back(it->first);
+    }
+    auto lookups = [&]() {
+      auto stats = lsm->GetCacheStats();
+      return stats.hits_ + stats.misses_;
+    };
+    auto before = lookups();
+    for (auto& key : batch) {
+      std::string value;
+      ASSERT_TRUE(lsm->Get(key, &value));
+    }
+    auto get_lookups = lookups() - before;
+    before = lookups();
+    results = lsm->MultiGet(std::vector<Slice>(batch.begin(), batch.end()));
+    auto multiget_lookups = lookups() - before;
+    for (size_t i = 0; i < batch.size(); i++) {
+      ASSERT_EQ(*results[i], expected[batch[i]]);
+    }
+    DB_INFO("{} block lookups for Get, {} for MultiGet", get_lookups,
+        multiget_lookups);
+    ASSERT_LT(multiget_lookups * 4, get_lookups);
+  }
+  std::filesystem::remove_all(options.db_path);
+}
+
+TEST(LSMTest, LSMPerLevelBloomBitsTest) {
+  Options options;
+  options.compaction_strategy_name = "leveled";
+  options.sst_file_size = 64 * 1024;
+  options.write_buffer_size = 256 * 1024;
+  options.compaction_size_ratio = 3;
+  options.partition_index_and_filters = false;
+  options.db_path = "__tmpLSMPerLevelBloomBitsTest/";
+  std::filesystem::remove_all(options.db_path);
+  std::filesystem::create_directories(options.db_path);
+  uint32_t N = 200000;
+  auto kv = GenKVDataWithRandomLen(0x202410191800, N, {10, 10}, {1, 50});
+  {
+    auto lsm = DBImpl::Create(options);
+    for (uint32_t i = 0; i < N; i++) {
+      lsm->Put(kv[i].key(), kv[i].value());
+    }
+    lsm->FlushAll();
+    lsm->WaitForFlushAndCompaction();
+    /* The filter is followed by the smallest and the largest keys. */
+    auto filter_bits = [](const SSTInfo& info) {
+      return (info.size_ - info.bloom_filter_offset_ - sizeof(size_t) * 3 -
+                 info.smallest_key_.size() - info.largest_key_.size()) *
+             8;
+    };
+    auto version = lsm->GetSV()->GetVersion();
+    auto& levels = version->GetLevels();
+    ASSERT_GE(levels.size(), 3);
+    LeveledCompactionPicker picker(options.compaction_size_ratio,
+        options.write_buffer_size, options.level0_compaction_trigger);
+    double budget = 0, last_bits = 1e9;
+    size_t total_bits = 0, total_keys = 0;
+    for (auto& level : levels) {
+      size_t bits = 0, keys = 0;
+      for (auto& run : level.GetRuns()) {
+        for (auto& sst : run->GetSSTs()) {
+          bits += filter_bits(sst->GetSSTInfo());
+          keys += sst->GetSSTInfo().count_;
+        }
+      }
+      total_bits += bits;
+      total_keys += keys;
+      if (keys == 0) {
+        continue;
+      }
+      double alloc = picker.GetBloomBitsPerKey(
+          version.get(), level.GetID(), options.bloom_bits_per_key);
+      DB_INFO("Level {}: {} keys, {} bits per key, {} allocated",
+          level.GetID(), keys, bits / (double)keys, alloc);
+      /* The levels below are larger, so they get fewer bits. */
+      ASSERT_LT(alloc, last_bits);
+      last_bits = alloc;
+      budget += alloc * keys;
+    }
+    /* The allocation uses the same memory as bloom_bits_per_key. */
+    ASSERT_NEAR(budget / total_keys, options.bloom_bits_per_key, 1e-6);
+    ASSERT_LT(last_bits, options.bloom_bits_per_key);
+    /* The filters are built with the allocation at the time of writing. */
+    ASSERT_LT(total_bits / (double)total_keys,
+        options.bloom_bits_per_key * 1.1);
+    for (uint32_t i = 0; i < N; i++) {
+      std::string value;
+      ASSERT_TRUE(lsm->Get(kv[i].key(), &value));
+      ASSERT_EQ(value, kv[i].value());
+    }
+  }
+  std::filesystem::remove_all(options.db_path);
+}
+
+TEST(LSMTest, LSMPrefixSeekTest) {
+  for (bool partitioned : {false, true}) {
+    Options options;
+    options.compaction_strategy_name = "leveled";
+    options.sst_file_size = 64 * 1024;
+    options.write_buffer_size = 256 * 1024;
+    options.partition_index_and_filters = partitioned;
+    options.prefix_extractor = std::make_shared<FixedPrefixExtractor>(8);
+    options.db_path = "__tmpLSMPrefixSeekTest/";
+    std::filesystem::remove_all(options.db_path);
+    std::filesystem::create_directories(options.db_path);
+    /* Composite keys of an 8-byte prefix and a 4-byte suffix. */
+    uint32_t P = 4000, M = 16;
+    auto make_key = [](uint32_t p, uint32_t j) {
+      return fmt::format("{:08d}{:04d}", p, j);
+    };
+    std::mt19937_64 gen(0x202410192000);
+    std::vector<uint32_t> prefixes;
+    for (uint32_t p = 0; p < P; p++) {
+      prefixes.push_back(p);
+    }
+    std::shuffle(prefixes.begin(), prefixes.end(), gen);
+    std::map<std::string, std::string> expected;
+    auto lsm = DBImpl::Create(options);
+    /* Each sorted run has the prefixes written in a period of time. */
+    for (auto p : prefixes) {
+      for (uint32_t j = 0; j < M; j++) {
+        auto key = make_key(p, j);
+        auto value = fmt::format("{}{}", key, gen());
+        lsm->Put(key, value);
+        expected[key] = value;
+      }
+    }
+    for (uint32_t p = 0; p < P; p += 5) {
+      lsm->Del(make_key(p, M / 2));
+      expected.erase(make_key(p, M / 2));
+    }
+    lsm->FlushAll();
+    lsm->WaitForFlushAndCompaction();
+    size_t num_runs = 0;
+    for (auto& level : lsm->GetSV()->GetVersion()->GetLevels()) {
+      num_runs += level.GetRuns().size();
+    }
+    ASSERT_GT(num_runs, 1);
+    GetStatsContext()->Reset();
+    for (uint32_t p = 0; p < P; p += 7) {
+      auto start = make_key(p, 3);
+      auto it = lsm->PrefixSeek(start);
+      auto exp = expected.lower_bound(start);
+      for (; it.Valid(); it.Next(), ++exp) {
+        ASSERT_TRUE(exp != expected.end());
+        ASSERT_EQ(it.key(), exp->first);
+        ASSERT_EQ(it.value(), exp->second);
+      }
+      /* It stops at the end of the prefix. */
+      ASSERT_TRUE(exp == expected.end() ||
+                  !exp->first.starts_with(start.substr(0, 8)));
+    }
+    /* Some runs do not have the prefix of a scan. */
+    ASSERT_GT(GetStatsContext()->total_prefix_filtered_runs.load(), 0);
+    /* The prefixes that are not in the database skip almost all the runs. */
+    GetStatsContext()->Reset();
+    uint32_t num_missing = 1000;
+    for (uint32_t p = P; p < P + num_missing; p++) {
+      auto it = lsm->PrefixSeek(make_key(p, 0));
+      ASSERT_FALSE(it.Valid());
+    }
+    ASSERT_GT(GetStatsContext()->total_prefix_filtered_runs.load(),
+        num_runs * num_missing * 0.9);
+    /* The whole keys are still in the filters. */
+    for (uint32_t p = 0; p < P; p += 11) {
+      for (uint32_t j = 0; j < M; j++) {
+        auto key = make_key(p, j);
+        std::string value;
+        ASSERT_EQ(lsm->Get(key, &value), expected.count(key) > 0);
+      }
+    }
+    lsm.reset();
+    std::filesystem::remove_all(options.db_path);
+  }
+}
+
+TEST(LSMTest, LSMDeleteRangeTest) {
+  Options options;
+  options.compaction_strategy_name = "leveled";
+  options.sst_file_size = 64 * 1024;
+  options.db_path = "__tmpLSMDeleteRangeTest/";
+  std::filesystem::remove_all(options.db_path);
+  std::filesystem::create_directories(options.db_path);
+  uint32_t N = 100000;
+  auto make_key = [](uint32_t i) { return fmt::format("{:08}", i); };
+  auto make_value = [](uint32_t i, uint32_t round) {
+    return fmt::format("{:0100}", i * 7 + round);
+  };
+  std::map<std::string, std::string> expected;
+  auto check = [&](DBImpl* lsm) {
+    for (uint32_t i = 0; i < N; i += 7) {
+      auto key = make_key(i);
+      std::string value;
+      auto it = expected.find(key);
+      ASSERT_EQ(lsm->Get(key, &value), it != expected.end());
+      if (it != expected.end()) {
+        ASSERT_EQ(value, it->second);
+      }
+    }
+    std::vector<std::string> keys;
+    for (uint32_t i = 0; i < N; i += 13) {
+      keys.push_back(make_key(i));
+    }
+    std::vector<Slice> slices(keys.begin(), keys.end());
+    auto results = lsm->MultiGet(slices);
+    for (size_t i = 0; i < keys.size(); i++) {
+      auto it = expected.find(keys[i]);
+      ASSERT_EQ(results[i].has_value(), it != expected.end());
+      if (it != expected.end()) {
+        ASSERT_EQ(*results[i], it->second);
+      }
+    }
+    auto it = lsm->Begin();
+    for (auto& [key, value] : expected) {
+      ASSERT_TRUE(it.Valid());
+      ASSERT_EQ(it.key(), key);
+      ASSERT_EQ(it.value(), value);
+      it.Next();
+    }
+    ASSERT_FALSE(it.Valid());
+    /* Seek into a deleted range skips it. */
+    auto seek_it = lsm->Seek(make_key(N / 4));
+    auto expected_it = expected.lower_bound(make_key(N / 4));
+    ASSERT_EQ(seek_it.Valid(), expected_it != expected.end());
+    if (expected_it != expected.end()) {
+      ASSERT_EQ(seek_it.key(), expected_it->first);
+    }
+  };
+  auto delete_range = [&](DBImpl* lsm, uint32_t begin, uint32_t end) {
+    lsm->DeleteRange(make_key(begin), make_key(end));
+    expected.erase(expected.lower_bound(make_key(begin)),
+        expected.lower_bound(make_key(end)));
+  };
+  GetStatsContext()->Reset();
+  {
+    auto lsm = DBImpl::Create(options);
+    for (uint32_t i = 0; i < N; i++) {
+      lsm->Put(make_key(i), make_value(i, 0));
+      expected[make_key(i)] = make_value(i, 0);
+    }
+    lsm->FlushAll();
+    lsm->WaitForFlushAndCompaction();
+    /* The tombstone is in the MemTable, and the records are in SSTables. */
+    delete_range(lsm.get(), N / 10, N / 2);
+    check(lsm.get());
+    /* The keys written after the deletion are not deleted. */
+    for (uint32_t i = N / 5; i < N / 5 + 1000; i++) {
+      lsm->Put(make_key(i), make_value(i, 1));
+      expected[make_key(i)] = make_value(i, 1);
+    }
+    check(lsm.get());
+    lsm->FlushAll();
+    lsm->WaitForFlushAndCompaction();
+    check(lsm.get());
+    /* The compactions drop the SSTables covered by the tombstone. */
+    for (uint32_t round = 2; round < 4; round++) {
+      for (uint32_t i = N / 2; i < N; i++) {
+        lsm->Put(make_key(i), make_value(i, round));
+        expected[make_key(i)] = make_value(i, round);
+      }
+      lsm->FlushAll();
+      lsm->WaitForFlushAndCompaction();
+    }
+    ASSERT_GT(GetStatsContext()->total_range_deleted_ssts.load(), 0);
+    check(lsm.get());
+    ASSERT_TRUE(SanityCheck(lsm.get()));
+    /* A tombstone in a batch, which stays in the MemTable. */
+    WriteBatch batch;
+    batch.Put(make_key(N / 2 - 1), make_value(N / 2 - 1, 4));
+    batch.DeleteRange(make_key(N / 2), make_key(N / 2 + 5000));
+    lsm->Write(batch);
+    expected[make_key(N / 2 - 1)] = make_value(N / 2 - 1, 4);
+    expected.erase(expected.lower_bound(make_key(N / 2)),
+        expected.lower_bound(make_key(N / 2 + 5000)));
+    check(lsm.get());
+  }
+  /* The tombstones are recovered from the MANIFEST. */
+  options.create_new = false;
+  {
+    auto lsm = DBImpl::Create(options);
+    check(lsm.get());
+    delete_range(lsm.get(), 0, N / 20);
+    lsm->FlushAll();
+    lsm->WaitForFlushAndCompaction();
+  }
+  {
+    auto lsm = DBImpl::Create(options);
+    check(lsm.get());
+  }
+  std::filesystem::remove_all(options.db_path);
+}
+
+TEST(LSMTest, LSMValueLogTest) {
+  uint32_t N = 20000, R = 3;
+  auto make_key = [](uint32_t i) { return fmt::format("{:08}", i); };
+  auto make_value = [](uint32_t i, uint32_t round) {
+    /* Some values are small and stay in the SSTables. */
+    return fmt::format("{:0{}}", i + round, i % 10 == 0 ? 16 : 1000);
+  };
+  auto run = [&](size_t min_blob_size, double blob_gc_age_cutoff = 0.25) {
+    Options options;
+    options.compaction_strategy_name = "leveled";
+    options.sst_file_size = 256 * 1024;
+    options.min_blob_size = min_blob_size;
+    options.blob_gc_age_cutoff = blob_gc_age_cutoff;
+    options.blob_file_size = 1 << 20;
+    options.db_path = "__tmpLSMValueLogTest/";
+    std::filesystem::remove_all(options.db_path);
+    std::filesystem::create_directories(options.db_path);
+    auto check = [&](DBImpl* lsm) {
+      for (uint32_t i = 0; i < N; i += 3) {
+        std::string value;
+        ASSERT_TRUE(lsm->Get(make_key(i), &value));
+        ASSERT_EQ(value, make_value(i, R - 1));
+      }
+      std::vector<std::string> keys;
+      for (uint32_t i = 0; i < N; i += 5) {
+        keys.push_back(make_key(i));
+      }
+      std::vector<Slice> slices(keys.begin(), keys.end());
+      auto results = lsm->MultiGet(slices);
+      for (uint32_t i = 0; i < keys.size(); i++) {
+        ASSERT_TRUE(results[i].has_value());
+        ASSERT_EQ(*results[i], make_value(i * 5, R - 1));
+      }
+      auto it = lsm->Begin();
+      for (uint32_t i = 0; i < N; i++) {
+        ASSERT_TRUE(it.Valid());
+        ASSERT_EQ(it.key(), make_key(i));
+        ASSERT_EQ(it.value(), make_value(i, R - 1));
+        it.Next();
+      }
+      ASSERT_FALSE(it.Valid());
+    };
+    GetStatsContext()->Reset();
+    {
+      auto lsm = DBImpl::Create(options);
+      for (uint32_t round = 0; round < R; round++) {
+        for (uint32_t i = 0; i < N; i++) {
+          lsm->Put(make_key(i), make_value(i, round));
+        }
+      }
+      lsm->FlushAll();
+      lsm->WaitForFlushAndCompaction();
+      check(lsm.get());
+      /* The blob files that no SSTable refers to are removed. */
+      std::set<std::string> referenced;
+      for (auto& level : lsm->GetSV()->GetVersion()->GetLevels()) {
+        for (auto& run : level.GetRuns()) {
+          for (auto& sst : run->GetSSTs()) {
+            for (auto id : sst->GetSSTInfo().blob_files_) {
+              referenced.insert(fmt::format("{}.blob", id));
+            }
+          }
+        }
+      }
+      std::set<std::string> on_disk;
+      for (auto& entry : std::filesystem::directory_iterator(options.db_path)) {
+        if (entry.path().extension() == ".blob") {
+          on_disk.insert(entry.path().filename().string());
+        }
+      }
+      EXPECT_EQ(on_disk, referenced);
+      EXPECT_EQ(referenced.empty(), min_blob_size == 0);
+    }
+    auto write_bytes = GetStatsContext()->total_write_bytes.load();
+    /* The SSTables refer to the blob files after the restart. */
+    options.create_new = false;
+    {
+      auto lsm = DBImpl::Create(options);
+      check(lsm.get());
+    }
+    std::filesystem::remove_all(options.db_path);
+    return write_bytes;
+  };
+  auto inline_bytes = run(0);
+  auto blob_bytes = run(512);
+  DB_INFO("Write bytes: {} inline, {} with the value log", inline_bytes,
+      blob_bytes);
+  /**
+   * The compactions do not rewrite the large values. The inline writes
+   * depend on how far the compactions fall behind, so the bound is loose.
+   */
+  ASSERT_LT(blob_bytes, inline_bytes * 2 / 3);
+  /* The compactions move the values of all the blob files. */
+  run(512, 1);
+}
+
+TEST(LSMTest, LSMReadaheadTest) {
+  uint32_t N = 100000;
+  auto kv = GenKVDataWithRandomLen(0x202410201100, N, {10, 10}, {1, 200});
+  std::map<std::string, std::string> expected;
+  for (auto& x : kv) {
+    expected[std::string(x.key())] = x.value();
+  }
+  for (size_t readahead : {0, 8}) {
+    Options options;
+    options.compaction_strategy_name = "leveled";
+    options.sst_file_size = 256 * 1024;
+    options.max_readahead_blocks = readahead;
+    options.db_path = fmt::format("__tmpLSMReadaheadTest{}/", readahead);
+    std::filesystem::remove_all(options.db_path);
+    std::filesystem::create_directories(options.db_path);
+    GetStatsContext()->Reset();
+    auto lsm = DBImpl::Create(options);
+    for (uint32_t i = 0; i < N; i++) {
+      lsm->Put(kv[i].key(), kv[i].value());
+    }
+    /* The compactions read their inputs ahead. */
+    lsm->FlushAll();
+    lsm->WaitForFlushAndCompaction();
+    auto it = lsm->Begin();
+    for (auto& [key, value] : expected) {
+      ASSERT_TRUE(it.Valid());
+      ASSERT_EQ(it.key(), key);
+      ASSERT_EQ(it.value(), value);
+      it.Next();
+    }
+    ASSERT_FALSE(it.Valid());
+    /* Short scans after seeks. */
+    for (uint32_t i = 0; i < N; i += 997) {
+      auto it = lsm->Seek(kv[i].key());
+      auto exp = expected.find(std::string(kv[i].key()));
+      for (int j = 0; j < 10 && exp != expected.end(); j++, ++exp) {
+        ASSERT_TRUE(it.Valid());
+        ASSERT_EQ(it.key(), exp->first);
+        ASSERT_EQ(it.value(), exp->second);
+        it.Next();
+      }
+    }
+    auto blocks = GetStatsContext()->total_readahead_blocks.load();
+    DB_INFO("max_readahead_blocks: {}, blocks read ahead: {}", readahead,
+        blocks);
+    if (readahead == 0) {
+      ASSERT_EQ(blocks, 0);
+    } else {
+      ASSERT_GT(blocks, 0);
+    }
+  }
+}
+
+TEST(LSMTest, LSMMmapReadTest) {
+  Options options;
+  options.compaction_strategy_name = "leveled";
+  options.sst_file_size = 256 * 1024;
+  options.use_mmap_reads = true;
+  options.db_path = "__tmpLSMMmapReadTest/";
+  std::filesystem::remove_all(options.db_path);
+  std::filesystem::create_directories(options.db_path);
+  uint32_t N = 100000;
+  auto kv = GenKVDataWithRandomLen(0x202410201500, N, {10, 10}, {1, 200});
+  std::map<std::string, std::string> expected;
+  for (auto& x : kv) {
+    expected[std::string(x.key())] = x.value();
+  }
+  auto check = [&](DBImpl* lsm) {
+    for (uint32_t i = 0; i < N; i += 7) {
+      std::string value;
+      ASSERT_TRUE(lsm->Get(kv[i].key(), &value));
+      ASSERT_EQ(value, expected[std::string(kv[i].key())]);
+    }
+    auto it = lsm->Begin();
+    for (auto& [key, value] : expected) {
+      ASSERT_TRUE(it.Valid());
+      ASSERT_EQ(it.key(), key);
+      ASSERT_EQ(it.value(), value);
+      it.Next();
+    }
+    ASSERT_FALSE(it.Valid());
+    /* The blocks are read from the mappings, not the block cache. */
+    auto stats = lsm->GetCacheStats();
+    ASSERT_EQ(stats.hits_ + stats.misses_, 0);
+  };
+  {
+    auto lsm = DBImpl::Create(options);
+    for (uint32_t i = 0; i < N; i++) {
+      lsm->Put(kv[i].key(), kv[i].value());
+    }
+    lsm->FlushAll();
+    lsm->WaitForFlushAndCompaction();
+    check(lsm.get());
+  }
+  options.create_new = false;
+  {
+    auto lsm = DBImpl::Create(options);
+    check(lsm.get());
+  }
+  std::filesystem::remove_all(options.db_path);
+}
+
+TEST(LSMTest, LSMRowCacheTest) {
+  uint32_t N = 100000, M = 200000;
+  auto kv = GenKVDataWithRandomLen(0x202410201900, N, {10, 10}, {1, 100});
+  /**
+   * The same memory for the block cache, or for both caches. Return the
+   * hit rate of the cache above the tree, and the number of blocks read.
+   */
+  auto run = [&](bool use_row_cache) {
+    Options options;
+    options.compaction_strategy_name = "leveled";
+    options.sst_file_size = 256 * 1024;
+    options.cache.capacity = 2 << 20;
+    if (use_row_cache) {
+      options.cache.capacity = 1 << 20;
+      options.row_cache_options.capacity = 1 << 20;
+    }
+    options.db_path = "__tmpLSMRowCacheTest/";
+    std::filesystem::remove_all(options.db_path);
+    std::filesystem::create_directories(options.db_path);
+    auto lsm = DBImpl::Create(options);
+    std::map<std::string, std::optional<std::string>> expected;
+    for (uint32_t i = 0; i < N; i++) {
+      lsm->Put(kv[i].key(), kv[i].value());
+      expected[std::string(kv[i].key())] = kv[i].value();
+    }
+    lsm->FlushAll();
+    lsm->WaitForFlushAndCompaction();
+    std::mt19937_64 gen(0x202410201930);
+    zipf_distribution<> zipf(N, 0.99);
+    /* The hit rate of a read-only skewed workload after a warm-up. */
+    auto read = [&]() {
+      for (uint32_t i = 0; i < M; i++) {
+        auto key = std::string(kv[zipf(gen) - 1].key());
+        std::string value;
+        EXPECT_TRUE(lsm->Get(key, &value));
+      }
+    };
+    read();
+    auto cache_before = lsm->GetCacheStats();
+    auto row_cache_before = lsm->GetRowCacheStats();
+    read();
+    auto cache = lsm->GetCacheStats();
+    auto row_cache = lsm->GetRowCacheStats();
+    double hits = use_row_cache ? row_cache.hits_ - row_cache_before.hits_
+                                : cache.hits_ - cache_before.hits_;
+    double misses = use_row_cache
+                        ? row_cache.misses_ - row_cache_before.misses_
+                        : cache.misses_ - cache_before.misses_;
+    auto block_reads = cache.misses_ - cache_before.misses_;
+    for (uint32_t i = 0; i < M; i++) {
+      auto key = std::string(kv[zipf(gen) - 1].key());
+      /* The cached rows are invalidated by the writes. */
+      if (i % 50 == 0) {
+        lsm->Put(key, fmt::format("updated{}", i));
+        expected[key] = fmt::format("updated{}", i);
+      } else if (i % 50 == 25) {
+        lsm->Del(key);
+        expected[key] = std::nullopt;
+      }
+      std::string value;
+      EXPECT_EQ(lsm->Get(key, &value), expected[key].has_value());
+      if (expected[key]) {
+        EXPECT_EQ(value, *expected[key]);
+      }
+    }
+    /* A range deletion invalidates all the rows. */
+    auto begin = std::string(kv[0].key());
+    lsm->DeleteRange("A", "{");
+    std::string value;
+    EXPECT_FALSE(lsm->Get(begin, &value));
+    lsm->Put(begin, "new");
+    EXPECT_TRUE(lsm->Get(begin, &value));
+    EXPECT_EQ(value, "new");
+    return std::make_pair(hits / (hits + misses), block_reads);
+  };
+  auto [block_hit_rate, block_reads] = run(false);
+  auto [row_hit_rate, row_block_reads] = run(true);
+  DB_INFO("Hit rate: {} of the block cache, {} of the row cache",
+      block_hit_rate, row_hit_rate);
+  DB_INFO("Blocks read: {} without the row cache, {} with it", block_reads,
+      row_block_reads);
+  /* Most of the lookups of the hot keys do not go into the tree. */
+  ASSERT_GT(row_hit_rate, 0.5);
+  ASSERT_LT(row_block_reads, block_reads * 0.8);
+  std::filesystem::remove_all("__tmpLSMRowCacheTest/");
+}
+
+TEST(LSMTest, LSMThreadLocalSVTest) {
+  Options options;
+  options.compaction_strategy_name = "leveled";
+  options.sst_file_size = 64 * 1024;
+  options.db_path = "__tmpLSMThreadLocalSVTest/";
+  std::filesystem::remove_all(options.db_path);
+  std::filesystem::create_directories(options.db_path);
+  uint32_t N = 20000, TH = 4;
+  auto make_key = [](uint32_t i) { return fmt::format("{:08}", i); };
+  auto make_value = [](uint32_t i, uint32_t round) {
+    return fmt::format("{:08}-{}", i, round);
+  };
+  auto lsm = DBImpl::Create(options);
+  for (uint32_t i = 0; i < N; i++) {
+    lsm->Put(make_key(i), make_value(i, 0));
+  }
+  std::atomic<bool> stop{false}, exit{false};
+  std::atomic<uint32_t> parked{0};
+  std::vector<std::thread> readers;
+  for (uint32_t t = 0; t < TH; t++) {
+    readers.emplace_back([&, t]() {
+      std::mt19937_64 gen(0x202410202100 + t);
+      auto check = [&]() {
+        uint32_t i = gen() % N;
+        std::string value;
+        EXPECT_TRUE(lsm->Get(make_key(i), &value));
+        EXPECT_EQ(value.substr(0, 8), make_key(i));
+      };
+      while (!stop) {
+        check();
+      }
+      /* The thread keeps its cached SuperVersion while it is idle. */
+      check();
+      parked += 1;
+      while (!exit) {
+        std::this_thread::yield();
+      }
+    });
+  }
+  /* The SuperVersion changes while the threads are reading. */
+  for (uint32_t round = 1; round <= 3; round++) {
+    for (uint32_t i = 0; i < N; i++) {
+      lsm->Put(make_key(i), make_value(i, round));
+    }
+    lsm->FlushAll();
+    lsm->WaitForFlushAndCompaction();
+  }
+  stop = true;
+  while (parked < TH) {
+    std::this_thread::yield();
+  }
+  /* The SuperVersions cached by the idle threads do not keep old SSTables. */
+  for (uint32_t i = 0; i < N; i++) {
+    lsm->Put(make_key(i), make_value(i, 4));
+  }
+  lsm->FlushAll();
+  lsm->WaitForFlushAndCompaction();
+  std::set<std::string> live;
+  for (auto& level : lsm->GetSV()->GetVersion()->GetLevels()) {
+    for (auto& run : level.GetRuns()) {
+      for (auto& sst : run->GetSSTs()) {
+        live.insert(std::filesystem::path(sst->GetSSTInfo().filename_)
+                        .filename()
+                        .string());
+      }
+    }
+  }
+  std::set<std::string> on_disk;
+  for (auto& entry : std::filesystem::directory_iterator(options.db_path)) {
+    if (entry.path().extension() == ".sst") {
+      on_disk.insert(entry.path().filename().string());
+    }
+  }
+  ASSERT_EQ(on_disk, live);
+  for (uint32_t i = 0; i < N; i += 7) {
+    std::string value;
+    ASSERT_TRUE(lsm->Get(make_key(i), &value));
+    ASSERT_EQ(value, make_value(i, 4));
+  }
+  /* The threads leave after the database is destroyed. */
+  lsm.reset();
+  exit = true;
+  for (auto& t : readers) {
+    t.join();
+  }
+  std::filesystem::remove_all(options.db_path);
+}
+
+TEST(LSMTest, LSMSnapshotTest) {
+  Options options;
+  options.compaction_strategy_name = "leveled";
+  options.sst_file_size = 64 * 1024;
+  options.write_buffer_size = 256 * 1024;
+  options.db_path = "__tmpLSMSnapshotTest/";
+  std::filesystem::remove_all(options.db_path);
+  std::filesystem::create_directories(options.db_path);
+  uint32_t N = 50000;
+  auto make_key = [](uint32_t i) { return fmt::format("{:08}", i); };
+  auto make_value = [](uint32_t i, uint32_t round) {
+    return fmt::format("{:0100}", i * 7 + round);
+  };
+  using Expected = std::map<std::string, std::string>;
+  auto check = [&](DBImpl* lsm, const Snapshot* snapshot,
+                   const Expected& expected) {
+    for (uint32_t i = 0; i < N; i += 7) {
+      auto key = make_key(i);
+      std::string value;
+      auto it = expected.find(key);
+      ASSERT_EQ(lsm->Get(key, &value, snapshot), it != expected.end());
+      if (it != expected.end()) {
+        ASSERT_EQ(value, it->second);
+      }
+    }
+    std::vector<std::string> keys;
+    for (uint32_t i = 0; i < N; i += 13) {
+      keys.push_back(make_key(i));
+    }
+    std::vector<Slice> slices(keys.begin(), keys.end());
+    auto results = lsm->MultiGet(slices, snapshot);
+    for (size_t i = 0; i < keys.size(); i++) {
+      auto it = expected.find(keys[i]);
+      ASSERT_EQ(results[i].has_value(), it != expected.end());
+      if (it != expected.end()) {
+        ASSERT_EQ(*results[i], it->second);
+      }
+    }
+    auto it = lsm->Begin(snapshot);
+    for (auto& [key, value] : expected) {
+      ASSERT_TRUE(it.Valid());
+      ASSERT_EQ(it.key(), key);
+      ASSERT_EQ(it.value(), value);
+      it.Next();
+    }
+    ASSERT_FALSE(it.Valid());
+  };
+  auto count_records = [](DBImpl* lsm) {
+    size_t count = 0;
+    for (auto& level : lsm->GetSV()->GetVersion()->GetLevels()) {
+      for (auto& run : level.GetRuns()) {
+        for (auto& sst : run->GetSSTs()) {
+          count += sst->GetSSTInfo().count_;
+        }
+      }
+    }
+    return count;
+  };
+  auto lsm = DBImpl::Create(options);
+  Expected expected;
+  for (uint32_t i = 0; i < N; i++) {
+    lsm->Put(make_key(i), make_value(i, 0));
+    expected[make_key(i)] = make_value(i, 0);
+  }
+  auto snapshot0 = lsm->GetSnapshot();
+  auto expected0 = expected;
+  /* Overwrite, delete and delete a range after the first snapshot. */
+  for (uint32_t i = 0; i < N; i++) {
+    lsm->Put(make_key(i), make_value(i, 1));
+    expected[make_key(i)] = make_value(i, 1);
+  }
+  for (uint32_t i = 0; i < N; i += 3) {
+    lsm->Del(make_key(i));
+    expected.erase(make_key(i));
+  }
+  lsm->DeleteRange(make_key(N / 4), make_key(N / 2));
+  expected.erase(expected.lower_bound(make_key(N / 4)),
+      expected.lower_bound(make_key(N / 2)));
+  auto snapshot1 = lsm->GetSnapshot();
+  auto expected1 = expected;
+  check(lsm.get(), snapshot0, expected0);
+  check(lsm.get(), snapshot1, expected1);
+  /* The compactions keep the records that the snapshots see. */
+  for (uint32_t round = 2; round <= 4; round++) {
+    for (uint32_t i = 0; i < N; i++) {
+      lsm->Put(make_key(i), make_value(i, round));
+      expected[make_key(i)] = make_value(i, round);
+    }
+    lsm->FlushAll();
+    lsm->WaitForFlushAndCompaction();
+    check(lsm.get(), snapshot0, expected0);
+    check(lsm.get(), snapshot1, expected1);
+    check(lsm.get(), nullptr, expected);
+  }
+  ASSERT_GE(count_records(lsm.get()), 2 * N);
+  /* The records of the released snapshot are dropped, and the other one
+   * still sees its records. */
+  lsm->ReleaseSnapshot(snapshot0);
+  lsm->DeleteRange(make_key(0), make_key(N / 10));
+  expected.erase(expected.begin(), expected.lower_bound(make_key(N / 10)));
+  for (uint32_t round = 5; round <= 6; round++) {
+    for (uint32_t i = N / 10; i < N; i++) {
+      lsm->Put(make_key(i), make_value(i, round));
+      expected[make_key(i)] = make_value(i, round);
+    }
+    lsm->FlushAll();
+    lsm->WaitForFlushAndCompaction();
+    check(lsm.get(), snapshot1, expected1);
+    check(lsm.get(), nullptr, expected);
+  }
+  lsm->ReleaseSnapshot(snapshot1);
+  for (uint32_t i = N / 10; i < N; i++) {
+    lsm->Put(make_key(i), make_value(i, 7));
+    expected[make_key(i)] = make_value(i, 7);
+  }
+  lsm->FlushAll();
+  lsm->WaitForFlushAndCompaction();
+  check(lsm.get(), nullptr, expected);
+  /* Reopen the database. The snapshots do not survive it. */
+  lsm.reset();
+  options.create_new = false;
+  lsm = DBImpl::Create(options);
+  check(lsm.get(), nullptr, expected);
+  lsm.reset();
+  std::filesystem::remove_all(options.db_path);
+}
+
+TEST(LSMTest, LSMBackgroundJobsTest) {
+  Options options;
+  options.compaction_strategy_name = "leveled";
+  options.sst_file_size = 16 * 1024;
+  options.max_immutable_count = 8;
+  options.max_background_flushes = 4;
+  options.max_background_compactions = 3;
+  options.db_path = "__tmpLSMBackgroundJobsTest/";
+  std::filesystem::remove_all(options.db_path);
+  std::filesystem::create_directories(options.db_path);
+  uint32_t N = 20000;
+  auto kv = GenKVDataWithRandomLen(0x202410190010, N, {10, 10}, {1, 100});
+  std::map<std::string, std::string> expected;
+  {
+    auto lsm = DBImpl::Create(options);
+    /**
+     * The newer versions must win, although the MemTables are flushed in
+     * parallel and may finish in any order.
+     */
+    for (int round = 0; round < 4; round++) {
+      for (uint32_t i = 0; i < N; i++) {
+        auto value = fmt::format("{}{}", kv[i].value(), round);
+        lsm->Put(kv[i].key(), value);
+        expected[std::string(kv[i].key())] = value;
+      }
+    }
+    lsm->FlushAll();
+    lsm->WaitForFlushAndCompaction();
+    ASSERT_TRUE(SanityCheck(lsm.get()));
+    for (auto& [key, value] : expected) {
+      std::string result;
+      ASSERT_TRUE(lsm->Get(key, &result));
+      ASSERT_EQ(result, value);
+    }
+    auto it = lsm->Begin();
+    for (auto& [key, value] : expected) {
+      ASSERT_TRUE(it.Valid());
+      ASSERT_EQ(it.key(), key);
+      ASSERT_EQ(it.value(), value);
+      it.Next();
+    }
+    ASSERT_FALSE(it.Valid());
+  }
+  std::filesystem::remove_all(options.db_path);
+}
+
+TEST(LSMTest, LSMWriteStallTest) {
+  {
+    /* The delayed writes are limited to the write rate. */
+    WriteController controller(1024 * 1024);
+    controller.SetState(WriteState::kDelayed);
+    wing::StopWatch sw;
+    for (int i = 0; i < 64; i++) {
+      controller.DelayWrite(4096);
+    }
+    ASSERT_GT(sw.GetTimeInSeconds(), 0.2);
+    /* The stopped writes resume when the state changes. */
+    controller.SetState(WriteState::kStopped);
+    std::atomic<bool> done{false};
+    std::thread writer([&]() {
+      controller.DelayWrite(1);
+      done = true;
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    ASSERT_FALSE(done);
+    controller.SetState(WriteState::kNormal);
+    writer.join();
+    ASSERT_TRUE(done);
+  }
+  Options options;
+  options.compaction_strategy_name = "leveled";
+  options.sst_file_size = 32 * 1024;
+  options.level0_slowdown_writes_trigger = 2;
+  options.delayed_write_rate = 4 * 1024 * 1024;
+  options.db_path = "__tmpLSMWriteStallTest/";
+  std::filesystem::remove_all(options.db_path);
+  std::filesystem::create_directories(options.db_path);
+  uint32_t N = 50000;
+  auto kv = GenKVDataWithRandomLen(0x202410182130, N, {10, 10}, {1, 100});
+  GetStatsContext()->Reset();
+  {
+    auto lsm = DBImpl::Create(options);
+    double max_latency = 0;
+    for (uint32_t i = 0; i < N; i++) {
+      wing::StopWatch sw;
+      lsm->Put(kv[i].key(), kv[i].value());
+      max_latency = std::max(max_latency, sw.GetTimeInSeconds());
+    }
+    lsm->FlushAll();
+    lsm->WaitForFlushAndCompaction();
+    for (uint32_t i = 0; i < N; i++) {
+      std::string value;
+      ASSERT_TRUE(lsm->Get(kv[i].key(), &value));
+      ASSERT_EQ(value, kv[i].value());
+    }
+    ASSERT_GT(GetStatsContext()->total_write_delay_micros.load(), 0);
+    DB_INFO("Delayed {}us, stopped {}us, max latency {}s",
+        GetStatsContext()->total_write_delay_micros.load(),
+        GetStatsContext()->total_write_stop_micros.load(), max_latency);
+  }
+  std::filesystem::remove_all(options.db_path);
+}
+
+TEST(LSMTest, LSMWriteBatchTest) {
+  Options options;
+  options.compaction_strategy_name = "leveled";
+  options.sst_file_size = 1 << 20;
+  options.db_path = "__tmpLSMWriteBatchTest/";
+  std::filesystem::remove_all(options.db_path);
+  std::filesystem::create_directories(options.db_path);
+  uint32_t K = 16, R = 2000, T = 4;
+  {
+    auto lsm = DBImpl::Create(options);
+    /* Each batch sets all the keys to the same value. */
+    std::vector<std::thread> writers;
+    for (uint32_t t = 0; t < T; t++) {
+      writers.emplace_back([&, t]() {
+        for (uint32_t r = 0; r < R; r++) {
+          WriteBatch batch;
+          auto value = fmt::format("{}-{}-{}", t, r, std::string(200, 'v'));
+          for (uint32_t i = 0; i < K; i++) {
+            batch.Put(fmt::format("key{:04}", i), value);
+          }
+          lsm->Write(batch);
+        }
+      });
+    }
+    /* A scan reads a single sequence number, so it sees whole batches. */
+    std::atomic<bool> stop{false};
+    std::thread reader([&]() {
+      while (!stop) {
+        auto it = lsm->Begin();
+        std::string first;
+        uint32_t count = 0;
+        for (; it.Valid(); it.Next(), count++) {
+          if (count == 0) {
+            first = it.value();
+          }
+          ASSERT_EQ(it.value(), first);
+        }
+        ASSERT_TRUE(count == 0 || count == K);
+      }
+    });
+    for (auto& thread : writers) {
+      thread.join();
+    }
+    stop = true;
+    reader.join();
+    ASSERT_EQ(lsm->CurrentSeq(), K * R * T);
+
+    WriteBatch batch;
+    for (uint32_t i = 0; i < K; i += 2) {
+      batch.Del(fmt::format("key{:04}", i));
+    }
+    batch.Put("key9999", "last");
+    lsm->Write(batch);
+    ASSERT_EQ(lsm->CurrentSeq(), K * R * T + K / 2 + 1);
+  }
+  options.create_new = false;
+  {
+    auto lsm = DBImpl::Create(options);
+    std::string value, last;
+    for (uint32_t i = 0; i < K; i++) {
+      if (i % 2 == 0) {
+        ASSERT_FALSE(lsm->Get(fmt::format("key{:04}", i), &value));
+      } else {
+        ASSERT_TRUE(lsm->Get(fmt::format("key{:04}", i), &value));
+        if (last.empty()) {
+          last = value;
+        }
+        ASSERT_EQ(value, last);
+      }
+    }
+    ASSERT_TRUE(lsm->Get("key9999", &value));
+    ASSERT_EQ(value, "last");
+  }
+  std::filesystem::remove_all(options.db_path);
+}
+
+TEST(LSMTest, LSMSharedResourceTest) {
+  /* Many databases share 2 background threads and 1 MiB of block cache. */
+  CacheOptions cache_options;
+  cache_options.capacity = 1 << 20;
+  auto cache = std::make_shared<Cache>(cache_options);
+  auto scheduler = std::make_shared<Scheduler>(2);
+  auto subcompaction_scheduler = std::make_shared<Scheduler>(1);
+  auto readahead_scheduler = std::make_shared<Scheduler>(1);
+  uint32_t D = 8, N = 20000;
+  Options options;
+  options.sst_file_size = 256 * 1024;
+  options.block_cache = cache;
+  options.scheduler = scheduler;
+  options.max_subcompactions = 2;
+  options.subcompaction_scheduler = subcompaction_scheduler;
+  options.readahead_scheduler = readahead_scheduler;
+  std::vector<std::unique_ptr<DBImpl>> dbs;
+  for (uint32_t d = 0; d < D; d++) {
+    options.db_path = fmt::format("__tmpLSMSharedResourceTest/{}/", d);
+    std::filesystem::remove_all(options.db_path);
+    std::filesystem::create_directories(options.db_path);
+    dbs.push_back(DBImpl::Create(options));
+  }
+  std::vector<std::thread> writers;
+  for (uint32_t d = 0; d < D; d++) {
+    writers.emplace_back([&, d]() {
+      for (uint32_t i = 0; i < N; i++) {
+        dbs[d]->Put(fmt::format("key{:08}", i),
+            fmt::format("{}-{}-{}", d, i, std::string(50, 'v')));
+      }
+      dbs[d]->FlushAll();
+    });
+  }
+  for (auto& thread : writers) {
+    thread.join();
+  }
+  ASSERT_EQ(scheduler->GetThreadCount(), 2);
+  ASSERT_EQ(subcompaction_scheduler->GetThreadCount(), 1);
+  ASSERT_EQ(readahead_scheduler->GetThreadCount(), 1);
+  std::string value;
+  for (uint32_t d = 0; d < D; d++) {
+    dbs[d]->WaitForFlushAndCompaction();
+    for (uint32_t i = 0; i < N; i += 7) {
+      ASSERT_TRUE(dbs[d]->Get(fmt::format("key{:08}", i), &value));
+      ASSERT_EQ(value, fmt::format("{}-{}-{}", d, i, std::string(50, 'v')));
+    }
+  }
+  /* The budget is global: every database reports the same cache. */
+  auto stats = cache->GetStats();
+  ASSERT_EQ(dbs[0]->GetCacheStats().misses_, stats.misses_);
+  ASSERT_LE(stats.size_, cache_options.capacity);
+  ASSERT_GT(stats.evictions_, 0);
+  dbs.clear();
+  std::filesystem::remove_all("__tmpLSMSharedResourceTest");
+}
+
 TEST(LSMTest, LSMBigScanTest) {
   Options options;
   options.compaction_strategy_name = "leveled";